@@ -25,6 +25,7 @@ along with piccante.  If not, see <http://www.gnu.org/licenses/>.
 #define _USE_MATH_DEFINES
 //#define USE_HDF5
 #define _REORDER_MPI_CART_PROCESSES 1
+//#define _FLOAT_FIELDS
 
 #include <string>
 
@@ -91,6 +92,17 @@ enum particlesType{ ELECTRON, POSITRON, ION };
 
 
 
+//*****FIELD STORAGE*****
+// with _FLOAT_FIELDS the E and B arrays (and their halos and dumps) are stored in single precision and
+// the arithmetic on them is done in double; J and the densities (CURRENT) are always accumulated in double
+#ifdef _FLOAT_FIELDS
+typedef float fieldType;
+#define MPI_FIELD_TYPE MPI_FLOAT
+#else
+typedef double fieldType;
+#define MPI_FIELD_TYPE MPI_DOUBLE
+#endif
+
 //*****USEFUL FUNCTIONS*****
 template <class T>const T& MIN(const T& a, const T& b){
   return (a < b) ? a : b;
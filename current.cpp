@@ -22,16 +22,24 @@ along with piccante.  If not, see <http://www.gnu.org/licenses/>.
 CURRENT::CURRENT()
 {
   allocated = 0;
+  val = NULL;
   ZGrid_factor = YGrid_factor = 1;
+  zeroedVersion = -1;
 }
 
 CURRENT::~CURRENT()
 {
-  free(val);
+  bigArrays::release(val);
 }
 
 
 void CURRENT::allocate(GRID *grid) //field allocation
+{
+  allocate(grid, 4);
+}
+
+//ncomp components on the same grid as J, used as scratch by the diagnostics
+void CURRENT::allocate(GRID *grid, int ncomp)
 {
   mygrid = grid;
   acc.alloc_number(N_grid, mygrid->Nloc);
@@ -41,8 +49,8 @@ void CURRENT::allocate(GRID *grid) //field allocation
   if (N_grid[1] == 1)
     YGrid_factor = 0;
 
-  Ncomp = 4;
-  val = (double *)malloc(Ntot*Ncomp*sizeof(double));
+  Ncomp = ncomp;
+  val = (double *)bigArrays::allocate(Ntot*Ncomp*sizeof(double), MEM_CURRENT, bigArrays::gridTouchUnits(N_grid));
   allocated = 1;
 }
 //REALLOCATION only if load balancing is introduced
@@ -58,18 +66,30 @@ void CURRENT::reallocate()
     ZGrid_factor = 0;
   if (N_grid[1] == 1)
     YGrid_factor = 0;
-  val = (double *)realloc((void*)val, Ntot*Ncomp*sizeof(double));
+  val = (double *)bigArrays::reallocate((void*)val, Ntot*Ncomp*sizeof(double), MEM_CURRENT, bigArrays::gridTouchUnits(N_grid));
 }
 //set all values to zero!
 void CURRENT::setAllValuesToZero()  //set all the values to zero
 {
-  if (allocated)
-    memset((void*)val, 0, Ntot*Ncomp*sizeof(double));
-  else
+  if (!allocated)
   {
     printf("ERROR: current.setAllValuesToZero impossible");
     exit(17);
   }
+  if (!mygrid->isWithActiveRegion() || mygrid->getActiveRegionVersion() != zeroedVersion){
+    bigArrays::parallelZero((void*)val, Ntot*Ncomp*sizeof(double), bigArrays::gridTouchUnits(N_grid));
+    zeroedVersion = mygrid->getActiveRegionVersion();
+    return;
+  }
+  // the active region did not change since the last full zeroing: the current can only
+  // have been deposited on its runs
+  std::vector<int> runBegin, runEnd;
+  int Nruns = mygrid->getActiveRuns(-acc.edge, N_grid[0] - acc.edge, runBegin, runEnd);
+#pragma omp parallel for collapse(2)
+  for (int k = 0; k < N_grid[2]; k++)
+    for (int j = 0; j < N_grid[1]; j++)
+      for (int r = 0; r < Nruns; r++)
+        memset((void*)&JJ(0, runBegin[r], j - acc.edge, k - acc.edge), 0, (runEnd[r] - runBegin[r])*Ncomp*sizeof(double));
 }
 
 CURRENT CURRENT::operator = (CURRENT &destro)
@@ -132,7 +152,7 @@ void CURRENT::pbc()
   // same is done also for the charge density components of the field
   int i, j, k, c;
   int Nx, Ny, Nz, Nc = Ncomp;
-  int Ngx, Ngy, Ngz, sendcount;
+  int Ngy, Ngz, sendcount;
   int dimensions = acc.dimensions;
   int edge = acc.edge;
   int Nxchng = 2 * edge + 1;//, istart=(Nxchng-1)/2;
@@ -144,25 +164,31 @@ void CURRENT::pbc()
   Nx = mygrid->Nloc[0];
   Ny = mygrid->Nloc[1];
   Nz = mygrid->Nloc[2];
-  Ngx = N_grid[0];
   Ngy = N_grid[1];
   Ngz = N_grid[2];
+  // along y and z only the x columns of the active region are exchanged
+  std::vector<int> runBegin, runEnd, column;
+  int Nruns = mygrid->getActiveRuns(-edge, Nx + edge, runBegin, runEnd);
+  for (int r = 0; r < Nruns; r++)
+    for (i = runBegin[r]; i < runEnd[r]; i++)
+      column.push_back(i + edge);
+  int Ncol = (int)column.size();
 
   if (dimensions == 3)
   {
     //send boundaries along z
 
-    sendcount = Ngx*Ngy*Nxchng*Nc;
+    sendcount = Ncol*Ngy*Nxchng*Nc;
     send_buffer = (double *)malloc(sendcount*sizeof(double));
     recv_buffer = (double *)malloc(sendcount*sizeof(double));
 
     // ======   send right: send_buff=right_edge
     for (k = 0; k < Nxchng; k++)
       for (j = 0; j < Ngy; j++)
-        for (i = 0; i < Ngx; i++)
+        for (i = 0; i < Ncol; i++)
           for (c = 0; c < Nc; c++)
           {
-      send_buffer[c + i*Nc + j*Nc*Ngx + k*Nc*Ngx*Ngy] = JJ(c, i - edge, j - edge, (Nz - 1) - edge + k);
+      send_buffer[c + i*Nc + j*Nc*Ncol + k*Nc*Ncol*Ngy] = JJ(c, column[i] - edge, j - edge, (Nz - 1) - edge + k);
           }
 
     // ====== send edge to right receive from left
@@ -175,11 +201,11 @@ void CURRENT::pbc()
     // ====== add recv_buffer to left_edge and send back to left the result
     for (k = 0; k < Nxchng; k++)
       for (j = 0; j < Ngy; j++)
-        for (i = 0; i < Ngx; i++)
+        for (i = 0; i < Ncol; i++)
           for (c = 0; c < Nc; c++)
           {
-      JJ(c, i - edge, j - edge, k - edge) += recv_buffer[c + i*Nc + j*Nc*Ngx + k*Nc*Ngx*Ngy];
-      send_buffer[c + i*Nc + j*Nc*Ngx + k*Nc*Ngx*Ngy] = JJ(c, i - edge, j - edge, k - edge);
+      JJ(c, column[i] - edge, j - edge, k - edge) += recv_buffer[c + i*Nc + j*Nc*Ncol + k*Nc*Ncol*Ngy];
+      send_buffer[c + i*Nc + j*Nc*Ncol + k*Nc*Ncol*Ngy] = JJ(c, column[i] - edge, j - edge, k - edge);
           }
 
     // ====== send to left receive from right
@@ -190,10 +216,10 @@ void CURRENT::pbc()
     // ====== copy recv_buffer to the right edge
     for (k = 0; k < Nxchng; k++)
       for (j = 0; j < Ngy; j++)
-        for (i = 0; i < Ngx; i++)
+        for (i = 0; i < Ncol; i++)
           for (c = 0; c < Nc; c++)
           {
-      JJ(c, i - edge, j - edge, (Nz - 1) - edge + k) = recv_buffer[c + i*Nc + j*Nc*Ngx + k*Nc*Ngx*Ngy];
+      JJ(c, column[i] - edge, j - edge, (Nz - 1) - edge + k) = recv_buffer[c + i*Nc + j*Nc*Ncol + k*Nc*Ncol*Ngy];
           }
 
     // ===== finished, now free the send  recv buffers
@@ -205,17 +231,17 @@ void CURRENT::pbc()
   {
     // ===============    send boundaries along y  ============
 
-    sendcount = Ngx*Nxchng*Ngz*Nc;
+    sendcount = Ncol*Nxchng*Ngz*Nc;
     send_buffer = (double *)malloc(sendcount*sizeof(double));
     recv_buffer = (double *)malloc(sendcount*sizeof(double));
 
     // ======   send right: send_buff=right_edge
     for (k = 0; k < Ngz; k++)
       for (j = 0; j < Nxchng; j++)
-        for (i = 0; i < Ngx; i++)
+        for (i = 0; i < Ncol; i++)
           for (c = 0; c < Nc; c++)
           {
-      send_buffer[c + i*Nc + j*Nc*Ngx + k*Nc*Ngx*Nxchng] = JJ(c, i - edge, (Ny - 1) - edge + j, k - edge);
+      send_buffer[c + i*Nc + j*Nc*Ncol + k*Nc*Ncol*Nxchng] = JJ(c, column[i] - edge, (Ny - 1) - edge + j, k - edge);
           }
 
     // ====== send edge to right receive from left
@@ -228,11 +254,11 @@ void CURRENT::pbc()
     // ====== add recv_buffer to left_edge and send back to left the result
     for (k = 0; k < Ngz; k++)
       for (j = 0; j < Nxchng; j++)
-        for (i = 0; i < Ngx; i++)
+        for (i = 0; i < Ncol; i++)
           for (c = 0; c < Nc; c++)
           {
-      JJ(c, i - edge, j - edge, k - edge) += recv_buffer[c + i*Nc + j*Nc*Ngx + k*Nc*Ngx*Nxchng];
-      send_buffer[c + i*Nc + j*Nc*Ngx + k*Nc*Ngx*Nxchng] = JJ(c, i - edge, j - edge, k - edge);
+      JJ(c, column[i] - edge, j - edge, k - edge) += recv_buffer[c + i*Nc + j*Nc*Ncol + k*Nc*Ncol*Nxchng];
+      send_buffer[c + i*Nc + j*Nc*Ncol + k*Nc*Ncol*Nxchng] = JJ(c, column[i] - edge, j - edge, k - edge);
           }
 
     // ====== send to left receive from right
@@ -243,10 +269,10 @@ void CURRENT::pbc()
     // ====== copy recv_buffer to the right edge
     for (k = 0; k < Ngz; k++)
       for (j = 0; j < Nxchng; j++)
-        for (i = 0; i < Ngx; i++)
+        for (i = 0; i < Ncol; i++)
           for (c = 0; c < Nc; c++)
           {
-      JJ(c, i - edge, (Ny - 1) - edge + j, k - edge) = recv_buffer[c + i*Nc + j*Nc*Ngx + k*Nc*Ngx*Nxchng];
+      JJ(c, column[i] - edge, (Ny - 1) - edge + j, k - edge) = recv_buffer[c + i*Nc + j*Nc*Ncol + k*Nc*Ncol*Nxchng];
           }
 
     // ===== finished, now free the send  recv buffers
@@ -320,3 +346,24 @@ void CURRENT::eraseDensity(){
       }
 }
 
+
+//the ghost cells are left as they are: the field solver reads J only on the local points
+void CURRENT::applyFilter(filterStack &stack, int flags, int dirflags){
+  int comps[4], ncomp = 0;
+  for (int c = 0; c < Ncomp; c++){
+    if (flags & (1 << c))
+      comps[ncomp++] = c;
+  }
+  if (ncomp == 0)
+    return;
+
+  int stride[3];
+  stride[0] = Ncomp;
+  stride[1] = YGrid_factor*Ncomp*N_grid[0];
+  stride[2] = ZGrid_factor*Ncomp*N_grid[0] * N_grid[1];
+
+  for (int d = 0; d < acc.dimensions; d++){
+    if (dirflags & (1 << d))
+      stack.applyAlong(mygrid, d, &JJ(0, 0, 0, 0), stride, ncomp, comps);
+  }
+}
@@ -35,6 +35,12 @@ along with piccante.  If not, see <http://www.gnu.org/licenses/>.
 #include "grid.h"
 #include "structures.h"
 
+enum currentFilterOptions{
+  fltr_Jx = 1 << 0,
+  fltr_Jy = 1 << 1,
+  fltr_Jz = 1 << 2,
+  fltr_rho = 1 << 3
+};
 
 class CURRENT{
 public:
@@ -44,6 +50,7 @@ public:
   CURRENT();
   ~CURRENT();
   void allocate(GRID *grid); //field allocation 
+  void allocate(GRID *grid, int ncomp);
   void reallocate();	//REALLOCATION only if load balancing is introduced
   void setAllValuesToZero();
   CURRENT operator = (CURRENT &destro);
@@ -55,6 +62,8 @@ public:
 
   void eraseDensity();
 
+  void applyFilter(filterStack &stack, int flags, int dirflags);
+
   //PUBLIC INLINE FUNCTIONS
   inline double & Jx(int i, int j, int k){ return val[my_indice(acc.edge, YGrid_factor, ZGrid_factor, 0, i, j*YGrid_factor, k*ZGrid_factor, N_grid[0], N_grid[1], N_grid[2], Ncomp)]; }
   inline double & Jy(int i, int j, int k){ return val[my_indice(acc.edge, YGrid_factor, ZGrid_factor, 1, i, j*YGrid_factor, k*ZGrid_factor, N_grid[0], N_grid[1], N_grid[2], Ncomp)]; }
@@ -69,9 +78,10 @@ private:
   long int Ntot;
   int ZGrid_factor, YGrid_factor;
   ACCESSO acc;    // object distinguishing 1-2-3 D
-  double *val; //   THE BIG poiniter
+  double *val; //   THE BIG poiniter (double also with _FLOAT_FIELDS)
   GRID *mygrid;         // pointer to the GIRD object 
   int allocated;  //flag 1-0 allocaded-not alloc
+  int zeroedVersion;  //active region version of the last full zeroing
 
   //PRIVATE INLINE FUNCTIONS
   inline int my_indice(int edge, int YGrid_factor, int ZGrid_factor, int c, int i, int j, int k, int Nx, int Ny, int Nz, int Nc){
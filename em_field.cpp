@@ -30,11 +30,19 @@ EM_FIELD::EM_FIELD()
   total_energy[6] = 0;
   maxima[6] = maxima[7] = 0;
   ZGrid_factor = YGrid_factor = 1;
+  xOrigin = xSlack = 0;
   EBEnergyExtremesFlag = false;
+  NenergyRegions = 0;
+  reductionOffset[0] = -1;
+  spectralGuard = 16;
+  spectralOrder = -1;
+  specVal = NULL;
+  tileCacheBytes = 1024 * 1024;
 }
 
 EM_FIELD::~EM_FIELD(){
-  free(val);
+  bigArrays::release(val);
+  bigArrays::release(specVal);
 }
 
 void EM_FIELD::allocate(GRID *grid){
@@ -45,12 +53,19 @@ void EM_FIELD::allocate(GRID *grid){
   if (N_grid[1] == 1)
     YGrid_factor = 0;
 
-  Ntot = ((long int)N_grid[0]) * ((long int)N_grid[1]) * ((long int)N_grid[2]);
+  xOrigin = 0;
+  xSlack = 0;
+  if (mygrid->isWithMovingWindow())
+    xSlack = MAX(1, mygrid->Nloc[0] / windowSlackFraction);
+  NxAlloc = N_grid[0] + xSlack;
+
+  Ntot = ((long int)NxAlloc) * ((long int)N_grid[1]) * ((long int)N_grid[2]);
   Ncomp = 6;
-  val = (double *)malloc(Ntot*Ncomp*sizeof(double));
+  val = (fieldType *)bigArrays::allocate(Ntot*Ncomp*sizeof(fieldType), MEM_FIELDS, bigArrays::gridTouchUnits(N_grid));
   allocated = true;
   EM_FIELD::setAllValuesToZero();
   EBEnergyExtremesFlag = false;
+  checkFieldSolver();
 }
 
 void EM_FIELD::reallocate(){
@@ -64,16 +79,22 @@ void EM_FIELD::reallocate(){
   if (N_grid[1] == 1)
     YGrid_factor = 0;
 
-  Ntot = ((long int)N_grid[0]) * ((long int)N_grid[1]) * ((long int)N_grid[2]);
+  xOrigin = 0;
+  xSlack = 0;
+  if (mygrid->isWithMovingWindow())
+    xSlack = MAX(1, mygrid->Nloc[0] / windowSlackFraction);
+  NxAlloc = N_grid[0] + xSlack;
+
+  Ntot = ((long int)NxAlloc) * ((long int)N_grid[1]) * ((long int)N_grid[2]);
   Ncomp = 6;
-  val = (double *)realloc((void*)val, Ntot*Ncomp*sizeof(double));
+  val = (fieldType *)bigArrays::reallocate((void*)val, Ntot*Ncomp*sizeof(fieldType), MEM_FIELDS, bigArrays::gridTouchUnits(N_grid));
   EBEnergyExtremesFlag = false;
 }
 //set all values to zero!
 void EM_FIELD::setAllValuesToZero()  //set all the values to zero
 {
   if (allocated)
-    memset((void*)val, 0, Ntot*Ncomp*sizeof(double));
+    bigArrays::parallelZero((void*)val, Ntot*Ncomp*sizeof(fieldType), bigArrays::gridTouchUnits(N_grid));
   else		{
     printf("ERROR: erase_field\n");
     exit(17);
@@ -93,7 +114,8 @@ EM_FIELD EM_FIELD::operator = (EM_FIELD &destro)
     allocate(destro.mygrid);
   }
   else reallocate();
-  memcpy((void*)val, (void*)destro.val, Ntot*Ncomp*sizeof(double));
+  memcpy((void*)val, (void*)destro.val, Ntot*Ncomp*sizeof(fieldType));
+  xOrigin = destro.xOrigin;
   return *this;
 }
 
@@ -139,7 +161,7 @@ bool EM_FIELD::areEnergyExtremesAvailable(){
   return EBEnergyExtremesFlag;
 }
 
-int EM_FIELD::pbc_compute_alloc_size(){
+int EM_FIELD::pbc_compute_alloc_size(int Nxchng){
   int dimensions = acc.dimensions;
   int allocated_size;
   int Ngx, Ngy, Ngz, Nc = Ncomp;
@@ -149,22 +171,22 @@ int EM_FIELD::pbc_compute_alloc_size(){
   Ngz = N_grid[2];
 
   if (dimensions == 3){
-    allocated_size = Nc*Ngy*Ngz*acc.Nexchange;;
-    allocated_size = MAX(allocated_size, Nc*Ngx*Ngz*acc.Nexchange);
-    allocated_size = MAX(allocated_size, Nc*Ngx*Ngy*acc.Nexchange);
+    allocated_size = Nc*Ngy*Ngz*Nxchng;
+    allocated_size = MAX(allocated_size, Nc*Ngx*Ngz*Nxchng);
+    allocated_size = MAX(allocated_size, Nc*Ngx*Ngy*Nxchng);
   }
   else if (dimensions == 2){
-    allocated_size = Nc*Ngy*acc.Nexchange;
-    allocated_size = MAX(allocated_size, Nc*Ngx*acc.Nexchange);
+    allocated_size = Nc*Ngy*Nxchng;
+    allocated_size = MAX(allocated_size, Nc*Ngx*Nxchng);
   }
   else{
-    allocated_size = Nc*acc.Nexchange;
+    allocated_size = Nc*Nxchng;
   }
   return allocated_size;
 }
 
 
-void EM_FIELD::pbcExchangeAlongX(double* send_buffer, double* recv_buffer){
+void EM_FIELD::pbcExchangeAlongX(fieldType* send_buffer, fieldType* recv_buffer, int Nxchng){
   int Nx, Ny, Nz;
   int Ngx, Ngy, Ngz, Nc = Ncomp;
 
@@ -175,8 +197,6 @@ void EM_FIELD::pbcExchangeAlongX(double* send_buffer, double* recv_buffer){
   Ny = mygrid->Nloc[1];
   Nz = mygrid->Nloc[2];
 
-  int Nxchng = acc.Nexchange;
-
   int edge = acc.edge;
 
   MPI_Status status;
@@ -196,8 +216,8 @@ void EM_FIELD::pbcExchangeAlongX(double* send_buffer, double* recv_buffer){
         }
   // ====== send edge to right receive from left
   MPI_Cart_shift(mygrid->cart_comm, 0, 1, &ileft, &iright);
-  MPI_Sendrecv(send_buffer, sendcount, MPI_DOUBLE, iright, 13,
-    recv_buffer, sendcount, MPI_DOUBLE, ileft, 13,
+  MPI_Sendrecv(send_buffer, sendcount, MPI_FIELD_TYPE, iright, 13,
+    recv_buffer, sendcount, MPI_FIELD_TYPE, ileft, 13,
     MPI_COMM_WORLD, &status);
 
 
@@ -218,8 +238,8 @@ void EM_FIELD::pbcExchangeAlongX(double* send_buffer, double* recv_buffer){
 
 
   // ====== send to left receive from right
-  MPI_Sendrecv(send_buffer, sendcount, MPI_DOUBLE, ileft, 13,
-    recv_buffer, sendcount, MPI_DOUBLE, iright, 13,
+  MPI_Sendrecv(send_buffer, sendcount, MPI_FIELD_TYPE, ileft, 13,
+    recv_buffer, sendcount, MPI_FIELD_TYPE, iright, 13,
     MPI_COMM_WORLD, &status);
 
   if (mygrid->getXBoundaryConditions() == _PBC || (mygrid->rmyid[0] != (mygrid->rnproc[0] - 1))){
@@ -237,7 +257,7 @@ void EM_FIELD::pbcExchangeAlongX(double* send_buffer, double* recv_buffer){
 
 
 }
-void EM_FIELD::pbcExchangeAlongY(double* send_buffer, double* recv_buffer){
+void EM_FIELD::pbcExchangeAlongY(fieldType* send_buffer, fieldType* recv_buffer, int Nxchng){
   int Nx, Ny, Nz;
   int Ngx, Ngy, Ngz, Nc = Ncomp;
 
@@ -248,8 +268,6 @@ void EM_FIELD::pbcExchangeAlongY(double* send_buffer, double* recv_buffer){
   Ny = mygrid->Nloc[1];
   Nz = mygrid->Nloc[2];
 
-  int Nxchng = acc.Nexchange;
-
   int edge = acc.edge;
 
   MPI_Status status;
@@ -270,8 +288,8 @@ void EM_FIELD::pbcExchangeAlongY(double* send_buffer, double* recv_buffer){
 
   // ====== send edge to right receive from left    
   MPI_Cart_shift(mygrid->cart_comm, 1, 1, &ileft, &iright);
-  MPI_Sendrecv(send_buffer, sendcount, MPI_DOUBLE, iright, 13,
-    recv_buffer, sendcount, MPI_DOUBLE, ileft, 13,
+  MPI_Sendrecv(send_buffer, sendcount, MPI_FIELD_TYPE, iright, 13,
+    recv_buffer, sendcount, MPI_FIELD_TYPE, ileft, 13,
     MPI_COMM_WORLD, &status);
   // ======   send right: send_buff=right_edge    
   if (mygrid->getYBoundaryConditions() == _PBC || (mygrid->rmyid[1] != 0)){
@@ -288,8 +306,8 @@ void EM_FIELD::pbcExchangeAlongY(double* send_buffer, double* recv_buffer){
   }
 
   // ====== send to left receive from right   
-  MPI_Sendrecv(send_buffer, sendcount, MPI_DOUBLE, ileft, 13,
-    recv_buffer, sendcount, MPI_DOUBLE, iright, 13,
+  MPI_Sendrecv(send_buffer, sendcount, MPI_FIELD_TYPE, ileft, 13,
+    recv_buffer, sendcount, MPI_FIELD_TYPE, iright, 13,
     MPI_COMM_WORLD, &status);
   // ====== copy recv_buffer to the right edge    
   if (mygrid->getYBoundaryConditions() == _PBC || (mygrid->rmyid[1] != (mygrid->rnproc[1] - 1))){
@@ -305,7 +323,7 @@ void EM_FIELD::pbcExchangeAlongY(double* send_buffer, double* recv_buffer){
   }
 }
 
-void EM_FIELD::pbcExchangeAlongZ(double* send_buffer, double* recv_buffer){
+void EM_FIELD::pbcExchangeAlongZ(fieldType* send_buffer, fieldType* recv_buffer, int Nxchng){
   int Nx, Ny, Nz;
   int Ngx, Ngy, Ngz, Nc = Ncomp;
 
@@ -316,8 +334,6 @@ void EM_FIELD::pbcExchangeAlongZ(double* send_buffer, double* recv_buffer){
   Ny = mygrid->Nloc[1];
   Nz = mygrid->Nloc[2];
 
-  int Nxchng = acc.Nexchange;
-
   int edge = acc.edge;
 
   MPI_Status status;
@@ -337,8 +353,8 @@ void EM_FIELD::pbcExchangeAlongZ(double* send_buffer, double* recv_buffer){
         }
   // ====== send edge to right receive from left   
   MPI_Cart_shift(mygrid->cart_comm, 2, 1, &ileft, &iright);
-  MPI_Sendrecv(send_buffer, sendcount, MPI_DOUBLE, iright, 13,
-    recv_buffer, sendcount, MPI_DOUBLE, ileft, 13,
+  MPI_Sendrecv(send_buffer, sendcount, MPI_FIELD_TYPE, iright, 13,
+    recv_buffer, sendcount, MPI_FIELD_TYPE, ileft, 13,
     MPI_COMM_WORLD, &status);
 
   // ====== update left boundary and send edge to left receive from right
@@ -354,8 +370,8 @@ void EM_FIELD::pbcExchangeAlongZ(double* send_buffer, double* recv_buffer){
         }
 
   // ====== send to left receive from right    
-  MPI_Sendrecv(send_buffer, sendcount, MPI_DOUBLE, ileft, 13,
-    recv_buffer, sendcount, MPI_DOUBLE, iright, 13,
+  MPI_Sendrecv(send_buffer, sendcount, MPI_FIELD_TYPE, ileft, 13,
+    recv_buffer, sendcount, MPI_FIELD_TYPE, iright, 13,
     MPI_COMM_WORLD, &status);
   // ====== update right edge
 
@@ -370,28 +386,33 @@ void EM_FIELD::pbcExchangeAlongZ(double* send_buffer, double* recv_buffer){
 }
 
 void EM_FIELD::pbc_EB()  // set on the ghost cells the boundary values
+{
+  pbc_EB(acc.Nexchange);
+}
+
+void EM_FIELD::pbc_EB(int Nxchng)
 {
   EBEnergyExtremesFlag = false;
-  static double *send_buffer, *recv_buffer;
+  static fieldType *send_buffer, *recv_buffer;
   int allocated_size;
 
-  allocated_size = pbc_compute_alloc_size();
-  send_buffer = new double[allocated_size];
-  recv_buffer = new double[allocated_size];
+  allocated_size = pbc_compute_alloc_size(Nxchng);
+  send_buffer = new fieldType[allocated_size];
+  recv_buffer = new fieldType[allocated_size];
 
   if (acc.dimensions == 3)
   {
     // ======================================
     // ========== z direction 3D ===============
     // ======================================        
-    pbcExchangeAlongZ(send_buffer, recv_buffer);
+    pbcExchangeAlongZ(send_buffer, recv_buffer, Nxchng);
   }
   if (acc.dimensions >= 2)
   {
     // ======================================
     // ========== y direction 3D ===============
     // ======================================        
-    pbcExchangeAlongY(send_buffer, recv_buffer);
+    pbcExchangeAlongY(send_buffer, recv_buffer, Nxchng);
 
   }
   if (acc.dimensions >= 1)
@@ -399,7 +420,7 @@ void EM_FIELD::pbc_EB()  // set on the ghost cells the boundary values
     // ======================================
     // ========== x direction 3D ===============
     // ======================================       
-    pbcExchangeAlongX(send_buffer, recv_buffer);
+    pbcExchangeAlongX(send_buffer, recv_buffer, Nxchng);
   }
   delete[] recv_buffer;
   delete[] send_buffer;
@@ -591,6 +612,12 @@ void EM_FIELD::boundary_conditions()  // set on the ghost cells the boundary val
 void EM_FIELD::new_halfadvance_B()
 {
   EBEnergyExtremesFlag = false;
+  if (mygrid->getFieldSolver() == PSATD_SOLVER)  // B is advanced together with E in new_advance_E
+    return;
+  if (mygrid->getFieldSolver() == CK_SOLVER && acc.dimensions > 1){
+    advanceBWithCK(0.5);
+    return;
+  }
   int i, j, k;
   int Nx, Ny, Nz;
   double dt, dxi, dyi, dzi;
@@ -600,14 +627,17 @@ void EM_FIELD::new_halfadvance_B()
   Ny = mygrid->Nloc[1];
   Nz = mygrid->Nloc[2];
   dt = mygrid->dt;
+  std::vector<int> runBegin, runEnd;
+  int Nruns = mygrid->getActiveRuns(0, Nx, runBegin, runEnd);
 
   if (dimensions == 3)
-#pragma omp parallel for private(i,j)
+#pragma omp parallel for private(i, j, dxi, dyi, dzi)
     for (k = 0; k < Nz; k++){
     dzi = mygrid->dri[2] * mygrid->hStretchingDerivativeCorrection[2][k];
     for (j = 0; j < Ny; j++){
       dyi = mygrid->dri[1] * mygrid->hStretchingDerivativeCorrection[1][j];
-      for (i = 0; i < Nx; i++){
+      for (int r = 0; r < Nruns; r++)
+        for (i = runBegin[r]; i < runEnd[r]; i++){
         dxi = mygrid->dri[0] * mygrid->hStretchingDerivativeCorrection[0][i];
         B0(i, j, k) -= 0.5*dt*(dyi*(E2(i, j + 1, k) - E2(i, j, k)) - dzi*(E1(i, j, k + 1) - E1(i, j, k)));
         B1(i, j, k) -= 0.5*dt*(dzi*(E0(i, j, k + 1) - E0(i, j, k)) - dxi*(E2(i + 1, j, k) - E2(i, j, k)));
@@ -616,10 +646,11 @@ void EM_FIELD::new_halfadvance_B()
     }
     }
   else if (dimensions == 2)
-#pragma omp parallel for private(i)
+#pragma omp parallel for private(i, k, dxi, dyi)
     for (j = 0; j < Ny; j++){
     dyi = mygrid->dri[1] * mygrid->hStretchingDerivativeCorrection[1][j];
-    for (i = 0; i < Nx; i++){
+    for (int r = 0; r < Nruns; r++)
+      for (i = runBegin[r]; i < runEnd[r]; i++){
       k = 0;
       dxi = mygrid->dri[0] * mygrid->hStretchingDerivativeCorrection[0][i];
 
@@ -629,8 +660,9 @@ void EM_FIELD::new_halfadvance_B()
     }
     }
   else if (dimensions == 1)
-#pragma omp parallel for
-    for (i = 0; i < Nx; i++){
+    for (int r = 0; r < Nruns; r++)
+#pragma omp parallel for private(j, k, dxi)
+    for (i = runBegin[r]; i < runEnd[r]; i++){
     j = 0;
     k = 0;
     dxi = mygrid->dri[0] * mygrid->hStretchingDerivativeCorrection[0][i];
@@ -643,6 +675,12 @@ void EM_FIELD::new_halfadvance_B()
 void EM_FIELD::new_advance_B()
 {
   EBEnergyExtremesFlag = false;
+  if (mygrid->getFieldSolver() == PSATD_SOLVER)
+    return;
+  if (mygrid->getFieldSolver() == CK_SOLVER && acc.dimensions > 1){
+    advanceBWithCK(1.0);
+    return;
+  }
   int i, j, k;
   int Nx, Ny, Nz;
   double dt, dxi, dyi, dzi;
@@ -652,13 +690,16 @@ void EM_FIELD::new_advance_B()
   Ny = mygrid->Nloc[1];
   Nz = mygrid->Nloc[2];
   dt = mygrid->dt;
+  std::vector<int> runBegin, runEnd;
+  int Nruns = mygrid->getActiveRuns(0, Nx, runBegin, runEnd);
 
   if (dimensions == 3)
     for (k = 0; k < Nz; k++){
     dzi = mygrid->dri[2] * mygrid->hStretchingDerivativeCorrection[2][k];
     for (j = 0; j < Ny; j++){
       dyi = mygrid->dri[1] * mygrid->hStretchingDerivativeCorrection[1][j];
-      for (i = 0; i < Nx; i++){
+      for (int r = 0; r < Nruns; r++)
+        for (i = runBegin[r]; i < runEnd[r]; i++){
         dxi = mygrid->dri[0] * mygrid->hStretchingDerivativeCorrection[0][i];
         B0(i, j, k) -= dt*(dyi*(E2(i, j + 1, k) - E2(i, j, k)) - dzi*(E1(i, j, k + 1) - E1(i, j, k)));
         B1(i, j, k) -= dt*(dzi*(E0(i, j, k + 1) - E0(i, j, k)) - dxi*(E2(i + 1, j, k) - E2(i, j, k)));
@@ -669,7 +710,8 @@ void EM_FIELD::new_advance_B()
   else if (dimensions == 2)
     for (j = 0; j < Ny; j++){
     dyi = mygrid->dri[1] * mygrid->hStretchingDerivativeCorrection[1][j];
-    for (i = 0; i < Nx; i++){
+    for (int r = 0; r < Nruns; r++)
+      for (i = runBegin[r]; i < runEnd[r]; i++){
       k = 0;
       dxi = mygrid->dri[0] * mygrid->hStretchingDerivativeCorrection[0][i];
 
@@ -679,7 +721,8 @@ void EM_FIELD::new_advance_B()
     }
     }
   else if (dimensions == 1)
-    for (i = 0; i < Nx; i++){
+    for (int r = 0; r < Nruns; r++)
+    for (i = runBegin[r]; i < runEnd[r]; i++){
     j = 0;
     k = 0;
     dxi = mygrid->dri[0] * mygrid->hStretchingDerivativeCorrection[0][i];
@@ -689,9 +732,387 @@ void EM_FIELD::new_advance_B()
     B2(i, j, k) -= dt*(dxi*(E1(i + 1, j, k) - E1(i, j, k)));
     }
 }
+void EM_FIELD::setFieldSolver(fieldSolverType solver){
+  mygrid->setFieldSolver(solver);
+  checkFieldSolver();
+}
+
+void EM_FIELD::checkFieldSolver(){
+  if (mygrid->getFieldSolverHalo() > acc.Nexchange){
+    printf("ERROR: the field solver needs %i ghost points, only %i are exchanged\n", mygrid->getFieldSolverHalo(), acc.Nexchange);
+    exit(17);
+  }
+  if (mygrid->getFieldSolver() == CK_SOLVER && mygrid->isStretched()){
+    printf("ERROR: the CK field solver is not available on a stretched grid\n");
+    exit(17);
+  }
+  if (mygrid->getFieldSolver() == PSATD_SOLVER){
+    if (mygrid->isStretched()){
+      printf("ERROR: the PSATD field solver is not available on a stretched grid\n");
+      exit(17);
+    }
+    axisBoundaryConditions bc[3] = { mygrid->getXBoundaryConditions(), mygrid->getYBoundaryConditions(), mygrid->getZBoundaryConditions() };
+    for (int d = 0; d < acc.dimensions; d++){
+      if (bc[d] != _PBC){
+        printf("ERROR: the PSATD field solver needs periodic boundaries along every axis\n");
+        exit(17);
+      }
+    }
+  }
+  bigArrays::release(specVal);
+  specVal = NULL;
+}
+
+void EM_FIELD::setSpectralGuardCells(int guard){
+  if (guard < 1){
+    printf("ERROR: setSpectralGuardCells needs at least one guard cell\n");
+    exit(17);
+  }
+  spectralGuard = guard;
+  bigArrays::release(specVal);
+  specVal = NULL;
+}
+
+void EM_FIELD::setSpectralOrder(int order){
+  if (order < 0 || order % 2){
+    printf("ERROR: setSpectralOrder needs an even order (0 for the exact k)\n");
+    exit(17);
+  }
+  spectralOrder = order;
+  bigArrays::release(specVal);
+  specVal = NULL;
+}
+
+// Cole-Karkkainen coefficients for arbitrary cell aspect ratio (Cowan et al., PRST-AB 16, 041303)
+void EM_FIELD::computeCKCoefficients(){
+  for (int d = 0; d < 3; d++){
+    ckAlpha[d] = ckGamma[d] = 0;
+    ckBeta[d][0] = ckBeta[d][1] = ckBeta[d][2] = 0;
+  }
+  if (acc.dimensions == 3){
+    double delta = MAX(mygrid->dri[0], MAX(mygrid->dri[1], mygrid->dri[2]));
+    double r[3];
+    for (int d = 0; d < 3; d++)
+      r[d] = (mygrid->dri[d] / delta)*(mygrid->dri[d] / delta);
+    double rsum = r[1] * r[2] + r[2] * r[0] + r[0] * r[1];
+    double beta = 0.125*(1 - r[0] * r[1] * r[2] / rsum);
+    for (int d = 0; d < 3; d++){
+      int t1 = (d + 1) % 3, t2 = (d + 2) % 3;
+      double gamma = r[t1] * r[t2] * (0.0625 - 0.125*r[t1] * r[t2] / rsum);
+      ckBeta[d][t1] = r[t1] * beta;
+      ckBeta[d][t2] = r[t2] * beta;
+      ckAlpha[d] = 1 - 2 * ckBeta[d][t1] - 2 * ckBeta[d][t2] - 4 * gamma;
+      ckGamma[d] = gamma;
+    }
+  }
+  else if (acc.dimensions == 2){
+    double delta = MAX(mygrid->dri[0], mygrid->dri[1]);
+    double r[2];
+    for (int d = 0; d < 2; d++)
+      r[d] = (mygrid->dri[d] / delta)*(mygrid->dri[d] / delta);
+    ckBeta[0][1] = 0.125*r[1];
+    ckBeta[1][0] = 0.125*r[0];
+    ckAlpha[0] = 1 - 2 * ckBeta[0][1];
+    ckAlpha[1] = 1 - 2 * ckBeta[1][0];
+  }
+  for (int d = 0; d < 3; d++){
+    ckAlpha[d] *= mygrid->dri[d];
+    ckGamma[d] *= mygrid->dri[d];
+    for (int t = 0; t < 3; t++)
+      ckBeta[d][t] *= mygrid->dri[d];
+  }
+}
+
+// B -= dtFactor*dt*curl(E) with the CK stencil (uniform grid only). The E update stays the Yee one.
+void EM_FIELD::advanceBWithCK(double dtFactor){
+  int Nx, Ny, Nz;
+  double dt;
+
+  Nx = mygrid->Nloc[0];
+  Ny = mygrid->Nloc[1];
+  Nz = mygrid->Nloc[2];
+  dt = dtFactor*mygrid->dt;
+  computeCKCoefficients();
+  std::vector<int> runBegin, runEnd;
+  int Nruns = mygrid->getActiveRuns(0, Nx, runBegin, runEnd);
+
+  if (acc.dimensions == 3){
+#pragma omp parallel for collapse(2)
+    for (int k = 0; k < Nz; k++)
+      for (int j = 0; j < Ny; j++)
+        for (int r = 0; r < Nruns; r++)
+        for (int i = runBegin[r]; i < runEnd[r]; i++){
+      B0(i, j, k) -= dt*(ckDerivative(2, 1, i, j, k) - ckDerivative(1, 2, i, j, k));
+      B1(i, j, k) -= dt*(ckDerivative(0, 2, i, j, k) - ckDerivative(2, 0, i, j, k));
+      B2(i, j, k) -= dt*(ckDerivative(1, 0, i, j, k) - ckDerivative(0, 1, i, j, k));
+        }
+  }
+  else if (acc.dimensions == 2){
+#pragma omp parallel for
+    for (int j = 0; j < Ny; j++)
+      for (int r = 0; r < Nruns; r++)
+      for (int i = runBegin[r]; i < runEnd[r]; i++){
+      int k = 0;
+      B0(i, j, k) -= dt*(ckDerivative(2, 1, i, j, k));
+      B1(i, j, k) -= dt*(-ckDerivative(2, 0, i, j, k));
+      B2(i, j, k) -= dt*(ckDerivative(1, 0, i, j, k) - ckDerivative(0, 1, i, j, k));
+      }
+  }
+}
+
+int EM_FIELD::spectralRightGuard(int uniquePoints){
+  return fftPlan::goodSize(uniquePoints + 2 * spectralGuard) - uniquePoints - spectralGuard;
+}
+
+void EM_FIELD::allocateSpectralBox(){
+  bool decomposed = false;
+  for (int d = 0; d < acc.dimensions; d++)
+    decomposed = decomposed || (mygrid->rnproc[d] > 1);
+  // the exact k couples every point of the box, so with guard cells a finite order is used by default
+  int order = spectralOrder;
+  if (order < 0)
+    order = decomposed ? MAX(2, spectralGuard - spectralGuard % 2) : 0;
+  else if (order == 0 && decomposed && mygrid->myid == mygrid->master_proc)
+    printf("WARNING: the exact k PSATD is not local, the guard cells are not enough on a decomposed grid\n");
+  for (int d = 0; d < 3; d++){
+    specGuardLeft[d] = specGuardRight[d] = 0;
+    specN[d] = 1;
+    if (d >= acc.dimensions)
+      continue;
+    int L = mygrid->uniquePointsloc[d];
+    specN[d] = L;
+    if (mygrid->rnproc[d] > 1){
+      specGuardLeft[d] = spectralGuard;
+      specGuardRight[d] = spectralRightGuard(L);
+      specN[d] = L + specGuardLeft[d] + specGuardRight[d];
+      for (int p = 0; p < mygrid->rnproc[d]; p++){
+        int Lp = mygrid->rproc_NuniquePointsloc[d][p];
+        if (Lp < spectralGuard || Lp < spectralRightGuard(Lp)){
+          printf("ERROR: PSATD needs %i guard cells, a subdomain has only %i points along %i\n", MAX(spectralGuard, spectralRightGuard(Lp)), Lp, d);
+          exit(17);
+        }
+      }
+    }
+    // an undecomposed periodic axis is not padded: its length sets the radices of the FFT
+    else if (specN[d] != fftPlan::goodSize(specN[d]) && mygrid->myid == mygrid->master_proc)
+      printf("WARNING: PSATD with %i points along %i, not a product of 2, 3 and 5: its FFT is slow (%i would be fast)\n", specN[d], d, fftPlan::goodSize(specN[d]));
+    specFFT[d].init(specN[d]);
+  }
+  // staggered centered difference of order 2m: sum_l w_l (f(x+(l-1/2)h) - f(x-(l-1/2)h))/h,
+  // w_l = (-1)^(l+1) ((2m-1)!!)^2 / ((2l-1)^2 (m+l-1)! (m-l)! 4^(m-1)), i.e. k -> (2/h) sum_l w_l sin((2l-1)kh/2)
+  int m = order / 2;
+  std::vector<double> w(m);
+  for (int l = 1; l <= m; l++){
+    double logw = 2 * (lgamma(2.0 * m + 1) - lgamma(m + 1.0) - m*log(2.0)) - lgamma(m + l + 0.0) - lgamma(m - l + 1.0) - (m - 1)*log(4.0);
+    w[l - 1] = ((l % 2) ? 1 : -1)*exp(logw) / ((2 * l - 1)*(2 * l - 1));
+  }
+  for (int d = 0; d < 3; d++){
+    specK[d].resize(specN[d]);
+    specKmod[d].resize(specN[d]);
+    for (int n = 0; n < specN[d]; n++){
+      int mm = (n <= specN[d] / 2) ? n : n - specN[d];
+      double h = mygrid->dr[d];
+      specK[d][n] = (specN[d] > 1) ? 2 * M_PI*mm / (specN[d] * h) : 0;
+      specKmod[d][n] = specK[d][n];
+      if (m > 0){
+        specKmod[d][n] = 0;
+        for (int l = 1; l <= m; l++)
+          specKmod[d][n] += (2 / h)*w[l - 1] * sin((2 * l - 1)*specK[d][n] * h / 2);
+      }
+    }
+  }
+  long int Nbox = ((long int)specN[0])*specN[1] * specN[2];
+  specVal = (std::complex<double> *)bigArrays::allocate(9 * Nbox*sizeof(std::complex<double>), MEM_SPECTRAL, bigArrays::gridTouchUnits(specN));
+}
+
+// copies E, B and den_factor*J on the unique points, then fills the guards axis by axis
+// (the planes sent along y and z already contain the x and y guards, so the corners come along)
+void EM_FIELD::fillSpectralBox(CURRENT *current){
+  long int Nbox = ((long int)specN[0])*specN[1] * specN[2];
+  int L[3] = { 1, 1, 1 };
+  for (int d = 0; d < acc.dimensions; d++)
+    L[d] = mygrid->uniquePointsloc[d];
+  double den_factor = mygrid->den_factor;
+
+  memset((void*)specVal, 0, 9 * Nbox*sizeof(std::complex<double>));
+#pragma omp parallel for collapse(2)
+  for (int k = 0; k < L[2]; k++)
+    for (int j = 0; j < L[1]; j++)
+      for (int i = 0; i < L[0]; i++){
+    long int n = (i + specGuardLeft[0]) + specN[0] * ((j + specGuardLeft[1]) + ((long int)specN[1])*(k + specGuardLeft[2]));
+    for (int c = 0; c < 6; c++)
+      specVal[c*Nbox + n] = VEB(c, i, j, k);
+    if (current != NULL)
+      for (int c = 0; c < 3; c++)
+        specVal[(6 + c)*Nbox + n] = den_factor*current->JJ(c, i, j, k);
+      }
+  for (int d = 0; d < acc.dimensions; d++)
+    if (mygrid->rnproc[d] > 1)
+      exchangeSpectralGuards(d);
+}
+
+// only the real parts travel: before the forward transform the box is real
+void EM_FIELD::exchangeSpectralGuards(int d){
+  long int Nbox = ((long int)specN[0])*specN[1] * specN[2];
+  long int stride[3] = { 1, specN[0], ((long int)specN[0])*specN[1] };
+  int a = (d + 1) % 3, b = (d + 2) % 3;
+  long int Nplane = ((long int)specN[a])*specN[b];
+  int L = mygrid->uniquePointsloc[d];
+  int Gl = specGuardLeft[d], Gr = specGuardRight[d];
+  int leftCoord = (mygrid->rmyid[d] - 1 + mygrid->rnproc[d]) % mygrid->rnproc[d];
+  int GrOfLeft = spectralRightGuard(mygrid->rproc_NuniquePointsloc[d][leftCoord]);
+  int Nmax = MAX(Gl, MAX(Gr, GrOfLeft));
+  double *sendBuffer = new double[9 * Nplane*Nmax];
+  double *recvBuffer = new double[9 * Nplane*Nmax];
+  int ileft, iright;
+  MPI_Status status;
+  MPI_Cart_shift(mygrid->cart_comm, d, 1, &ileft, &iright);
+
+  // first GrOfLeft unique planes to the left neighbour (its right guard), Gr planes from the right one
+  for (int p = 0; p < GrOfLeft; p++)
+    for (long int q = 0; q < Nplane; q++){
+    long int n = (Gl + p)*stride[d] + (q%specN[a])*stride[a] + (q / specN[a])*stride[b];
+    for (int c = 0; c < 9; c++)
+      sendBuffer[c + 9 * (q + Nplane*p)] = specVal[c*Nbox + n].real();
+    }
+  MPI_Sendrecv(sendBuffer, 9 * Nplane*GrOfLeft, MPI_DOUBLE, ileft, 14,
+    recvBuffer, 9 * Nplane*Gr, MPI_DOUBLE, iright, 14,
+    mygrid->cart_comm, &status);
+  for (int p = 0; p < Gr; p++)
+    for (long int q = 0; q < Nplane; q++){
+    long int n = (Gl + L + p)*stride[d] + (q%specN[a])*stride[a] + (q / specN[a])*stride[b];
+    for (int c = 0; c < 9; c++)
+      specVal[c*Nbox + n] = recvBuffer[c + 9 * (q + Nplane*p)];
+    }
+
+  // last Gl unique planes to the right neighbour (its left guard), Gl planes from the left one
+  for (int p = 0; p < Gl; p++)
+    for (long int q = 0; q < Nplane; q++){
+    long int n = (L + p)*stride[d] + (q%specN[a])*stride[a] + (q / specN[a])*stride[b];
+    for (int c = 0; c < 9; c++)
+      sendBuffer[c + 9 * (q + Nplane*p)] = specVal[c*Nbox + n].real();
+    }
+  MPI_Sendrecv(sendBuffer, 9 * Nplane*Gl, MPI_DOUBLE, iright, 15,
+    recvBuffer, 9 * Nplane*Gl, MPI_DOUBLE, ileft, 15,
+    mygrid->cart_comm, &status);
+  for (int p = 0; p < Gl; p++)
+    for (long int q = 0; q < Nplane; q++){
+    long int n = p*stride[d] + (q%specN[a])*stride[a] + (q / specN[a])*stride[b];
+    for (int c = 0; c < 9; c++)
+      specVal[c*Nbox + n] = recvBuffer[c + 9 * (q + Nplane*p)];
+    }
+  delete[] sendBuffer;
+  delete[] recvBuffer;
+}
+
+// multidimensional FFT of the first ncomp components, one axis at a time
+void EM_FIELD::spectralTransform(int ncomp, bool inverse){
+  long int Nbox = ((long int)specN[0])*specN[1] * specN[2];
+  long int stride[3] = { 1, specN[0], ((long int)specN[0])*specN[1] };
+  for (int d = 0; d < acc.dimensions; d++){
+    if (specN[d] == 1)
+      continue;
+    int a = (d + 1) % 3, b = (d + 2) % 3;
+    long int Nlines = Nbox / specN[d];
+#pragma omp parallel
+    {
+      std::complex<double> *scratch = new std::complex<double>[2 * specN[d]];
+#pragma omp for
+      for (long int l = 0; l < ncomp*Nlines; l++){
+        int c = l / Nlines;
+        long int q = l%Nlines;
+        std::complex<double> *origin = specVal + c*Nbox + (q%specN[a])*stride[a] + (q / specN[a])*stride[b];
+        specFFT[d].transform(origin, stride[d], inverse, scratch);
+      }
+      delete[] scratch;
+    }
+  }
+}
+
+// one full step of E and B with J at the half step (Haber et al. 1973, Vay et al. JCP 243, 260 (2013)):
+// each component is moved to the cell corner with a half cell phase shift, advanced, and shifted back
+void EM_FIELD::advanceWithPSATD(CURRENT *current){
+  if (specVal == NULL)
+    allocateSpectralBox();
+  fillSpectralBox(current);
+  spectralTransform(9, false);
+
+  long int Nbox = ((long int)specN[0])*specN[1] * specN[2];
+  double dt = mygrid->dt;
+  double shift[9][3];
+  char half = _HALF_CRD;
+  for (int c = 0; c < 9; c++){
+    integer_or_halfinteger crd = getCompCoords(c % 6);
+    shift[c][0] = (crd.x == half) ? 0.5*mygrid->dr[0] : 0;
+    shift[c][1] = (crd.y == half) ? 0.5*mygrid->dr[1] : 0;
+    shift[c][2] = (crd.z == half) ? 0.5*mygrid->dr[2] : 0;
+  }
+
+#pragma omp parallel for
+  for (long int n = 0; n < Nbox; n++){
+    int m[3] = { (int)(n%specN[0]), (int)((n / specN[0]) % specN[1]), (int)(n / (((long int)specN[0])*specN[1])) };
+    double kt[3], kv[3];
+    for (int d = 0; d < 3; d++){
+      kt[d] = specK[d][m[d]];
+      kv[d] = specKmod[d][m[d]];
+    }
+    std::complex<double> F[9], phase[9];
+    for (int c = 0; c < 9; c++){
+      phase[c] = std::polar(1.0, kt[0] * shift[c][0] + kt[1] * shift[c][1] + kt[2] * shift[c][2]);
+      F[c] = specVal[c*Nbox + n] / phase[c];
+    }
+    std::complex<double> *E = F, *B = F + 3, *J = F + 6;
+    std::complex<double> En[3], Bn[3];
+    double kk = sqrt(kv[0] * kv[0] + kv[1] * kv[1] + kv[2] * kv[2]);
+    if (kk == 0){
+      for (int d = 0; d < 3; d++){
+        En[d] = E[d] - dt*J[d];
+        Bn[d] = B[d];
+      }
+    }
+    else{
+      const std::complex<double> I(0, 1);
+      double C = cos(kk*dt), S = sin(kk*dt);
+      double kh[3] = { kv[0] / kk, kv[1] / kk, kv[2] / kk };
+      std::complex<double> kE = kh[0] * E[0] + kh[1] * E[1] + kh[2] * E[2];
+      std::complex<double> kJ = kh[0] * J[0] + kh[1] * J[1] + kh[2] * J[2];
+      for (int d = 0; d < 3; d++){
+        int d1 = (d + 1) % 3, d2 = (d + 2) % 3;
+        std::complex<double> kxB = kh[d1] * B[d2] - kh[d2] * B[d1];
+        std::complex<double> kxE = kh[d1] * E[d2] - kh[d2] * E[d1];
+        std::complex<double> kxJ = kh[d1] * J[d2] - kh[d2] * J[d1];
+        En[d] = C*E[d] + I*S*kxB - (S / kk)*J[d] + (1 - C)*kh[d] * kE + kh[d] * kJ*(S / kk - dt);
+        Bn[d] = C*B[d] - I*S*kxE + I*((1 - C) / kk)*kxJ;
+      }
+    }
+    for (int d = 0; d < 3; d++){
+      specVal[d*Nbox + n] = En[d] * phase[d];
+      specVal[(3 + d)*Nbox + n] = Bn[d] * phase[3 + d];
+    }
+  }
+
+  spectralTransform(6, true);
+  // the last local point (a copy of the neighbour's first one) is not refreshed by pbc_EB:
+  // it is in the right guard or, without guards, the first point of the periodic box
+  int Nx = mygrid->Nloc[0], Ny = mygrid->Nloc[1], Nz = mygrid->Nloc[2];
+  double norm = 1.0 / Nbox;
+#pragma omp parallel for collapse(2)
+  for (int k = 0; k < Nz; k++)
+    for (int j = 0; j < Ny; j++)
+      for (int i = 0; i < Nx; i++){
+    long int n = ((i + specGuardLeft[0]) % specN[0]) + specN[0] * (((j + specGuardLeft[1]) % specN[1]) + ((long int)specN[1])*((k + specGuardLeft[2]) % specN[2]));
+    for (int c = 0; c < 6; c++)
+      VEB(c, i, j, k) = specVal[c*Nbox + n].real()*norm;
+      }
+}
+
 void EM_FIELD::new_advance_E()
 {
   EBEnergyExtremesFlag = false;
+  if (mygrid->getFieldSolver() == PSATD_SOLVER){
+    advanceWithPSATD(NULL);
+    return;
+  }
   int i, j, k;
   int Nx, Ny, Nz;
   double dt, dxi, dyi, dzi;
@@ -701,14 +1122,17 @@ void EM_FIELD::new_advance_E()
   Ny = mygrid->Nloc[1];
   Nz = mygrid->Nloc[2];
   dt = mygrid->dt;
+  std::vector<int> runBegin, runEnd;
+  int Nruns = mygrid->getActiveRuns(0, Nx, runBegin, runEnd);
 
   if (dimensions == 3)
-#pragma omp parallel for private(i,j)
+#pragma omp parallel for private(i, j, dxi, dyi, dzi)
     for (k = 0; k < Nz; k++){
     dzi = mygrid->dri[2] * mygrid->iStretchingDerivativeCorrection[2][k];
     for (j = 0; j < Ny; j++){
       dyi = mygrid->dri[1] * mygrid->iStretchingDerivativeCorrection[1][j];
-      for (i = 0; i < Nx; i++){
+      for (int r = 0; r < Nruns; r++)
+        for (i = runBegin[r]; i < runEnd[r]; i++){
         dxi = mygrid->dri[0] * mygrid->hStretchingDerivativeCorrection[0][i];
         E0(i, j, k) += dt*(dyi*(B2(i, j, k) - B2(i, j - 1, k)) -
           dzi*(B1(i, j, k) - B1(i, j, k - 1)));
@@ -720,10 +1144,11 @@ void EM_FIELD::new_advance_E()
     }
     }
   else if (dimensions == 2)
-#pragma omp parallel for private(i)
+#pragma omp parallel for private(i, k, dxi, dyi)
     for (j = 0; j < Ny; j++){
     dyi = mygrid->dri[1] * mygrid->iStretchingDerivativeCorrection[1][j];
-    for (i = 0; i < Nx; i++){
+    for (int r = 0; r < Nruns; r++)
+      for (i = runBegin[r]; i < runEnd[r]; i++){
       k = 0;
       dxi = mygrid->dri[0] * mygrid->hStretchingDerivativeCorrection[0][i];
 
@@ -734,8 +1159,9 @@ void EM_FIELD::new_advance_E()
     }
     }
   else if (dimensions == 1)
-#pragma omp parallel for
-    for (i = 0; i < Nx; i++){
+    for (int r = 0; r < Nruns; r++)
+#pragma omp parallel for private(j, k, dxi)
+    for (i = runBegin[r]; i < runEnd[r]; i++){
     j = 0;
     k = 0;
     dxi = mygrid->dri[0] * mygrid->hStretchingDerivativeCorrection[0][i];
@@ -749,6 +1175,10 @@ void EM_FIELD::new_advance_E()
 void EM_FIELD::new_advance_E(CURRENT *current)
 {
   EBEnergyExtremesFlag = false;
+  if (mygrid->getFieldSolver() == PSATD_SOLVER){
+    advanceWithPSATD(current);
+    return;
+  }
   int i, j, k;
   int Nx, Ny, Nz;
   double dt, dxi, dyi, dzi;
@@ -758,13 +1188,16 @@ void EM_FIELD::new_advance_E(CURRENT *current)
   Ny = mygrid->Nloc[1];
   Nz = mygrid->Nloc[2];
   dt = mygrid->dt;
+  std::vector<int> runBegin, runEnd;
+  int Nruns = mygrid->getActiveRuns(0, Nx, runBegin, runEnd);
 
   if (dimensions == 3)
     for (k = 0; k < Nz; k++){
     dzi = mygrid->dri[2] * mygrid->iStretchingDerivativeCorrection[2][k];
     for (j = 0; j < Ny; j++){
       dyi = mygrid->dri[1] * mygrid->iStretchingDerivativeCorrection[1][j];
-      for (i = 0; i < Nx; i++){
+      for (int r = 0; r < Nruns; r++)
+        for (i = runBegin[r]; i < runEnd[r]; i++){
         dxi = mygrid->dri[0] * mygrid->hStretchingDerivativeCorrection[0][i];
         E0(i, j, k) += dt*((dyi*(B2(i, j, k) - B2(i, j - 1, k)) - dzi*(B1(i, j, k) - B1(i, j, k - 1))) - mygrid->den_factor*current->Jx(i, j, k));
         E1(i, j, k) += dt*((dzi*(B0(i, j, k) - B0(i, j, k - 1)) - dxi*(B2(i, j, k) - B2(i - 1, j, k))) - mygrid->den_factor*current->Jy(i, j, k));
@@ -775,7 +1208,8 @@ void EM_FIELD::new_advance_E(CURRENT *current)
   else if (dimensions == 2)
     for (j = 0; j < Ny; j++){
     dyi = mygrid->dri[1] * mygrid->iStretchingDerivativeCorrection[1][j];
-    for (i = 0; i < Nx; i++){
+    for (int r = 0; r < Nruns; r++)
+      for (i = runBegin[r]; i < runEnd[r]; i++){
       k = 0;
       dxi = mygrid->dri[0] * mygrid->hStretchingDerivativeCorrection[0][i];
       E0(i, j, k) += dt*((dyi*(B2(i, j, k) - B2(i, j - 1, k))) - mygrid->den_factor*current->Jx(i, j, k));
@@ -784,7 +1218,8 @@ void EM_FIELD::new_advance_E(CURRENT *current)
     }
     }
   else if (dimensions == 1)
-    for (i = 0; i < Nx; i++){
+    for (int r = 0; r < Nruns; r++)
+    for (i = runBegin[r]; i < runEnd[r]; i++){
     j = 0;
     k = 0;
     dxi = mygrid->dri[0] * mygrid->hStretchingDerivativeCorrection[0][i];
@@ -796,6 +1231,290 @@ void EM_FIELD::new_advance_E(CURRENT *current)
 
 }
 
+void EM_FIELD::setTileCacheSize(long int bytes){
+  if (bytes <= 0){
+    printf("ERROR: setTileCacheSize needs a positive size in bytes\n");
+    exit(17);
+  }
+  tileCacheBytes = bytes;
+}
+
+bool EM_FIELD::canUseTiledAdvance(){
+  if (acc.dimensions != 3 || mygrid->getFieldSolver() != YEE_SOLVER || mygrid->isStretched())
+    return false;
+  if (mygrid->getZBoundaryConditions() != _PBC)
+    return false;
+  for (int d = 0; d < 3; d++){
+    if (mygrid->Nloc[d] < 3)
+      return false;
+  }
+  return true;
+}
+
+// same as openBoundariesE_1; new_halfadvance_B; boundary_conditions; openBoundariesB; new_advance_E;
+// boundary_conditions; openBoundariesE_2; new_halfadvance_B; boundary_conditions, bitwise and ghost
+// cells included, as long as the planes shared by neighbouring tasks hold the same values (each step
+// keeps them so); the current must already be deposited and exchanged with current->pbc()
+void EM_FIELD::new_advance_EB_tiled(){
+  advanceEBTiled(NULL);
+}
+
+void EM_FIELD::new_advance_EB_tiled(CURRENT *current){
+  advanceEBTiled(current);
+}
+
+void EM_FIELD::advanceEBTiled(CURRENT *current){
+  if (!canUseTiledAdvance()){
+    openBoundariesE_1();
+    new_halfadvance_B();
+    boundary_conditions();
+    openBoundariesB();
+    if (current)
+      new_advance_E(current);
+    else
+      new_advance_E();
+    boundary_conditions();
+    openBoundariesE_2();
+    new_halfadvance_B();
+    boundary_conditions();
+    return;
+  }
+  EBEnergyExtremesFlag = false;
+  axisBoundaryConditions bc[3] = { mygrid->getXBoundaryConditions(), mygrid->getYBoundaryConditions(), mygrid->getZBoundaryConditions() };
+  int N[3], lo[3], hi[3];
+  // first B half on [lo,hi), E on [0,hi), second B half on [0,N): the ghost layers -1 and N
+  // are computed here instead of being exchanged, except on the physical open sides
+  for (int d = 0; d < 3; d++){
+    N[d] = mygrid->Nloc[d];
+    lo[d] = (bc[d] == _PBC || mygrid->rmyid[d] != 0) ? -1 : 0;
+    hi[d] = (bc[d] == _PBC || mygrid->rmyid[d] != (mygrid->rnproc[d] - 1)) ? N[d] + 1 : N[d];
+  }
+
+  // the outermost ghost layers are never exchanged by the plain sequence (Nexchange = 1): they are
+  // put back after the sweep, so that the particles read the same ghost values in both steps
+  std::vector<fieldType> outerLayers;
+  copyOuterGhostLayers(outerLayers, false);
+  pbc_EB(2);
+  openBoundariesE_1();
+
+  long int rowBytes = (long int)NxAlloc*Ncomp*sizeof(fieldType);
+  int By = (int)(tileCacheBytes / (4 * rowBytes));
+  if (By < 4)
+    By = 4;
+
+#pragma omp parallel
+  {
+    // E lags the first B half by one row and one plane, the second B half by two: every
+    // value is read before it is overwritten and after the values it depends on are updated
+    for (int y0 = lo[1]; y0 < hi[1]; y0 += By){
+      int y1 = MIN(y0 + By, hi[1]);
+      int e0 = (y0 == lo[1]) ? 0 : y0 - 1;
+      int e1 = (y1 == hi[1]) ? hi[1] : y1 - 1;
+      int b0 = (y0 == lo[1]) ? 0 : y0 - 2;
+      int b1 = (y1 == hi[1]) ? N[1] : y1 - 2;
+      for (int s = lo[2]; s < hi[2] + 2; s++){
+        if (s < hi[2])
+          tiledHalfAdvanceB(s, y0, y1, lo[0], hi[0], false);
+        if (s >= 1 && s - 1 < hi[2])
+          tiledAdvanceE(s - 1, e0, e1, hi[0], current);
+        if (s >= 2 && s - 2 < N[2])
+          tiledHalfAdvanceB(s - 2, b0, b1, 0, N[0], true);
+      }
+    }
+  }
+
+  copyOuterGhostLayers(outerLayers, true);
+
+  // open boundary values on the ghost rows left out of the sweep and on the outer layers just put
+  // back, in the order of the plain sequence: their inputs are unchanged or outer layers too
+  bool xOpenRight = (bc[0] == _Open && mygrid->rmyid[0] == (mygrid->rnproc[0] - 1));
+  bool yOpenLeft = (bc[1] == _Open && mygrid->rmyid[1] == 0);
+  bool yOpenRight = (bc[1] == _Open && mygrid->rmyid[1] == (mygrid->rnproc[1] - 1));
+  int nx = acc.Nexchange, last_cell = N[0] - 1, last_row = N[1] - 1;
+  // openBoundariesE_1 on the outer layers, read there by the B faces
+  for (int k = -acc.edge; k < N_grid[2] - acc.edge; k++){
+    for (int j = -acc.edge; j < N_grid[1] - acc.edge; j++){
+      if (xOpenRight && (j < -nx || j >= N[1] + nx || k < -nx || k >= N[2] + nx)){
+        E1(last_cell + 1, j, k) = 2.0*B2(last_cell, j, k) - E1(last_cell, j, k);
+        E2(last_cell + 1, j, k) = -2.0*B1(last_cell, j, k) - E2(last_cell, j, k);
+      }
+    }
+  }
+  for (int k = -acc.edge; k < N_grid[2] - acc.edge; k++){
+    for (int i = -acc.edge; i < N_grid[0] - acc.edge; i++){
+      if (yOpenRight && (i < -nx || i >= N[0] + nx || k < -nx || k >= N[2] + nx)){
+        E0(i, last_row + 1, k) = -2.0*B2(i, last_row, k) - E0(i, last_row, k);
+        E2(i, last_row + 1, k) = 2.0*B0(i, last_row, k) - E2(i, last_row, k);
+      }
+    }
+  }
+  for (int k = -acc.edge; k < N_grid[2] - acc.edge; k++){
+    if (yOpenLeft)
+      openBoundariesBYFace(k, true);
+    for (int j = -acc.edge; j < N_grid[1] - acc.edge; j++){
+      if ((j < 0 || j >= hi[1] || k < 0 || k >= hi[2]) && !(yOpenLeft && j == -1) && !(yOpenRight && j == N[1]))
+        openBoundariesBRow(j, k);
+    }
+  }
+  for (int k = -acc.edge; k < N_grid[2] - acc.edge; k++){
+    if (yOpenRight)
+      openBoundariesE_2YFace(k, true);
+    for (int j = -acc.edge; j < N_grid[1] - acc.edge; j++){
+      if ((j < 0 || j >= N[1] || k < 0 || k >= N[2]) && !(yOpenRight && j == N[1]))
+        openBoundariesE_2Row(j, k);
+    }
+  }
+
+  boundary_conditions();
+}
+
+// the ghost cells beyond the first Nexchange layers along any axis, in a fixed order
+void EM_FIELD::copyOuterGhostLayers(std::vector<fieldType> &layers, bool restore){
+  int lo = -acc.Nexchange, hi[3];
+  for (int d = 0; d < 3; d++)
+    hi[d] = mygrid->Nloc[d] + acc.Nexchange;
+  if (!restore)
+    layers.clear();
+  long int n = 0;
+  for (int k = -acc.edge; k < N_grid[2] - acc.edge; k++){
+    for (int j = -acc.edge; j < N_grid[1] - acc.edge; j++){
+      bool wholeRow = (k < lo || k >= hi[2] || j < lo || j >= hi[1]);
+      for (int i = -acc.edge; i < N_grid[0] - acc.edge; i++){
+        if (!wholeRow && i >= lo && i < hi[0])
+          continue;
+        for (int c = 0; c < Ncomp; c++){
+          if (restore)
+            VEB(c, i, j, k) = layers[n++];
+          else
+            layers.push_back(VEB(c, i, j, k));
+        }
+      }
+    }
+  }
+}
+
+void EM_FIELD::tiledHalfAdvanceB(int k, int j0, int j1, int i0, int i1, bool withOpenBoundaries){
+  double dt = mygrid->dt;
+  double dxi = mygrid->dri[0], dyi = mygrid->dri[1], dzi = mygrid->dri[2];
+  int sx = Ncomp, sy = Ncomp*NxAlloc, sz = Ncomp*NxAlloc*N_grid[1];
+  std::vector<int> runBegin, runEnd;
+  int Nruns = mygrid->getActiveRuns(i0, i1, runBegin, runEnd);
+
+#pragma omp for
+  for (int j = j0; j < j1; j++){
+    if (withOpenBoundaries)
+      openBoundariesE_2Row(j, k);
+    for (int r = 0; r < Nruns; r++){
+      fieldType *F = &VEB(0, runBegin[r], j, k);
+      for (int i = runBegin[r]; i < runEnd[r]; i++, F += sx){
+        F[3] -= 0.5*dt*(dyi*(F[sy + 2] - F[2]) - dzi*(F[sz + 1] - F[1]));
+        F[4] -= 0.5*dt*(dzi*(F[sz] - F[0]) - dxi*(F[sx + 2] - F[2]));
+        F[5] -= 0.5*dt*(dxi*(F[sx + 1] - F[1]) - dyi*(F[sy] - F[0]));
+      }
+    }
+  }
+}
+
+void EM_FIELD::tiledAdvanceE(int k, int j0, int j1, int i1, CURRENT *current){
+  double dt = mygrid->dt, den_factor = mygrid->den_factor;
+  double dxi = mygrid->dri[0], dyi = mygrid->dri[1], dzi = mygrid->dri[2];
+  int sx = Ncomp, sy = Ncomp*NxAlloc, sz = Ncomp*NxAlloc*N_grid[1];
+  std::vector<int> runBegin, runEnd;
+  int Nruns = mygrid->getActiveRuns(0, i1, runBegin, runEnd);
+
+#pragma omp for
+  for (int j = j0; j < j1; j++){
+    openBoundariesBRow(j, k);
+    for (int r = 0; r < Nruns; r++){
+      fieldType *F = &VEB(0, runBegin[r], j, k);
+      if (current){
+        double *J = &current->Jx(runBegin[r], j, k);
+        for (int i = runBegin[r]; i < runEnd[r]; i++, F += sx, J += current->Ncomp){
+          F[0] += dt*((dyi*(F[5] - F[5 - sy]) - dzi*(F[4] - F[4 - sz])) - den_factor*J[0]);
+          F[1] += dt*((dzi*(F[3] - F[3 - sz]) - dxi*(F[5] - F[5 - sx])) - den_factor*J[1]);
+          F[2] += dt*((dxi*(F[4] - F[4 - sx]) - dyi*(F[3] - F[3 - sy])) - den_factor*J[2]);
+        }
+      }
+      else{
+        for (int i = runBegin[r]; i < runEnd[r]; i++, F += sx){
+          F[0] += dt*(dyi*(F[5] - F[5 - sy]) - dzi*(F[4] - F[4 - sz]));
+          F[1] += dt*(dzi*(F[3] - F[3 - sz]) - dxi*(F[5] - F[5 - sx]));
+          F[2] += dt*(dxi*(F[4] - F[4 - sx]) - dyi*(F[3] - F[3 - sy]));
+        }
+      }
+    }
+  }
+}
+
+// openBoundariesB restricted to the row (j,k); the y face is set together with row 0, after
+// the x face of row -1 as in openBoundariesB since the two overlap at the corner. The x face of
+// the ghost row above an open y face goes with the last row, before openBoundariesE_2 changes E there
+void EM_FIELD::openBoundariesBRow(int j, int k){
+  bool yFace = (j == 0 && (mygrid->getYBoundaryConditions() == _Open) && (mygrid->rmyid[1] == 0));
+  bool yTop = (j == mygrid->Nloc[1] - 1 && (mygrid->getYBoundaryConditions() == _Open) && (mygrid->rmyid[1] == (mygrid->rnproc[1] - 1)));
+  if ((mygrid->getXBoundaryConditions() == _Open) && (mygrid->rmyid[0] == 0))
+  {
+    double alpha = (mygrid->dt / mygrid->dr[0])*mygrid->iStretchingDerivativeCorrection[0][0];
+    double c1 = 1. / (1 + alpha);
+    double c2 = (1 - alpha);
+    for (int jj = (yFace ? j - 1 : j); jj <= (yTop ? j + 1 : j); jj++){
+      B1(-1, jj, k) = c1*(2.0*E2(0, jj, k) - c2*B1(0, jj, k));
+      B2(-1, jj, k) = -c1*(2.0*E1(0, jj, k) + c2*B2(0, jj, k));
+    }
+  }
+  if (yFace)
+    openBoundariesBYFace(k, false);
+}
+
+// the low open y face of plane k, on the cells beyond the first Nexchange x layers only if outerOnly
+void EM_FIELD::openBoundariesBYFace(int k, bool outerOnly){
+  double alpha = (mygrid->dt / mygrid->dr[1])*mygrid->iStretchingDerivativeCorrection[1][0];
+  double c1 = 1. / (1 + alpha);
+  double c2 = (1 - alpha);
+  for (int i = 0; i < N_grid[0]; i++){
+    int ii = i - acc.edge;
+    if (outerOnly && ii >= -acc.Nexchange && ii < mygrid->Nloc[0] + acc.Nexchange)
+      continue;
+    B2(ii, -1, k) = c1*(2.0*E0(ii, 0, k) - c2*B2(ii, 0, k));
+    B0(ii, -1, k) = -c1*(2.0*E2(ii, 0, k) + c2*B0(ii, 0, k));
+  }
+}
+
+// openBoundariesE_2 restricted to the row (j,k); the y face is set together with the last row,
+// after the x face of the ghost row above it
+void EM_FIELD::openBoundariesE_2Row(int j, int k){
+  int last_row = mygrid->Nloc[1] - 1;
+  bool yFace = (j == last_row && (mygrid->getYBoundaryConditions() == _Open) && (mygrid->rmyid[1] == (mygrid->rnproc[1] - 1)));
+  if ((mygrid->getXBoundaryConditions() == _Open) && (mygrid->rmyid[0] == (mygrid->rnproc[0] - 1)))
+  {
+    double alpha = (mygrid->dt / mygrid->dr[0])*mygrid->iStretchingDerivativeCorrection[0][0];
+    double c1 = 1. / (1 + alpha*0.5);
+    double c2 = (1 - alpha*0.5);
+    int last_cell = mygrid->Nloc[0] - 1;
+    for (int jj = j; jj <= (yFace ? j + 1 : j); jj++){
+      E1(last_cell + 1, jj, k) = +c1*(2.0*B2(last_cell, jj, k) - c2*E1(last_cell, jj, k));
+      E2(last_cell + 1, jj, k) = -c1*(2.0*B1(last_cell, jj, k) + c2*E2(last_cell, jj, k));
+    }
+  }
+  if (yFace)
+    openBoundariesE_2YFace(k, false);
+}
+
+// the high open y face of plane k, on the cells beyond the first Nexchange x layers only if outerOnly
+void EM_FIELD::openBoundariesE_2YFace(int k, bool outerOnly){
+  int last_row = mygrid->Nloc[1] - 1;
+  double alpha = (mygrid->dt / mygrid->dr[1])*mygrid->iStretchingDerivativeCorrection[1][0];
+  double c1 = 1. / (1 + alpha*0.5);
+  double c2 = (1 - alpha*0.5);
+  for (int i = 0; i < N_grid[0]; i++){
+    int ii = i - acc.edge;
+    if (outerOnly && ii >= -acc.Nexchange && ii < mygrid->Nloc[0] + acc.Nexchange)
+      continue;
+    E0(ii, last_row + 1, k) = -c1*(2.0*B2(ii, last_row, k) + c2*E0(ii, last_row, k));
+    E2(ii, last_row + 1, k) = +c1*(2.0*B0(ii, last_row, k) - c2*E2(ii, last_row, k));
+  }
+}
+
 void EM_FIELD::init_output_diag(std::ofstream &ff)
 {
   if (mygrid->myid == mygrid->master_proc){
@@ -1035,16 +1754,13 @@ void EM_FIELD::initialize_cos2_plane_wave_angle(double lambda0, double amplitude
 {
 
   //DA USARE laser_pulse_initial_position !
-  int i, j, k;
   int Nx, Ny, Nz;
-  double k0, rx, x, y, sigma_z, x0;
-  double rxEnvelope;
+  double k0, x0;
   amplitude *= (2 * M_PI) / lambda0;
   Nx = mygrid->Nloc[0];
   Ny = mygrid->Nloc[1];
   Nz = mygrid->Nloc[2];
   k0 = 2 * M_PI / lambda0;
-  sigma_z = t_FWHM;
 
   double mycos, mysin;
   mycos = cos(angle);
@@ -1059,136 +1775,76 @@ void EM_FIELD::initialize_cos2_plane_wave_angle(double lambda0, double amplitude
   }
 
   x0 = laser_pulse_initial_position;
-  if (polarization == P_POLARIZATION){
-
-    for (k = 0; k < Nz; k++)
-      for (j = 0; j < Ny; j++)
-        for (i = 0; i < Nx; i++)
-        {
-      x = mygrid->cirloc[0][i];
-      y = mygrid->chrloc[1][j];
-
-      rx = xcenter + (x - xcenter)*mycos + y*mysin;
-      rx -= x0;
-      rxEnvelope = x - x0;
-      E1(i, j, k) += amplitude*cos2_plateau_profile(rise_time, t_FWHM - rise_time, rxEnvelope)*cos(k0*rx)*mycos;
-
-      x = mygrid->chrloc[0][i];
-      y = mygrid->cirloc[1][j];
-
-      rx = xcenter + (x - xcenter)*mycos + y*mysin;
-      rx -= x0;
-      rxEnvelope = x - x0;
-      E0(i, j, k) += -amplitude*cos2_plateau_profile(rise_time, t_FWHM - rise_time, rxEnvelope)*cos(k0*rx)*mysin;
 
-      x = mygrid->chrloc[0][i];
-      y = mygrid->chrloc[1][j];
-      rx = xcenter + (x - xcenter)*mycos + y*mysin;
-      rx -= x0;
-      rxEnvelope = x - x0;
-      B2(i, j, k) += amplitude*cos2_plateau_profile(rise_time, t_FWHM - rise_time, rxEnvelope)*cos(k0*rx);
+  // the envelope depends on x only and the phase k0*rx splits into x and y:
+  // one table per axis on integer (I) and half-integer (H) positions
+  double *envI = (double*)malloc(6 * Nx*sizeof(double));
+  double *envH = envI + Nx;
+  double *cxI = envI + 2 * Nx, *sxI = envI + 3 * Nx;
+  double *cxH = envI + 4 * Nx, *sxH = envI + 5 * Nx;
+  double *cyI = (double*)malloc(4 * Ny*sizeof(double));
+  double *syI = cyI + Ny, *cyH = cyI + 2 * Ny, *syH = cyI + 3 * Ny;
 
+#pragma omp parallel for
+  for (int i = 0; i < Nx; i++){
+    double xI = mygrid->cirloc[0][i];
+    double xH = mygrid->chrloc[0][i];
+    envI[i] = amplitude*cos2_plateau_profile(rise_time, t_FWHM - rise_time, xI - x0);
+    envH[i] = amplitude*cos2_plateau_profile(rise_time, t_FWHM - rise_time, xH - x0);
+    cxI[i] = cos(k0*(xcenter + (xI - xcenter)*mycos - x0));
+    sxI[i] = sin(k0*(xcenter + (xI - xcenter)*mycos - x0));
+    cxH[i] = cos(k0*(xcenter + (xH - xcenter)*mycos - x0));
+    sxH[i] = sin(k0*(xcenter + (xH - xcenter)*mycos - x0));
+  }
+  for (int j = 0; j < Ny; j++){
+    cyI[j] = cos(k0*mygrid->cirloc[1][j] * mysin);
+    syI[j] = sin(k0*mygrid->cirloc[1][j] * mysin);
+    cyH[j] = cos(k0*mygrid->chrloc[1][j] * mysin);
+    syH[j] = sin(k0*mygrid->chrloc[1][j] * mysin);
+  }
 
+  if (polarization == P_POLARIZATION){
+#pragma omp parallel for collapse(2)
+    for (int k = 0; k < Nz; k++)
+      for (int j = 0; j < Ny; j++)
+        for (int i = 0; i < Nx; i++){
+      E1(i, j, k) += envI[i] * (cxI[i] * cyH[j] - sxI[i] * syH[j])*mycos;
+      E0(i, j, k) += -envH[i] * (cxH[i] * cyI[j] - sxH[i] * syI[j])*mysin;
+      B2(i, j, k) += envH[i] * (cxH[i] * cyH[j] - sxH[i] * syH[j]);
         }
   }
   else if (polarization == S_POLARIZATION){
-
-    for (k = 0; k < Nz; k++)
-      for (j = 0; j < Ny; j++)
-        for (i = 0; i < Nx; i++)
-        {
-      x = mygrid->chrloc[0][i];
-      y = mygrid->cirloc[1][j];
-
-      rx = xcenter + (x - xcenter)*mycos + y*mysin;
-      rx -= x0;
-      rxEnvelope = x - x0;
-      B1(i, j, k) += amplitude*cos2_plateau_profile(rise_time, t_FWHM - rise_time, rxEnvelope)*cos(k0*rx)*mycos;
-
-      x = mygrid->cirloc[0][i];
-      y = mygrid->chrloc[1][j];
-
-      rx = xcenter + (x - xcenter)*mycos + y*mysin;
-      rx -= x0;
-      rxEnvelope = x - x0;
-      B0(i, j, k) += -amplitude*cos2_plateau_profile(rise_time, t_FWHM - rise_time, rxEnvelope)*cos(k0*rx)*mysin;
-
-      x = mygrid->cirloc[0][i];
-      y = mygrid->cirloc[1][j];
-      rx = xcenter + (x - xcenter)*mycos + y*mysin;
-      rx -= x0;
-      rxEnvelope = x - x0;
-      E2(i, j, k) -= amplitude*cos2_plateau_profile(rise_time, t_FWHM - rise_time, rxEnvelope)*cos(k0*rx);
-
-
+#pragma omp parallel for collapse(2)
+    for (int k = 0; k < Nz; k++)
+      for (int j = 0; j < Ny; j++)
+        for (int i = 0; i < Nx; i++){
+      B1(i, j, k) += envH[i] * (cxH[i] * cyI[j] - sxH[i] * syI[j])*mycos;
+      B0(i, j, k) += -envI[i] * (cxI[i] * cyH[j] - sxI[i] * syH[j])*mysin;
+      E2(i, j, k) -= envI[i] * (cxI[i] * cyI[j] - sxI[i] * syI[j]);
         }
-
   }
   else if (polarization == CIRCULAR_POLARIZATION){
-    for (k = 0; k < Nz; k++)
-      for (j = 0; j < Ny; j++)
-        for (i = 0; i < Nx; i++)
-        {
-      x = mygrid->cirloc[0][i];
-      y = mygrid->chrloc[1][j];
-
-      rx = xcenter + (x - xcenter)*mycos + y*mysin;
-      rx -= x0;
-      rxEnvelope = x - x0;
-      E1(i, j, k) += amplitude*cos2_plateau_profile(rise_time, t_FWHM - rise_time, rxEnvelope)*cos(k0*rx)*mycos;
-
-      x = mygrid->chrloc[0][i];
-      y = mygrid->cirloc[1][j];
-
-      rx = xcenter + (x - xcenter)*mycos + y*mysin;
-      rx -= x0;
-      rxEnvelope = x - x0;
-      E0(i, j, k) += -amplitude*cos2_plateau_profile(rise_time, t_FWHM - rise_time, rxEnvelope)*cos(k0*rx)*mysin;
-
-      x = mygrid->chrloc[0][i];
-      y = mygrid->chrloc[1][j];
-      rx = xcenter + (x - xcenter)*mycos + y*mysin;
-      rx -= x0;
-      rxEnvelope = x - x0;
-      B2(i, j, k) += amplitude*cos2_plateau_profile(rise_time, t_FWHM - rise_time, rxEnvelope)*cos(k0*rx);
-
-
-      x = mygrid->chrloc[0][i];
-      y = mygrid->cirloc[1][j];
-
-      rx = xcenter + (x - xcenter)*mycos + y*mysin;
-      rx -= x0;
-      rxEnvelope = x - x0;
-      B1(i, j, k) += amplitude*cos2_plateau_profile(rise_time, t_FWHM - rise_time, rxEnvelope)*sin(k0*rx)*mycos;
-
-      x = mygrid->cirloc[0][i];
-      y = mygrid->chrloc[1][j];
-
-      rx = xcenter + (x - xcenter)*mycos + y*mysin;
-      rx -= x0;
-
-      rxEnvelope = x - x0;
-      B0(i, j, k) += -amplitude*cos2_plateau_profile(rise_time, t_FWHM - rise_time, rxEnvelope)*sin(k0*rx)*mysin;
-
-      x = mygrid->cirloc[0][i];
-      y = mygrid->cirloc[1][j];
-      rx = xcenter + (x - xcenter)*mycos + y*mysin;
-      rx -= x0;
-      rxEnvelope = x - x0;
-      E2(i, j, k) -= amplitude*cos2_plateau_profile(rise_time, t_FWHM - rise_time, rxEnvelope)*sin(k0*rx);
-
-
+#pragma omp parallel for collapse(2)
+    for (int k = 0; k < Nz; k++)
+      for (int j = 0; j < Ny; j++)
+        for (int i = 0; i < Nx; i++){
+      E1(i, j, k) += envI[i] * (cxI[i] * cyH[j] - sxI[i] * syH[j])*mycos;
+      E0(i, j, k) += -envH[i] * (cxH[i] * cyI[j] - sxH[i] * syI[j])*mysin;
+      B2(i, j, k) += envH[i] * (cxH[i] * cyH[j] - sxH[i] * syH[j]);
+      B1(i, j, k) += envH[i] * (sxH[i] * cyI[j] + cxH[i] * syI[j])*mycos;
+      B0(i, j, k) += -envI[i] * (sxI[i] * cyH[j] + cxI[i] * syH[j])*mysin;
+      E2(i, j, k) -= envI[i] * (sxI[i] * cyI[j] + cxI[i] * syI[j]);
         }
   }
-
+  free(envI);
+  free(cyI);
 }
 
 void EM_FIELD::initialize_plane_wave_angle(double lambda0, double amplitude,
   double angle, pulsePolarization polarization)
 {
-  int i, j, k;
   int Nx, Ny, Nz;
-  double k0, x, y, rx;
+  double k0;
 
   amplitude *= (2 * M_PI) / lambda0;
   Nx = mygrid->Nloc[0];
@@ -1207,31 +1863,35 @@ void EM_FIELD::initialize_plane_wave_angle(double lambda0, double amplitude,
     mysin = (mysin > 0) ? (1) : (-1);
   }
 
-  for (k = 0; k < Nz; k++)
-    for (j = 0; j < Ny; j++)
-      for (i = 0; i < Nx; i++){
-    x = mygrid->cirloc[0][i];
-    y = mygrid->chrloc[1][j];
-    rx = x*mycos + y*mysin;
-    //B0(i,j,k)=0;
-    //E2(i,j,k)=B1(i,j,k)=0;
-
-    x = mygrid->cirloc[0][i];
-    y = mygrid->chrloc[1][j];
-    rx = x*mycos + y*mysin;
-    E1(i, j, k) += amplitude*cos(k0*rx)*mycos;
-
-    x = mygrid->chrloc[0][i];
-    y = mygrid->cirloc[1][j];
-    rx = x*mycos + y*mysin;
-    E0(i, j, k) += -amplitude*cos(k0*rx)*mysin;
-
-    x = mygrid->chrloc[0][i];
-    y = mygrid->chrloc[1][j];
-    rx = x*mycos + y*mysin;
-    B2(i, j, k) += amplitude*cos(k0*rx);
-      }
+  // cos(k0*(x*mycos + y*mysin)) split into factors along x and along y
+  double *cxI = (double*)malloc(4 * Nx*sizeof(double));
+  double *sxI = cxI + Nx, *cxH = cxI + 2 * Nx, *sxH = cxI + 3 * Nx;
+  double *cyI = (double*)malloc(4 * Ny*sizeof(double));
+  double *syI = cyI + Ny, *cyH = cyI + 2 * Ny, *syH = cyI + 3 * Ny;
 
+  for (int i = 0; i < Nx; i++){
+    cxI[i] = cos(k0*mygrid->cirloc[0][i] * mycos);
+    sxI[i] = sin(k0*mygrid->cirloc[0][i] * mycos);
+    cxH[i] = cos(k0*mygrid->chrloc[0][i] * mycos);
+    sxH[i] = sin(k0*mygrid->chrloc[0][i] * mycos);
+  }
+  for (int j = 0; j < Ny; j++){
+    cyI[j] = cos(k0*mygrid->cirloc[1][j] * mysin);
+    syI[j] = sin(k0*mygrid->cirloc[1][j] * mysin);
+    cyH[j] = cos(k0*mygrid->chrloc[1][j] * mysin);
+    syH[j] = sin(k0*mygrid->chrloc[1][j] * mysin);
+  }
+
+#pragma omp parallel for collapse(2)
+  for (int k = 0; k < Nz; k++)
+    for (int j = 0; j < Ny; j++)
+      for (int i = 0; i < Nx; i++){
+    E1(i, j, k) += amplitude*(cxI[i] * cyH[j] - sxI[i] * syH[j])*mycos;
+    E0(i, j, k) += -amplitude*(cxH[i] * cyI[j] - sxH[i] * syI[j])*mysin;
+    B2(i, j, k) += amplitude*(cxH[i] * cyH[j] - sxH[i] * syH[j]);
+      }
+  free(cxI);
+  free(cyI);
 }
 
 void EM_FIELD::auxiliary_rotation(double xin, double yin, double &xp, double &yp, double xcenter, double theta)
@@ -1244,14 +1904,10 @@ void EM_FIELD::initialize_gaussian_pulse_angle(double lambda0, double amplitude,
   double t_FWHM, double waist, double focus_position, double xcenter,
   double angle, pulsePolarization polarization)
 {
-  int i, j, k;
   int Nx, Ny, Nz;
-  double xh, yh, zh;
-  double xx, yy, zz, tt = 0;
-  double xp, yp;
+  double tt = 0;
   double lambda, w0, fwhm;
   double xc, tc;
-  double field[6];
   double dim_factorY = 1, dim_factorZ = 1;
 
   amplitude *= (2 * M_PI) / lambda0;
@@ -1287,10 +1943,19 @@ void EM_FIELD::initialize_gaussian_pulse_angle(double lambda0, double amplitude,
     dim_factorY = dim_factorZ = 0;
   }
 
-  for (k = 0; k < Nz; k++)
-    for (j = 0; j < Ny; j++)
-      for (i = 0; i < Nx; i++)
+  if (angle == 0){
+    initialize_gaussian_pulse_tabulated(amplitude, tt, lambda, fwhm, w0, xc,
+      dim_factorY, dim_factorZ, polarization);
+    return;
+  }
+
+#pragma omp parallel for collapse(2)
+  for (int k = 0; k < Nz; k++)
+    for (int j = 0; j < Ny; j++)
+      for (int i = 0; i < Nx; i++)
       {
+    double xx, yy, zz, xh, yh, zh, xp, yp;
+    double field[6];
     xx = mygrid->cirloc[0][i];
     yy = dim_factorY*mygrid->cirloc[1][j];
     zz = dim_factorZ*mygrid->cirloc[2][k];
@@ -1328,6 +1993,162 @@ void EM_FIELD::initialize_gaussian_pulse_angle(double lambda0, double amplitude,
       }
 }
 
+// factors of the gaussian beam that depend on x only (phase, Gouy, amplitudes)
+struct gaussianAxialFactors{
+  double cPhase, sPhase;  // e^{i(phi + atan(xn))}
+  double cGouy, sGouy;    // e^{i atan(xn)}
+  double xn, invw2;       // x/zra, 1/waist^2
+  double a00, a10, a01;
+};
+
+// transverse factors for a coordinate r (y or z) at fixed x
+struct gaussianTransverseFactors{
+  double r, e, c, s, u;   // r, exp(-r^2/waist^2), e^{-i xn r^2/waist^2}, r^2/w0^2
+};
+
+static inline void fillGaussianTransverse(gaussianTransverseFactors &t, const gaussianAxialFactors &a, double r, double w0){
+  double r2 = r*r;
+  t.r = r;
+  t.e = exp(-r2*a.invw2);
+  t.c = cos(a.xn*r2*a.invw2);
+  t.s = -sin(a.xn*r2*a.invw2);
+  t.u = r2 / (w0*w0);
+}
+
+// the same modes as gaussian_pulse, recomposed as products of complex factors:
+// amp01*e^{i phig01} = a01*rprofile*e^{i(phig00 + 2 atan(xn))}*((1-uu) - i xn)
+static inline void gaussianModesFromFactors(const gaussianAxialFactors &a,
+  const gaussianTransverseFactors &ty, const gaussianTransverseFactors &tz, double *modes){
+  double rprofile = ty.e*tz.e;
+  double uu = ty.u + tz.u;
+  double cyz = ty.c*tz.c - ty.s*tz.s;
+  double syz = ty.c*tz.s + ty.s*tz.c;
+  double c00 = a.cPhase*cyz - a.sPhase*syz;
+  double s00 = a.cPhase*syz + a.sPhase*cyz;
+  double c10 = c00*a.cGouy - s00*a.sGouy;
+  double s10 = c00*a.sGouy + s00*a.cGouy;
+  double cF = c10*a.cGouy - s10*a.sGouy;
+  double sF = c10*a.sGouy + s10*a.cGouy;
+  double c01 = cF*(1 - uu) + sF*a.xn;
+  double s01 = sF*(1 - uu) - cF*a.xn;
+
+  modes[0] = a.a00*rprofile*s00;   //Pamp00
+  modes[1] = a.a10*rprofile*c10;   //Pamp10
+  modes[2] = a.a01*rprofile*c01;   //Pamp01
+  modes[3] = a.a00*rprofile*c00;   //Samp00
+  modes[4] = -a.a10*rprofile*s10;  //Samp10
+  modes[5] = -a.a01*rprofile*s01;  //Samp01
+}
+
+void EM_FIELD::initialize_gaussian_pulse_tabulated(double amplitude, double tt, double lambda,
+  double fwhm, double w0, double xc, double dim_factorY, double dim_factorZ,
+  pulsePolarization polarization)
+{
+  int Nx, Ny, Nz;
+  double k0, epsilon, sigma, zra;
+  Nx = mygrid->Nloc[0];
+  Ny = mygrid->Nloc[1];
+  Nz = mygrid->Nloc[2];
+  k0 = 2 * M_PI / lambda;
+  epsilon = 1 / (k0*w0);
+  sigma = lambda / fwhm;
+  zra = M_PI*w0*w0;
+
+  // axial[0][i] on the integer points, axial[1][i] on the half-integer ones
+  gaussianAxialFactors *axial[2];
+  axial[0] = (gaussianAxialFactors*)malloc(2 * Nx*sizeof(gaussianAxialFactors));
+  axial[1] = axial[0] + Nx;
+
+#pragma omp parallel for
+  for (int i = 0; i < Nx; i++){
+    for (int sx = 0; sx < 2; sx++){
+      double xx = ((sx == 0) ? mygrid->cirloc[0][i] : mygrid->chrloc[0][i]) + xc;
+      double waist = w0*sqrt(1 + (xx*xx) / (zra*zra));
+      double tprofile = cos2_profile((tt - xx) / fwhm);
+      double tprofile01 = cossin_profile((tt - xx) / fwhm);
+      double xn = xx / zra;
+      double gouy = atan(xn);
+      double phase = k0*(tt - xx) + gouy;
+      gaussianAxialFactors &a = axial[sx][i];
+      a.cPhase = cos(phase);
+      a.sPhase = sin(phase);
+      a.cGouy = cos(gouy);
+      a.sGouy = sin(gouy);
+      a.xn = xn;
+      a.invw2 = 1 / (waist*waist);
+      a.a00 = (w0 / waist)*tprofile;
+      a.a10 = 2 * epsilon*(w0 / (waist*waist))*tprofile;
+      a.a01 = 0.5*sigma*(w0 / waist)*(w0 / waist)*(w0 / waist)*tprofile01;
+    }
+  }
+
+  // factors along z for every (sx,sz,k,i): zfact[((sx*2+sz)*Nz+k)*Nx+i]
+  gaussianTransverseFactors *zfact = (gaussianTransverseFactors*)malloc(4 * Nz*Nx*sizeof(gaussianTransverseFactors));
+#pragma omp parallel for
+  for (int k = 0; k < Nz; k++){
+    double zz[2];
+    zz[0] = dim_factorZ*mygrid->cirloc[2][k];
+    zz[1] = dim_factorZ*mygrid->chrloc[2][k];
+    for (int sx = 0; sx < 2; sx++)
+      for (int sz = 0; sz < 2; sz++)
+        for (int i = 0; i < Nx; i++)
+          fillGaussianTransverse(zfact[((sx * 2 + sz)*Nz + k)*Nx + i], axial[sx][i], zz[sz], w0);
+  }
+
+#pragma omp parallel
+  {
+    // factors along y of the current row j: yfact[(sx*2+sy)*Nx+i]
+    gaussianTransverseFactors *yfact = (gaussianTransverseFactors*)malloc(4 * Nx*sizeof(gaussianTransverseFactors));
+    gaussianTransverseFactors *yII = yfact, *yIH = yfact + Nx, *yHI = yfact + 2 * Nx, *yHH = yfact + 3 * Nx;
+    double modes[6], field[6];
+
+#pragma omp for
+    for (int j = 0; j < Ny; j++){
+      double yy[2];
+      yy[0] = dim_factorY*mygrid->cirloc[1][j];
+      yy[1] = dim_factorY*mygrid->chrloc[1][j];
+      for (int sx = 0; sx < 2; sx++)
+        for (int sy = 0; sy < 2; sy++)
+          for (int i = 0; i < Nx; i++)
+            fillGaussianTransverse(yfact[(sx * 2 + sy)*Nx + i], axial[sx][i], yy[sy], w0);
+
+      for (int k = 0; k < Nz; k++){
+        gaussianTransverseFactors *zII = zfact + (0 * Nz + k)*Nx;
+        gaussianTransverseFactors *zIH = zfact + (1 * Nz + k)*Nx;
+        gaussianTransverseFactors *zHI = zfact + (2 * Nz + k)*Nx;
+        gaussianTransverseFactors *zHH = zfact + (3 * Nz + k)*Nx;
+        for (int i = 0; i < Nx; i++){
+          gaussianAxialFactors &aI = axial[0][i];
+          gaussianAxialFactors &aH = axial[1][i];
+
+          gaussianModesFromFactors(aH, yHI[i], zHI[i], modes);
+          gaussian_pulse_fields(yHI[i].r, zHI[i].r, aH.xn, modes, field, polarization);
+          E0(i, j, k) += amplitude*field[0];
+          gaussianModesFromFactors(aI, yIH[i], zII[i], modes);
+          gaussian_pulse_fields(yIH[i].r, zII[i].r, aI.xn, modes, field, polarization);
+          E1(i, j, k) += amplitude*field[1];
+          gaussianModesFromFactors(aI, yII[i], zIH[i], modes);
+          gaussian_pulse_fields(yII[i].r, zIH[i].r, aI.xn, modes, field, polarization);
+          E2(i, j, k) += amplitude*field[2];
+
+          gaussianModesFromFactors(aI, yIH[i], zIH[i], modes);
+          gaussian_pulse_fields(yIH[i].r, zIH[i].r, aI.xn, modes, field, polarization);
+          B0(i, j, k) += amplitude*field[3];
+          gaussianModesFromFactors(aH, yHI[i], zHH[i], modes);
+          gaussian_pulse_fields(yHI[i].r, zHH[i].r, aH.xn, modes, field, polarization);
+          B1(i, j, k) += amplitude*field[4];
+          gaussianModesFromFactors(aH, yHH[i], zHI[i], modes);
+          gaussian_pulse_fields(yHH[i].r, zHI[i].r, aH.xn, modes, field, polarization);
+          B2(i, j, k) += amplitude*field[5];
+        }
+      }
+    }
+    free(yfact);
+  }
+  free(zfact);
+  free(axial[0]);
+}
+
 //TODO DA RIVEDERE
 /*void inject_field(double angle)
     {
@@ -1440,6 +2261,9 @@ void EM_FIELD::addFieldsFromFile(std::string name){
   free(myx);
 }
 
+//the window is moved by shifting the storage origin along x (see shiftWindowOrigin):
+//only the new stripe on the right is received from the neighbour. The right ghost layers
+//beyond Nx are zeroed as before, and filled by the next boundary_conditions()
 void EM_FIELD::move_window()
 {
   int Nx, Ngy, Ngz;
@@ -1450,7 +2274,7 @@ void EM_FIELD::move_window()
   if (!mygrid->shouldIMove)
     return;
 
-  static double *send_buffer = NULL, *recv_buffer = NULL;
+  static fieldType *send_buffer = NULL, *recv_buffer = NULL;
   static int shiftCellNumber = 0;
   static int exchangeCellNumber = 0;
   if (shiftCellNumber != mygrid->imove_mw){
@@ -1458,8 +2282,8 @@ void EM_FIELD::move_window()
     exchangeCellNumber = shiftCellNumber + 1;
     int sendcount;
     sendcount = Ncomp*exchangeCellNumber*Ngy*Ngz;
-    send_buffer = (double *)realloc((void*)send_buffer, sendcount*sizeof(double));
-    recv_buffer = (double *)realloc((void*)recv_buffer, sendcount*sizeof(double));
+    send_buffer = (fieldType *)realloc((void*)send_buffer, sendcount*sizeof(fieldType));
+    recv_buffer = (fieldType *)realloc((void*)recv_buffer, sendcount*sizeof(fieldType));
   }
   for (int k = 0; k < Ngz; k++){
     for (int j = 0; j < Ngy; j++){
@@ -1475,172 +2299,290 @@ void EM_FIELD::move_window()
   int ileft, iright;
   MPI_Status status;
   MPI_Cart_shift(mygrid->cart_comm, 0, 1, &ileft, &iright);
-  MPI_Sendrecv(send_buffer, sendcount, MPI_DOUBLE, ileft, 13,
-    recv_buffer, sendcount, MPI_DOUBLE, iright, 13,
+  MPI_Sendrecv(send_buffer, sendcount, MPI_FIELD_TYPE, ileft, 13,
+    recv_buffer, sendcount, MPI_FIELD_TYPE, iright, 13,
     MPI_COMM_WORLD, &status);
 
   if (mygrid->rmyid[0] == (mygrid->rnproc[0] - 1)){
-    memset((void*)recv_buffer, 0, sendcount*sizeof(double));
-    fflush(stdout);
+    memset((void*)recv_buffer, 0, sendcount*sizeof(fieldType));
   }
 
+  shiftWindowOrigin(shiftCellNumber);
+
   for (int k = 0; k < Ngz; k++)
     for (int j = 0; j < Ngy; j++)
     {
-    for (int i = -acc.Nexchange; i < (Nx - shiftCellNumber); i++)
+    for (int i = 0; i < (shiftCellNumber + 1); i++){
       for (int c = 0; c < Ncomp; c++)
       {
-      VEB(c, i, j - acc.edge, k - acc.edge) = VEB(c, i + shiftCellNumber, j - acc.edge, k - acc.edge);
+        VEB(c, i + (Nx - shiftCellNumber), j - acc.edge, k - acc.edge) = recv_buffer[c + i*Ncomp + j*Ncomp*exchangeCellNumber + k*Ncomp*exchangeCellNumber*Ngy];
       }
-    for (int i = 0; i < (shiftCellNumber + 1); i++){
+    }
+    for (int i = Nx + 1; i < (Nx + acc.edge); i++){
       for (int c = 0; c < Ncomp; c++)
       {
-        VEB(c, i + (Nx - shiftCellNumber), j - acc.edge, k - acc.edge) = recv_buffer[c + i*Ncomp + j*Ncomp*exchangeCellNumber + k*Ncomp*exchangeCellNumber*Ngy];
+        VEB(c, i, j - acc.edge, k - acc.edge) = 0;
       }
     }
     }
+  EBEnergyExtremesFlag = false;
+}
 
-  //TODO: si dovrebbe poter rimuovere
-  EM_FIELD::boundary_conditions();
+//moves the logical x origin "shift" cells to the right. While the slack allows it
+//nothing is copied, otherwise the whole array is moved back to xOrigin = 0 with a single memmove.
+//Either way the last "shift" cells on the right are left undefined
+void EM_FIELD::shiftWindowOrigin(int shift){
+  if ((xOrigin + shift) <= xSlack){
+    xOrigin += shift;
+    return;
+  }
+  resetWindowOrigin(shift);
 }
 
-double EM_FIELD::getEBenergy(double* EEnergy, double* BEnergy){
+void EM_FIELD::resetWindowOrigin(int shift){
+  long int displacement = ((long int)(xOrigin + shift))*Ncomp;
+  if (displacement > 0)
+    memmove((void*)val, (void*)(val + displacement), (Ntot*Ncomp - displacement)*sizeof(fieldType));
+  xOrigin = 0;
+}
 
-  EEnergy[0] = 0.0; EEnergy[1] = 0.0; EEnergy[2] = 0.0;
-  BEnergy[0] = 0.0; BEnergy[1] = 0.0; BEnergy[2] = 0.0;
-  double dxICorr, dyICorr, dzICorr;
-  double dxHCorr, dyHCorr, dzHCorr;
-  for (int k = 0; k < mygrid->uniquePointsloc[2]; k++){
-    dzICorr = 1. / mygrid->iStretchingDerivativeCorrection[2][k];
-    dzHCorr = 1. / mygrid->hStretchingDerivativeCorrection[2][k];
-    for (int j = 0; j < mygrid->uniquePointsloc[1]; j++){
-      dyICorr = 1. / mygrid->iStretchingDerivativeCorrection[1][j];
-      dyHCorr = 1. / mygrid->hStretchingDerivativeCorrection[1][j];
-      for (int i = 0; i < mygrid->uniquePointsloc[0]; i++){
-        dxICorr = 1. / mygrid->iStretchingDerivativeCorrection[0][i];
-        dxHCorr = 1. / mygrid->hStretchingDerivativeCorrection[0][i];
-
-        EEnergy[0] += E0(i, j, k)*E0(i, j, k)*dxHCorr*dyICorr*dzICorr;
-        EEnergy[1] += E1(i, j, k)*E1(i, j, k)*dxICorr*dyHCorr*dzICorr;
-        EEnergy[2] += E2(i, j, k)*E2(i, j, k)*dxICorr*dyICorr*dzHCorr;
-        BEnergy[0] += B0(i, j, k)*B0(i, j, k)*dxICorr*dyHCorr*dzHCorr;
-        BEnergy[1] += B1(i, j, k)*B1(i, j, k)*dxHCorr*dyICorr*dzHCorr;
-        BEnergy[2] += B2(i, j, k)*B2(i, j, k)*dxHCorr*dyHCorr*dzICorr;
+//tiles holding a field component above the active region threshold
+void EM_FIELD::markActiveTiles(std::vector<int> &activity){
+  if (mygrid->getFieldSolver() == PSATD_SOLVER){
+    printf("ERROR: the active region is not available with the PSATD field solver\n");
+    exit(17);
+  }
+  double threshold = mygrid->getActiveRegionThreshold();
+  int Nx = mygrid->Nloc[0], Ny = mygrid->Nloc[1], Nz = mygrid->Nloc[2];
+  std::vector<int> hot(Nx, 0);
+  // each thread scans its own (j,k) rows, the hot columns are OR-ed at the end
+#pragma omp parallel
+  {
+    std::vector<int> lhot(Nx, 0);
+#pragma omp for
+    for (int jk = 0; jk < Ny*Nz; jk++){
+      int j = jk % Ny, k = jk / Ny;
+      for (int i = 0; i < Nx; i++){
+        if (lhot[i])
+          continue;
+        for (int c = 0; c < 6; c++){
+          if (fabs(VEB(c, i, j, k)) > threshold){
+            lhot[i] = 1;
+            break;
+          }
+        }
       }
     }
+#pragma omp critical
+    {
+      for (int i = 0; i < Nx; i++)
+        hot[i] |= lhot[i];
+    }
+  }
+  for (int i = 0; i < Nx; i++){
+    if (hot[i])
+      activity[mygrid->getActiveTileOf(i)] = 1;
   }
+}
+
+double EM_FIELD::getEBenergy(double* EEnergy, double* BEnergy){
+  double sums[ENERGY_SUMS_BASE + 2 * MAX_ENERGY_REGIONS], mins[6], maxs[8];
+  sweepEnergyAndExtremes(sums, mins, maxs);
 
   for (int c = 0; c < 3; c++){
-    EEnergy[c] *= mygrid->dr[0] * mygrid->dr[1] * mygrid->dr[2] / (8.0*M_PI);
-    BEnergy[c] *= mygrid->dr[0] * mygrid->dr[1] * mygrid->dr[2] / (8.0*M_PI);
+    EEnergy[c] = sums[c];
+    BEnergy[c] = sums[3 + c];
   }
-
   return (EEnergy[0] + EEnergy[1] + EEnergy[2] + BEnergy[0] + BEnergy[1] + BEnergy[2]);
 }
 
-//exmim,eymin, ezmin, bxmin, bymin, bzmin, exmax, eymax, ezmax, bxmax, bymax, bzmax,etmax,btmax
-void EM_FIELD::computeEnergyAndExtremes(){
-
-  if (EBEnergyExtremesFlag){
-    return;
+int EM_FIELD::addEnergyRegion(double *rmin, double *rmax){
+  if (NenergyRegions >= MAX_ENERGY_REGIONS){
+    printf("ERROR: too many energy regions (max %i)\n", MAX_ENERGY_REGIONS);
+    exit(17);
   }
+  for (int c = 0; c < 3; c++){
+    energyRegionMin[NenergyRegions][c] = rmin[c];
+    energyRegionMax[NenergyRegions][c] = rmax[c];
+  }
+  EBEnergyExtremesFlag = false;
+  return NenergyRegions++;
+}
+
+// single threaded sweep over the unique local points: local energies (already scaled), Poynting
+// vector and region energies in sums[], component extrema in mins[]/maxs[], |E|^2 and |B|^2 max in maxs[6,7]
+void EM_FIELD::sweepEnergyAndExtremes(double *sums, double *mins, double *maxs){
   const double VERY_BIG_NUM_POS = 1.0e30;
   const double VERY_BIG_NUM_NEG = -1.0e30;
-  double dxICorr, dyICorr, dzICorr;
-  double dxHCorr, dyHCorr, dzHCorr;
-
-  double extrema[14];
-
-  for (int i = 0; i < 6; i++){
-    minima[i] = (VERY_BIG_NUM_POS);
-    extrema[i] = 0.0;
-  }
-  for (int i = 0; i < 8; i++){
-    maxima[i] = (VERY_BIG_NUM_NEG);
-    extrema[i + 6] = 0.0;
-  }
-  for (int i = 0; i < 3; i++){
-    total_momentum[i] = 0.0;
-  }
-  for (int i = 0; i < 7; i++){
-    total_energy[i] = 0.0;
-  }
-  double tval;
-
-
-
-  for (int k = 0; k < mygrid->uniquePointsloc[2]; k++){
-    dzICorr = 1. / mygrid->iStretchingDerivativeCorrection[2][k];
-    dzHCorr = 1. / mygrid->hStretchingDerivativeCorrection[2][k];
-    for (int j = 0; j < mygrid->uniquePointsloc[1]; j++){
-      dyICorr = 1. / mygrid->iStretchingDerivativeCorrection[1][j];
-      dyHCorr = 1. / mygrid->hStretchingDerivativeCorrection[1][j];
-      for (int i = 0; i < mygrid->uniquePointsloc[0]; i++){
-        dxICorr = 1. / mygrid->iStretchingDerivativeCorrection[0][i];
-        dxHCorr = 1. / mygrid->hStretchingDerivativeCorrection[0][i];
-
-        total_energy[0] += E0(i, j, k)*E0(i, j, k)*dxHCorr*dyICorr*dzICorr;
-        total_energy[1] += E1(i, j, k)*E1(i, j, k)*dxICorr*dyHCorr*dzICorr;
-        total_energy[2] += E2(i, j, k)*E2(i, j, k)*dxICorr*dyICorr*dzHCorr;
-        total_energy[3] += B0(i, j, k)*B0(i, j, k)*dxICorr*dyHCorr*dzHCorr;
-        total_energy[4] += B1(i, j, k)*B1(i, j, k)*dxHCorr*dyICorr*dzHCorr;
-        total_energy[5] += B2(i, j, k)*B2(i, j, k)*dxHCorr*dyHCorr*dzICorr;
-        double Ex, Ey, Ez, Bx, By, Bz;
-        Ex = 0.5*(E0(i, j, k) + E0(i - 1, j, k));
-        Ey = 0.5*(E1(i, j, k) + E1(i, j - 1, k));
-        Ez = 0.5*(E2(i, j, k) + E2(i, j, k - 1));
-        Bx = 0.5*(B0(i, j, k) + B0(i, j - 1, k - 1));
-        By = 0.5*(B1(i, j, k) + B1(i - 1, j, k - 1));
-        Bz = 0.5*(B2(i, j, k) + B2(i - 1, j - 1, k));
-        total_momentum[0] = (Ey*Bz - Ez*By)*dxICorr*dyICorr*dzICorr;
-        total_momentum[1] = (Ez*Bx - Ex*Bz)*dxICorr*dyICorr*dzICorr;
-        total_momentum[2] = (Ex*By - Ey*Bx)*dxICorr*dyICorr*dzICorr;
-
-        if (E0(i, j, k) <= extrema[0])extrema[0] = E0(i, j, k);
-        if (E1(i, j, k) <= extrema[1])extrema[1] = E1(i, j, k);
-        if (E2(i, j, k) <= extrema[2])extrema[2] = E2(i, j, k);
-
-        if (E0(i, j, k) >= extrema[6])extrema[6] = E0(i, j, k);
-        if (E1(i, j, k) >= extrema[7])extrema[7] = E1(i, j, k);
-        if (E2(i, j, k) >= extrema[8])extrema[8] = E2(i, j, k);
-
-        if (B0(i, j, k) <= extrema[3])extrema[3] = B0(i, j, k);
-        if (B1(i, j, k) <= extrema[4])extrema[4] = B1(i, j, k);
-        if (B2(i, j, k) <= extrema[5])extrema[5] = B2(i, j, k);
-
-        if (B0(i, j, k) >= extrema[9])extrema[9] = B0(i, j, k);
-        if (B1(i, j, k) >= extrema[10])extrema[10] = B1(i, j, k);
-        if (B2(i, j, k) >= extrema[11])extrema[11] = B2(i, j, k);
-
-        tval = E0(i, j, k)*E0(i, j, k) + E1(i, j, k)*E1(i, j, k) + E2(i, j, k)*E2(i, j, k);
-        if (tval >= extrema[12])extrema[12] = tval;
-        tval = B0(i, j, k)*B0(i, j, k) + B1(i, j, k)*B1(i, j, k) + B2(i, j, k)*B2(i, j, k);
-        if (tval >= extrema[13])extrema[13] = tval;
+  const int Nsums = ENERGY_SUMS_BASE + 2 * NenergyRegions;
+  int Nx = mygrid->uniquePointsloc[0];
+  int Ny = mygrid->uniquePointsloc[1];
+  int Nz = mygrid->uniquePointsloc[2];
+
+  // region -> local index ranges [imin,imax) along each axis
+  int regionRange[MAX_ENERGY_REGIONS][6];
+  for (int r = 0; r < NenergyRegions; r++){
+    for (int d = 0; d < 3; d++){
+      int Nd = mygrid->uniquePointsloc[d];
+      int imin = Nd, imax = 0;
+      if (d >= acc.dimensions){
+        imin = 0;
+        imax = Nd;
+      }
+      else{
+        for (int i = 0; i < Nd; i++){
+          if (mygrid->cirloc[d][i] >= energyRegionMin[r][d] && mygrid->cirloc[d][i] < energyRegionMax[r][d]){
+            imin = MIN(imin, i);
+            imax = MAX(imax, i + 1);
+          }
+        }
+      }
+      regionRange[r][2 * d] = imin;
+      regionRange[r][2 * d + 1] = imax;
+    }
+  }
 
+  for (int n = 0; n < Nsums; n++)
+    sums[n] = 0.0;
+  for (int n = 0; n < 6; n++)
+    mins[n] = VERY_BIG_NUM_POS;
+  for (int n = 0; n < 8; n++)
+    maxs[n] = VERY_BIG_NUM_NEG;
+
+#pragma omp parallel
+  {
+    double lsums[ENERGY_SUMS_BASE + 2 * MAX_ENERGY_REGIONS], lmins[6], lmaxs[8];
+    for (int n = 0; n < Nsums; n++)
+      lsums[n] = 0.0;
+    for (int n = 0; n < 6; n++)
+      lmins[n] = VERY_BIG_NUM_POS;
+    for (int n = 0; n < 8; n++)
+      lmaxs[n] = VERY_BIG_NUM_NEG;
+
+#pragma omp for collapse(2)
+    for (int k = 0; k < Nz; k++){
+      for (int j = 0; j < Ny; j++){
+        double dzICorr = 1. / mygrid->iStretchingDerivativeCorrection[2][k];
+        double dzHCorr = 1. / mygrid->hStretchingDerivativeCorrection[2][k];
+        double dyICorr = 1. / mygrid->iStretchingDerivativeCorrection[1][j];
+        double dyHCorr = 1. / mygrid->hStretchingDerivativeCorrection[1][j];
+        for (int i = 0; i < Nx; i++){
+          double dxICorr = 1. / mygrid->iStretchingDerivativeCorrection[0][i];
+          double dxHCorr = 1. / mygrid->hStretchingDerivativeCorrection[0][i];
+          double ex = E0(i, j, k), ey = E1(i, j, k), ez = E2(i, j, k);
+          double bx = B0(i, j, k), by = B1(i, j, k), bz = B2(i, j, k);
+          double en[6];
+
+          en[0] = ex*ex*dxHCorr*dyICorr*dzICorr;
+          en[1] = ey*ey*dxICorr*dyHCorr*dzICorr;
+          en[2] = ez*ez*dxICorr*dyICorr*dzHCorr;
+          en[3] = bx*bx*dxICorr*dyHCorr*dzHCorr;
+          en[4] = by*by*dxHCorr*dyICorr*dzHCorr;
+          en[5] = bz*bz*dxHCorr*dyHCorr*dzICorr;
+          for (int c = 0; c < 6; c++)
+            lsums[c] += en[c];
+
+          double Ex, Ey, Ez, Bx, By, Bz;
+          Ex = 0.5*(ex + E0(i - 1, j, k));
+          Ey = 0.5*(ey + E1(i, j - 1, k));
+          Ez = 0.5*(ez + E2(i, j, k - 1));
+          Bx = 0.5*(bx + B0(i, j - 1, k - 1));
+          By = 0.5*(by + B1(i - 1, j, k - 1));
+          Bz = 0.5*(bz + B2(i - 1, j - 1, k));
+          lsums[6] += (Ey*Bz - Ez*By)*dxICorr*dyICorr*dzICorr;
+          lsums[7] += (Ez*Bx - Ex*Bz)*dxICorr*dyICorr*dzICorr;
+          lsums[8] += (Ex*By - Ey*Bx)*dxICorr*dyICorr*dzICorr;
+
+          for (int r = 0; r < NenergyRegions; r++){
+            if (i >= regionRange[r][0] && i < regionRange[r][1] &&
+              j >= regionRange[r][2] && j < regionRange[r][3] &&
+              k >= regionRange[r][4] && k < regionRange[r][5]){
+              lsums[ENERGY_SUMS_BASE + 2 * r] += en[0] + en[1] + en[2];
+              lsums[ENERGY_SUMS_BASE + 2 * r + 1] += en[3] + en[4] + en[5];
+            }
+          }
+
+          lmins[0] = MIN(lmins[0], ex);
+          lmins[1] = MIN(lmins[1], ey);
+          lmins[2] = MIN(lmins[2], ez);
+          lmins[3] = MIN(lmins[3], bx);
+          lmins[4] = MIN(lmins[4], by);
+          lmins[5] = MIN(lmins[5], bz);
+          lmaxs[0] = MAX(lmaxs[0], ex);
+          lmaxs[1] = MAX(lmaxs[1], ey);
+          lmaxs[2] = MAX(lmaxs[2], ez);
+          lmaxs[3] = MAX(lmaxs[3], bx);
+          lmaxs[4] = MAX(lmaxs[4], by);
+          lmaxs[5] = MAX(lmaxs[5], bz);
+          lmaxs[6] = MAX(lmaxs[6], ex*ex + ey*ey + ez*ez);
+          lmaxs[7] = MAX(lmaxs[7], bx*bx + by*by + bz*bz);
+        }
       }
     }
+
+#pragma omp critical
+    {
+      for (int n = 0; n < Nsums; n++)
+        sums[n] += lsums[n];
+      for (int n = 0; n < 6; n++)
+        mins[n] = MIN(mins[n], lmins[n]);
+      for (int n = 0; n < 8; n++)
+        maxs[n] = MAX(maxs[n], lmaxs[n]);
+    }
   }
 
-  for (int c = 0; c < 3; c++){
-    total_energy[c] *= mygrid->dr[0] * mygrid->dr[1] * mygrid->dr[2] / (8.0*M_PI);
-    total_energy[3 + c] *= mygrid->dr[0] * mygrid->dr[1] * mygrid->dr[2] / (8.0*M_PI);
-    total_momentum[c] *= mygrid->dr[0] * mygrid->dr[1] * mygrid->dr[2] / (8.0*M_PI);
+  double dV = mygrid->dr[0] * mygrid->dr[1] * mygrid->dr[2] / (8.0*M_PI);
+  for (int n = 0; n < Nsums; n++)
+    sums[n] *= dV;
+}
+
+void EM_FIELD::addEnergyAndExtremesTo(packedReduction &red){
+  if (EBEnergyExtremesFlag){
+    reductionOffset[0] = -1;
+    return;
   }
+  double sums[ENERGY_SUMS_BASE + 2 * MAX_ENERGY_REGIONS], mins[6], maxs[8];
+  sweepEnergyAndExtremes(sums, mins, maxs);
+  reductionOffset[0] = red.addSums(sums, ENERGY_SUMS_BASE + 2 * NenergyRegions);
+  reductionOffset[1] = red.addMinima(mins, 6);
+  reductionOffset[2] = red.addMaxima(maxs, 8);
+}
 
-  extrema[12] = sqrt(extrema[12]);
-  extrema[13] = sqrt(extrema[13]);
+void EM_FIELD::getEnergyAndExtremesFrom(packedReduction &red){
+  if (reductionOffset[0] < 0){
+    return;
+  }
+  double sums[ENERGY_SUMS_BASE + 2 * MAX_ENERGY_REGIONS];
+  red.getSums(reductionOffset[0], sums, ENERGY_SUMS_BASE + 2 * NenergyRegions);
+  red.getMinima(reductionOffset[1], minima, 6);
+  red.getMaxima(reductionOffset[2], maxima, 8);
 
+  for (int c = 0; c < 6; c++)
+    total_energy[c] = sums[c];
   total_energy[6] = (total_energy[0] + total_energy[1] + total_energy[2] + total_energy[3] + total_energy[4] + total_energy[5]);
+  for (int c = 0; c < 3; c++)
+    total_momentum[c] = sums[6 + c];
+  for (int r = 0; r < NenergyRegions; r++){
+    regionEnergy[r][0] = sums[ENERGY_SUMS_BASE + 2 * r];
+    regionEnergy[r][1] = sums[ENERGY_SUMS_BASE + 2 * r + 1];
+  }
+  maxima[6] = sqrt(maxima[6]);
+  maxima[7] = sqrt(maxima[7]);
 
-  MPI_Allreduce(MPI_IN_PLACE, &total_energy[0], 3, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-  MPI_Allreduce(MPI_IN_PLACE, &total_energy[3], 3, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-  MPI_Allreduce(MPI_IN_PLACE, &total_energy[6], 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-  MPI_Allreduce(MPI_IN_PLACE, total_momentum, 3, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-  MPI_Allreduce(&extrema[0], minima, 6, MPI_DOUBLE, MPI_MIN, MPI_COMM_WORLD);
-  MPI_Allreduce(&extrema[6], maxima, 8, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
-
+  reductionOffset[0] = -1;
   EBEnergyExtremesFlag = true;
+}
 
+//exmim,eymin, ezmin, bxmin, bymin, bzmin, exmax, eymax, ezmax, bxmax, bymax, bzmax,etmax,btmax
+void EM_FIELD::computeEnergyAndExtremes(){
+
+  if (EBEnergyExtremesFlag){
+    return;
+  }
+  packedReduction red;
+  addEnergyAndExtremesTo(red);
+  red.allreduce(MPI_COMM_WORLD);
+  getEnergyAndExtremesFrom(red);
 }
 
 
@@ -1722,6 +2664,16 @@ void EM_FIELD::gaussian_pulse(int dimensions, double xx, double yy, double zz, d
   Samp10 = amp10*cos(phig10 + M_PI*0.5); //S-polarisation order 1,0
   Samp01 = amp01*cos(phig01 + M_PI*0.5); //S-polarisation order 0,1
 
+  double modes[6] = { Pamp00, Pamp10, Pamp01, Samp00, Samp10, Samp01 };
+  gaussian_pulse_fields(yy, zz, xx, modes, field, polarization);
+}
+
+// modes = {Pamp00, Pamp10, Pamp01, Samp00, Samp10, Samp01}, xx normalized to zra
+void EM_FIELD::gaussian_pulse_fields(double yy, double zz, double xx, double* modes, double* field, pulsePolarization polarization)
+{
+  double Pamp00 = modes[0], Pamp10 = modes[1], Pamp01 = modes[2];
+  double Samp00 = modes[3], Samp10 = modes[4], Samp01 = modes[5];
+
   if (polarization == P_POLARIZATION){
     field[0] = (yy*Pamp10);           //Ex
     field[1] = (Pamp00 - xx*Pamp01);  //Ey
@@ -1746,16 +2698,21 @@ void EM_FIELD::gaussian_pulse(int dimensions, double xx, double yy, double zz, d
     field[4] = -(Samp00 - xx*Samp01); //By
     field[5] = (Pamp00 - xx*Pamp01); //Bz
   }
-
 }
 
+//only the N_grid[0] logical cells of each x row are written (not the moving window slack),
+//so the dump has the same layout as one of an array without slack
 void EM_FIELD::dump(std::ofstream &ff){
-  ff.write((char*)val, Ntot*Ncomp*sizeof(double));
-
+  long int rowLength = ((long int)N_grid[0])*Ncomp;
+  for (long int row = 0; row < ((long int)N_grid[1])*N_grid[2]; row++)
+    ff.write((char*)(val + Ncomp*(xOrigin + row*NxAlloc)), rowLength*sizeof(fieldType));
 }
 
 void EM_FIELD::reloadDump(std::ifstream &ff){
-  ff.read((char*)val, Ntot*Ncomp*sizeof(double));
+  xOrigin = 0;
+  long int rowLength = ((long int)N_grid[0])*Ncomp;
+  for (long int row = 0; row < ((long int)N_grid[1])*N_grid[2]; row++)
+    ff.read((char*)(val + Ncomp*row*NxAlloc), rowLength*sizeof(fieldType));
 }
 
 void EM_FIELD::filterCompAlongX(int comp){
@@ -1864,3 +2821,29 @@ void EM_FIELD::applyFilter(int flags, int dirflags){
     filterDirSelect(5, dirflags);
 
 }
+
+//all the passes of the stack along all the selected directions, then a single halo refresh
+void EM_FIELD::applyFilter(filterStack &stack, int flags, int dirflags){
+  if (mygrid->isStretched() && (mygrid->myid == mygrid->master_proc)){
+    std::cout << "WARNING: filtering and stretched grid are not compatible. Proceed at your own risk." << std::endl;
+  }
+  int comps[6], ncomp = 0;
+  for (int c = 0; c < Ncomp; c++){
+    if (flags & (1 << c))
+      comps[ncomp++] = c;
+  }
+  if (ncomp == 0)
+    return;
+
+  int stride[3];
+  stride[0] = Ncomp;
+  stride[1] = YGrid_factor*Ncomp*NxAlloc;
+  stride[2] = ZGrid_factor*Ncomp*NxAlloc*N_grid[1];
+
+  for (int d = 0; d < acc.dimensions; d++){
+    if (dirflags & (1 << d))
+      stack.applyAlong(mygrid, d, &VEB(0, 0, 0, 0), stride, ncomp, comps);
+  }
+  boundary_conditions();
+}
+
@@ -89,19 +89,16 @@ enum filterOptions{
   fltr_Bz = 1 << 5
 };
 
-enum filterDir{
-  dir_x = 1 << 0,
-  dir_y = 1 << 1,
-  dir_z = 1 << 2
-};
-
 
+#define MAX_ENERGY_REGIONS 8
+#define ENERGY_SUMS_BASE 9
 
 class EM_FIELD{
 public:
   double minima[6], maxima[8];  //14 utility values minima: Exmin Eymin, ..., Bzmin;     maxima: Exmax, Eymax, ..., Bzmax, Emax, Bmax
   double total_energy[7];  // Ex2, Ey2, Ez2, Bx2, By2, Bz2 E2+B2 (totalenergy)
   double total_momentum[3];  // pointing vector Sx Sy Sz
+  double regionEnergy[MAX_ENERGY_REGIONS][2];  // E and B energy inside each region set with addEnergyRegion
 
 
   EM_FIELD();
@@ -120,10 +117,16 @@ public:
 
   void boundary_conditions();  // set on the ghost cells the boundary values  
 
+  void setFieldSolver(fieldSolverType solver);
+  void setSpectralGuardCells(int guard);
+  void setSpectralOrder(int order);
   void new_halfadvance_B();
   void new_advance_B();
   void new_advance_E();
   void new_advance_E(CURRENT *current);
+  void new_advance_EB_tiled();
+  void new_advance_EB_tiled(CURRENT *current);
+  void setTileCacheSize(long int bytes);
 
   static const int myWidth = 12;
   static const int myNarrowWidth = 6;
@@ -138,55 +141,60 @@ public:
   void addFieldsFromFile(std::string name);
 
   void move_window();
+  void markActiveTiles(std::vector<int> &activity);
 
   double getEBenergy(double* EEnergy, double* BEnergy);
   void computeEnergyAndExtremes();
+  int addEnergyRegion(double *rmin, double *rmax);
+  void addEnergyAndExtremesTo(packedReduction &red);
+  void getEnergyAndExtremesFrom(packedReduction &red);
 
   void openBoundariesE_1();
   void openBoundariesE_2();
   void openBoundariesB();
 
   void applyFilter(int flags, int dirflags);
+  void applyFilter(filterStack &stack, int flags, int dirflags);
 
   bool areEnergyExtremesAvailable();
   void dump(std::ofstream &ff);
   void debugDump(std::ofstream &ff);
   void reloadDump(std::ifstream &ff);
   //PUBLIC INLINE FUNCTIONS
-  inline double & E0(int i, int j, int k){
+  inline fieldType & E0(int i, int j, int k){
     return val[my_indice(acc.edge, YGrid_factor, ZGrid_factor,
-      0, i, j, k,
-      N_grid[0], N_grid[1], N_grid[2], Ncomp)];
+      0, i + xOrigin, j, k,
+      NxAlloc, N_grid[1], N_grid[2], Ncomp)];
   }
-  inline double & E1(int i, int j, int k){
+  inline fieldType & E1(int i, int j, int k){
     return val[my_indice(acc.edge, YGrid_factor, ZGrid_factor,
-      1, i, j, k,
-      N_grid[0], N_grid[1], N_grid[2], Ncomp)];
+      1, i + xOrigin, j, k,
+      NxAlloc, N_grid[1], N_grid[2], Ncomp)];
   }
-  inline double & E2(int i, int j, int k){
+  inline fieldType & E2(int i, int j, int k){
     return val[my_indice(acc.edge, YGrid_factor, ZGrid_factor,
-      2, i, j, k,
-      N_grid[0], N_grid[1], N_grid[2], Ncomp)];
+      2, i + xOrigin, j, k,
+      NxAlloc, N_grid[1], N_grid[2], Ncomp)];
   }
-  inline double & B0(int i, int j, int k){
+  inline fieldType & B0(int i, int j, int k){
     return val[my_indice(acc.edge, YGrid_factor, ZGrid_factor,
-      3, i, j, k,
-      N_grid[0], N_grid[1], N_grid[2], Ncomp)];
+      3, i + xOrigin, j, k,
+      NxAlloc, N_grid[1], N_grid[2], Ncomp)];
   }
-  inline  double & B1(int i, int j, int k){
+  inline  fieldType & B1(int i, int j, int k){
     return val[my_indice(acc.edge, YGrid_factor, ZGrid_factor,
-      4, i, j, k,
-      N_grid[0], N_grid[1], N_grid[2], Ncomp)];
+      4, i + xOrigin, j, k,
+      NxAlloc, N_grid[1], N_grid[2], Ncomp)];
   }
-  inline double & B2(int i, int j, int k){
+  inline fieldType & B2(int i, int j, int k){
     return val[my_indice(acc.edge, YGrid_factor, ZGrid_factor,
-      5, i, j, k,
-      N_grid[0], N_grid[1], N_grid[2], Ncomp)];
+      5, i + xOrigin, j, k,
+      NxAlloc, N_grid[1], N_grid[2], Ncomp)];
   }
-  inline double & VEB(int c, int i, int j, int k){
+  inline fieldType & VEB(int c, int i, int j, int k){
     return val[my_indice(acc.edge, YGrid_factor, ZGrid_factor,
-      c, i, j, k,
-      N_grid[0], N_grid[1], N_grid[2], Ncomp)];
+      c, i + xOrigin, j, k,
+      NxAlloc, N_grid[1], N_grid[2], Ncomp)];
   }
 
   //  inline double & E0(int i,int j,int k){
@@ -217,11 +225,44 @@ private:
   long int Ntot;
   int ZGrid_factor, YGrid_factor;
   ACCESSO acc;    // object distinguishing 1-2-3 D
-  double *val; //   THE BIG poiniter
+  fieldType *val; //   THE BIG poiniter
   GRID *mygrid;         // pointer to the GIRD object 
   bool allocated;  //flag 1-0 allocaded-not alloc 
 
+  // moving window: the x rows are allocated NxAlloc = N_grid[0] + xSlack long and
+  // the logical cell i is stored at i + xOrigin, so a window shift only moves xOrigin
+  static const int windowSlackFraction = 4;
+  int xOrigin, xSlack, NxAlloc;
+
   bool EBEnergyExtremesFlag;
+  int NenergyRegions;
+  double energyRegionMin[MAX_ENERGY_REGIONS][3], energyRegionMax[MAX_ENERGY_REGIONS][3];
+  int reductionOffset[3];
+  void sweepEnergyAndExtremes(double *sums, double *mins, double *maxs);
+
+  // CK stencil: forward derivative along d = alpha*(F(+d)-F) + beta[d][t]*(the same shifted by +-t)
+  // + gamma*(the same shifted along both transverse axes), coefficients already multiplied by dri[d]
+  double ckAlpha[3], ckBeta[3][3], ckGamma[3];
+  void checkFieldSolver();
+  void computeCKCoefficients();
+  void advanceBWithCK(double dtFactor);
+
+  // PSATD: E, B and den_factor*J (9 components) are transformed on a box made of the local unique points
+  // plus specGuardLeft/Right cells along the decomposed axes, copied from the neighbours every step.
+  // The box along a decomposed axis is rounded up to a 2-3-5 length, the extra cells go to the right guard.
+  // spectralOrder 0 uses the exact k, an even order the k of the staggered centered difference of that order,
+  // the default (-1) is the exact k on a single box and the order spectralGuard when an axis is decomposed
+  int spectralGuard, spectralOrder;
+  int specN[3], specGuardLeft[3], specGuardRight[3];
+  std::complex<double> *specVal;
+  std::vector<double> specK[3], specKmod[3];
+  fftPlan specFFT[3];
+  void allocateSpectralBox();
+  int spectralRightGuard(int uniquePoints);
+  void fillSpectralBox(CURRENT *current);
+  void exchangeSpectralGuards(int d);
+  void spectralTransform(int ncomp, bool inverse);
+  void advanceWithPSATD(CURRENT *current);
 
   void auxiliary_rotation(double xin, double yin, double &xp, double &yp, double xcenter, double theta);
 
@@ -229,15 +270,34 @@ private:
   static double cos2_plateau_profile(double rise, double plateau, double x);
   static double cossin_profile(double u);
 
-  int pbc_compute_alloc_size();
-  void pbcExchangeAlongX(double* send_buffer, double* recv_buffer);
-  void pbcExchangeAlongY(double* send_buffer, double* recv_buffer);
-  void pbcExchangeAlongZ(double* send_buffer, double* recv_buffer);
+  // tiled 3D Yee step: B half/E/B half are swept together as a z wavefront over blocks of y rows
+  // sized on tileCacheBytes; the ghost layers they read are computed locally after a 2-wide exchange,
+  // then the outer layers the plain step never exchanges are put back
+  long int tileCacheBytes;
+  bool canUseTiledAdvance();
+  void advanceEBTiled(CURRENT *current);
+  void copyOuterGhostLayers(std::vector<fieldType> &layers, bool restore);
+  void tiledHalfAdvanceB(int k, int j0, int j1, int i0, int i1, bool withOpenBoundaries);
+  void tiledAdvanceE(int k, int j0, int j1, int i1, CURRENT *current);
+  void openBoundariesBRow(int j, int k);
+  void openBoundariesE_2Row(int j, int k);
+  void openBoundariesBYFace(int k, bool outerOnly);
+  void openBoundariesE_2YFace(int k, bool outerOnly);
+
+  int pbc_compute_alloc_size(int Nxchng);
+  void pbcExchangeAlongX(fieldType* send_buffer, fieldType* recv_buffer, int Nxchng);
+  void pbcExchangeAlongY(fieldType* send_buffer, fieldType* recv_buffer, int Nxchng);
+  void pbcExchangeAlongZ(fieldType* send_buffer, fieldType* recv_buffer, int Nxchng);
   void pbc_EB();
+  void pbc_EB(int Nxchng);
+  void shiftWindowOrigin(int shift);
+  void resetWindowOrigin(int shift);
 
   void gaussian_pulse(int dimensions, double xx, double yy, double zz,
     double tt, double lambda, double fwhm,
     double w0, double* field, pulsePolarization polarization);
+  static void gaussian_pulse_fields(double yy, double zz, double xx, double* modes,
+    double* field, pulsePolarization polarization);
 
   void initialize_cos2_plane_wave_angle(double lambda0, double amplitude,
     double laser_pulse_initial_position,
@@ -250,6 +310,9 @@ private:
     double laser_pulse_initial_position, double t_FWHM,
     double waist, double focus_position,
     double xcenter, double angle, pulsePolarization polarization);
+  void initialize_gaussian_pulse_tabulated(double amplitude, double tt, double lambda,
+    double fwhm, double w0, double xc, double dim_factorY, double dim_factorZ,
+    pulsePolarization polarization);
 
   void filterDirSelect(int comp, int dirflags);
   void filterCompAlongX(int comp);
@@ -257,6 +320,27 @@ private:
   void filterCompAlongZ(int comp);
 
   //PRIVATE INLINE FUNCTIONS
+  inline double ckForwardDiff(int c, int d, int i, int j, int k, int s1, int s2){
+    int t1 = (d + 1) % 3, t2 = (d + 2) % 3;
+    int o[3] = { 0, 0, 0 };
+    o[t1] = s1;
+    o[t2] = s2;
+    int e[3] = { 0, 0, 0 };
+    e[d] = 1;
+    return VEB(c, i + o[0] + e[0], j + o[1] + e[1], k + o[2] + e[2]) - VEB(c, i + o[0], j + o[1], k + o[2]);
+  }
+  inline double ckDerivative(int c, int d, int i, int j, int k){
+    int t1 = (d + 1) % 3, t2 = (d + 2) % 3;
+    double res = ckAlpha[d] * ckForwardDiff(c, d, i, j, k, 0, 0);
+    if (ckBeta[d][t1] != 0)
+      res += ckBeta[d][t1] * (ckForwardDiff(c, d, i, j, k, 1, 0) + ckForwardDiff(c, d, i, j, k, -1, 0));
+    if (ckBeta[d][t2] != 0)
+      res += ckBeta[d][t2] * (ckForwardDiff(c, d, i, j, k, 0, 1) + ckForwardDiff(c, d, i, j, k, 0, -1));
+    if (ckGamma[d] != 0)
+      res += ckGamma[d] * (ckForwardDiff(c, d, i, j, k, 1, 1) + ckForwardDiff(c, d, i, j, k, -1, 1)
+      + ckForwardDiff(c, d, i, j, k, 1, -1) + ckForwardDiff(c, d, i, j, k, -1, -1));
+    return res;
+  }
   inline int my_indice(int edge, int YGrid_factor, int ZGrid_factor, int c, int i, int j, int k, int Nx, int Ny, int Nz, int Nc){
     return (c + Nc*(i + edge) + YGrid_factor*Nc*Nx*(j + edge) + ZGrid_factor*Nc*Nx*Ny*(k + edge));
   }
@@ -36,6 +36,14 @@ GRID::GRID()
   ref_den = 1.0; //= critical density
   den_factor = (2 * M_PI)*(2 * M_PI);
   dumpPath = "./";
+  courantFactor = 0;
+  fieldSolver = YEE_SOLVER;
+  totalTime = 0;
+  withActiveRegion = activeTilesKnown = false;
+  activeThreshold = 0;
+  activeTileWidth = 16;
+  activeCheckEvery = 4;
+  activeRegionVersion = 0;
   GRID::initializeStretchParameters();
   rnproc[1]=rnproc[2]=1;
 }
@@ -110,22 +118,55 @@ void GRID::setNProcsAlongZ(int nprocz){
 }
 
 void GRID::setCourantFactor(double courant_factor){
+  courantFactor = courant_factor;
+  computeTimeStep();
+}
+
+//the CK stencil is stable up to dt = min(dr), the Yee one up to 1/sqrt(sum dri^2)
+void GRID::computeTimeStep(){
+  if (courantFactor <= 0)
+    return;
   switch (accesso.dimensions){
   case 1:
-    dt = courant_factor*(1 / (sqrt(dri[0] * dri[0])));
+    dt = courantFactor*(1 / (sqrt(dri[0] * dri[0])));
     break;
   case 2:
-    dt = courant_factor*(1 / (sqrt(dri[0] * dri[0] + dri[1] * dri[1])));
+    if (fieldSolver != YEE_SOLVER)
+      dt = courantFactor / MAX(dri[0], dri[1]);
+    else
+      dt = courantFactor*(1 / (sqrt(dri[0] * dri[0] + dri[1] * dri[1])));
     break;
   case 3:
-    dt = courant_factor*(1 / (sqrt(dri[0] * dri[0] + dri[1] * dri[1] + dri[2] * dri[2])));
+    if (fieldSolver != YEE_SOLVER)
+      dt = courantFactor / MAX(dri[0], MAX(dri[1], dri[2]));
+    else
+      dt = courantFactor*(1 / (sqrt(dri[0] * dri[0] + dri[1] * dri[1] + dri[2] * dri[2])));
     break;
   default:
     printf("WRONG definition of DIMENSIONALITY\n");
     exit(17);
     break;
   }
+  if (totalTime > 0)
+    totalNumberOfTimesteps = (int)(totalTime / dt) + 2;
+}
+
+//may be called before or after setCourantFactor, dt is recomputed
+void GRID::setFieldSolver(fieldSolverType solver){
+  fieldSolver = solver;
+  computeTimeStep();
+}
+
+fieldSolverType GRID::getFieldSolver(){
+  return fieldSolver;
+}
+
+//ghost points needed on each side by the curl stencils (the CK transverse smoothing uses the first ghost too,
+//PSATD exchanges its own guard cells)
+int GRID::getFieldSolverHalo(){
+  return 1;
 }
+
 void GRID::setSimulationTime(double tot_time){
   totalTime = tot_time;
   totalNumberOfTimesteps = (int)(tot_time / dt) + 2;
@@ -164,6 +205,114 @@ void GRID::setFrequencyMovingWindow(int frequency_mw){
   frequency_mw_shifts = frequency_mw;
 }
 
+bool GRID::isWithMovingWindow(){
+  return withMovingWindow;
+}
+
+void GRID::enableActiveRegion(double threshold){
+  if (threshold < 0){
+    printf("ERROR: enableActiveRegion needs a non negative threshold\n");
+    exit(17);
+  }
+  withActiveRegion = true;
+  activeTilesKnown = false;
+  activeThreshold = threshold;
+}
+
+void GRID::setActiveRegionTiles(int tileWidth, int checkEvery){
+  if (checkEvery < 1 || tileWidth < (2 * checkEvery + accesso.edge + 1)){
+    printf("ERROR: setActiveRegionTiles needs tileWidth >= 2*checkEvery + %i\n", accesso.edge + 1);
+    exit(17);
+  }
+  activeTileWidth = tileWidth;
+  activeCheckEvery = checkEvery;
+  activeTilesKnown = false;
+}
+
+bool GRID::isWithActiveRegion(){
+  return withActiveRegion;
+}
+
+double GRID::getActiveRegionThreshold(){
+  return activeThreshold;
+}
+
+//the tiles are refreshed every activeCheckEvery steps and right after a window shift
+bool GRID::shouldICheckActiveRegion(){
+  if (!withActiveRegion)
+    return false;
+  return (!activeTilesKnown || shouldIMove || !(istep % activeCheckEvery));
+}
+
+int GRID::getNActiveTiles(){
+  return (NGridNodes[0] + activeTileWidth - 1) / activeTileWidth;
+}
+
+//global tile of the local x index i, ghost points included
+int GRID::getActiveTileOf(int i){
+  int g = rproc_imin[0][rmyid[0]] + i;
+  if (xBoundaryConditions == _PBC)
+    g = ((g % uniquePoints[0]) + uniquePoints[0]) % uniquePoints[0];
+  else
+    g = (g < 0) ? 0 : ((g > NGridNodes[0] - 1) ? NGridNodes[0] - 1 : g);
+  return g / activeTileWidth;
+}
+
+//activity must be the same on every task: the tiles next to the active ones are added here
+//and the local runs are rebuilt from -edge to Nloc+edge
+void GRID::setActiveTiles(std::vector<int> &activity){
+  int Ntiles = getNActiveTiles();
+  int Nused = (xBoundaryConditions == _PBC) ? ((uniquePoints[0] - 1) / activeTileWidth + 1) : Ntiles;
+  std::vector<int> active(Ntiles, 0);
+  for (int t = 0; t < Nused; t++){
+    int left = (t > 0) ? t - 1 : ((xBoundaryConditions == _PBC) ? Nused - 1 : t);
+    int right = (t < Nused - 1) ? t + 1 : ((xBoundaryConditions == _PBC) ? 0 : t);
+    active[t] = (activity[left] || activity[t] || activity[right]);
+  }
+
+  std::vector<int> runBegin, runEnd;
+  int edge = accesso.edge;
+  for (int i = -edge; i < Nloc[0] + edge; i++){
+    if (!active[getActiveTileOf(i)])
+      continue;
+    if (runEnd.size() && runEnd.back() == i)
+      runEnd.back() = i + 1;
+    else{
+      runBegin.push_back(i);
+      runEnd.push_back(i + 1);
+    }
+  }
+  if (!activeTilesKnown || runBegin != activeRunBegin || runEnd != activeRunEnd)
+    activeRegionVersion++;
+  activeRunBegin = runBegin;
+  activeRunEnd = runEnd;
+  activeTilesKnown = true;
+}
+
+//local x runs to sweep, clipped to [lo,hi); everything is a single run until the first setActiveTiles
+int GRID::getActiveRuns(int lo, int hi, std::vector<int> &i0, std::vector<int> &i1){
+  i0.clear();
+  i1.clear();
+  if (!withActiveRegion || !activeTilesKnown){
+    i0.push_back(lo);
+    i1.push_back(hi);
+    return 1;
+  }
+  for (size_t r = 0; r < activeRunBegin.size(); r++){
+    int begin = (activeRunBegin[r] > lo) ? activeRunBegin[r] : lo;
+    int end = (activeRunEnd[r] < hi) ? activeRunEnd[r] : hi;
+    if (end > begin){
+      i0.push_back(begin);
+      i1.push_back(end);
+    }
+  }
+  return (int)i0.size();
+}
+
+int GRID::getActiveRegionVersion(){
+  return activeRegionVersion;
+}
+
 int GRID::getTotalNumberOfTimesteps(){
   return totalNumberOfTimesteps;
 }
@@ -337,6 +486,7 @@ void GRID::visualDiag(){
     GRID::printGridProcessorInformation();
     printf("+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++\n");
     printf("dt=%f\n", dt);
+    printf("field solver: %s\n", (fieldSolver == CK_SOLVER) ? "CK" : ((fieldSolver == PSATD_SOLVER) ? "PSATD" : "Yee"));
     printf("dx=%f\n", dr[0]);
     printf("dy=%f\n", dr[1]);
     printf("dz=%f\n", dr[2]);
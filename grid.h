@@ -28,6 +28,7 @@ along with piccante.  If not, see <http://www.gnu.org/licenses/>.
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <vector>
 #include <cmath>
 #include <iomanip>
 //#include <malloc.h>
@@ -55,6 +56,15 @@ enum axisBoundaryConditions{
   _PML
 };
 
+// YEE_SOLVER: standard Yee scheme
+// CK_SOLVER: Cole-Karkkainen extended stencil for curl E, dispersion-free along the axes at dt = min(dr)
+// PSATD_SOLVER: pseudo-spectral analytical time domain, E and B advanced together in Fourier space
+enum fieldSolverType{
+  YEE_SOLVER,
+  CK_SOLVER,
+  PSATD_SOLVER
+};
+
 enum boundaryConditions{
   xPBC = 1 << 0,
   yPBC = 1 << 1,
@@ -108,11 +118,30 @@ public:
   void setNProcsAlongY(int nproc);
   void setNProcsAlongZ(int nproc);
   void setCourantFactor(double courant_factor);
+  void setFieldSolver(fieldSolverType solver);
+  fieldSolverType getFieldSolver();
+  int getFieldSolverHalo();
   void setSimulationTime(double tot_time);
   void setMovingWindow(double start, double beta, int frequency_mw);
   void setStartMovingWindow(double start);
   void setBetaMovingWindow(double beta);
   void setFrequencyMovingWindow(int frequency_mw);
+  bool isWithMovingWindow();
+  // active region: the global x axis is cut into tiles of activeTileWidth cells; a tile is active
+  // when it holds fields above the threshold or particles, or is next to such a tile. The field
+  // advance and the current zeroing/exchange only sweep the local x runs of active tiles.
+  // Fields spread up to 2 cells per step on the Yee stencil and particles deposit edge cells
+  // around them, so checkEvery steps must fit in a tile (current filters widen the spread)
+  void enableActiveRegion(double threshold);
+  void setActiveRegionTiles(int tileWidth, int checkEvery);
+  bool isWithActiveRegion();
+  double getActiveRegionThreshold();
+  bool shouldICheckActiveRegion();
+  int getNActiveTiles();
+  int getActiveTileOf(int i);
+  void setActiveTiles(std::vector<int> &activity);
+  int getActiveRuns(int lo, int hi, std::vector<int> &i0, std::vector<int> &i1);
+  int getActiveRegionVersion();
   void setMasterProc(int idMasterProc);
   int getTotalNumberOfTimesteps();
   void move_window();
@@ -176,6 +205,13 @@ private:
 
   double totalTime;
   bool withMovingWindow;
+  double courantFactor;
+  fieldSolverType fieldSolver;
+  void computeTimeStep();
+  bool withActiveRegion, activeTilesKnown;
+  double activeThreshold;
+  int activeTileWidth, activeCheckEvery, activeRegionVersion;
+  std::vector<int> activeRunBegin, activeRunEnd;
   // =========== STRETCHED GRID ========
   bool flagLeftStretchedAlong[3], flagRightStretchedAlong[3];
   bool flagStretchedAlong[3], flagStretched;
@@ -61,6 +61,7 @@ along with piccante.  If not, see <http://www.gnu.org/licenses/>.
 #define DIRECTORY_DUMP "DUMP"
 #define RANDOM_NUMBER_GENERATOR_SEED 5489
 #define FREQUENCY_STDOUT_STATUS 5
+#define TILED_FIELD_STEP false
 
 #define _FACT 0.333333
 
@@ -106,8 +107,12 @@ int main(int narg, char **args)
   //grid.setBetaMovingWindow(1.0);
   //grid.setFrequencyMovingWindow(20);
 
+  //grid.enableActiveRegion(0.0);
+
   grid.setMasterProc(0);
 
+  //bigArrays::setHugePages(HUGE_PAGES_TRANSPARENT);
+
   srand(time(NULL));
   grid.initRNG(rng, RANDOM_NUMBER_GENERATOR_SEED);
 
@@ -120,6 +125,7 @@ int main(int narg, char **args)
   //*******************************************BEGIN FIELD DEFINITION*********************************************************
   myfield.allocate(&grid);
   myfield.setAllValuesToZero();
+  //myfield.setTileCacheSize(1048576);
 
   laserPulse pulse1;
   pulse1.setCos2PlaneWave();
@@ -181,6 +187,7 @@ int main(int narg, char **args)
   for (spec_iterator = species.begin(); spec_iterator != species.end(); spec_iterator++){
     (*spec_iterator)->printParticleNumber();
   }
+  //bigArrays::printMemoryReport(MPI_COMM_WORLD, grid.master_proc);
 
   //*******************************************END SPECIED DEFINITION***********************************************************
 
@@ -192,6 +199,9 @@ int main(int narg, char **args)
   domain1->setPointCoordinate(0, 0, 0);
   domain1->setFreeDimensions(1, 1, 1);
   domain1->setName("SUBD");
+  //domain1->setStride(4, 4, 1);
+  //domain1->setBlockAverage(4, 4, 1);
+  //domain1->setCompression(COMPRESSION_QUANTIZED, 1e-4);
   domain1->setXRange(-10, 6);
   domain1->setYRange(-5, 5);
 
@@ -200,6 +210,22 @@ int main(int narg, char **args)
   manager.addSpeciesDensityFrom(ions1.name, 0.0, 5.0);
   manager.addCurrentFrom(0.0, 5.0);
   manager.addDiagFrom(0.0, 0.5);
+  //manager.addSpeciesTrackingFrom(domain1, electrons1.name, 1000, 0.0, 0.5); // needs electrons1.addMarker()
+  //outHistogram *xpx = new outHistogram;
+  //xpx->addAxis(HIST_X, 200, -10, 6);
+  //xpx->addAxis(HIST_PX, 200, -1, 1);
+  //manager.addSpeciesHistogramFrom(domain1, xpx, electrons1.name, 0.0, 0.5);
+  //outAccumulator *fluence = new outAccumulator;
+  //fluence->setQuantity(ACC_E2);
+  //manager.addFieldAccumulatorFrom(domain1, fluence, 0.0, 4, 5.0);
+  //manager.setAsyncOutput(256 * 1024 * 1024);
+  //manager.setSubfiling(64);
+  //domain1->setStreaming(true);
+  //manager.setStreaming("/tmp/piccante.sock", 64 * 1024 * 1024); // consumer: tools/stream_consumer
+  //manager.setHDF5Output(4); // needs USE_HDF5 (make hdf5)
+  //manager.setIOHint("romio_cb_write", "enable");
+  //manager.setIOHint("cb_nodes", "8");
+  //manager.setIOHint("striping_factor", "16");
 
   manager.initialize(DIRECTORY_OUTPUT);
   //*******************************************END DIAGNOSTICS DEFINITION**************************************************
@@ -237,9 +263,13 @@ int main(int narg, char **args)
 
     manager.callDiags(grid.istep);  /// deve tornare all'inizo del ciclo
 
-    myfield.openBoundariesE_1();
-    myfield.new_halfadvance_B();
-    myfield.boundary_conditions();
+    updateActiveRegion(&grid, &myfield, species);
+
+    if (!TILED_FIELD_STEP){
+      myfield.openBoundariesE_1();
+      myfield.new_halfadvance_B();
+      myfield.boundary_conditions();
+    }
 
     current.setAllValuesToZero();
     for (spec_iterator = species.begin(); spec_iterator != species.end(); spec_iterator++){
@@ -256,13 +286,18 @@ int main(int narg, char **args)
       (*spec_iterator)->position_parallel_pbc();
     }
 
-    myfield.openBoundariesB();
-    myfield.new_advance_E(&current);
-
-    myfield.boundary_conditions();
-    myfield.openBoundariesE_2();
-    myfield.new_halfadvance_B();
-    myfield.boundary_conditions();
+    if (TILED_FIELD_STEP){
+      myfield.new_advance_EB_tiled(&current);
+    }
+    else{
+      myfield.openBoundariesB();
+      myfield.new_advance_E(&current);
+
+      myfield.boundary_conditions();
+      myfield.openBoundariesE_2();
+      myfield.new_halfadvance_B();
+      myfield.boundary_conditions();
+    }
 
     for (spec_iterator = species.begin(); spec_iterator != species.end(); spec_iterator++){
 #ifdef RADIATION_FRICTION            
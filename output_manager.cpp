@@ -18,6 +18,14 @@ along with piccante.  If not, see <http://www.gnu.org/licenses/>.
 *******************************************************************************/
 
 #include "output_manager.h"
+#if !defined(_MSC_VER)
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
 
 int is_big_endian()
 {
@@ -58,6 +66,24 @@ outDomain::outDomain(){
   subselection = false;
   overrideFlag = false;
   followMovingWindowFlag = false;
+  decimation[0] = decimation[1] = decimation[2] = 1;
+  decimationAverage = false;
+  compression = COMPRESSION_NONE;
+  compressionTolerance = 0;
+  chunkSize[0] = chunkSize[1] = chunkSize[2] = 32;
+  gammaRange[0] = 0;
+  gammaRange[1] = 1e300;
+  coneFlag = false;
+  coneAxis[0] = 1;
+  coneAxis[1] = coneAxis[2] = 0;
+  coneCosAngle = -1;
+  markerFlag = false;
+  markerRange[0] = markerRange[1] = 0;
+  particleStride = 1;
+  sampleFraction = 1;
+  sampleSeed = 0;
+  phaseSpaceComponents = PS_ALL;
+  streamFlag = streamFiles = false;
   rmin[0] = rmin[1] = rmin[2] = -1e10;
   rmax[0] = rmax[1] = rmax[2] = +1e10;
 
@@ -67,6 +93,107 @@ void outDomain::followMovingWindow(){
   followMovingWindowFlag = true;
 }
 
+//only one point every sx (sy, sz) is written
+void outDomain::setStride(int sx, int sy, int sz){
+  if (sx < 1 || sy < 1 || sz < 1){
+    printf("ERROR: the output stride must be at least 1\n");
+    exit(17);
+  }
+  decimation[0] = sx;
+  decimation[1] = sy;
+  decimation[2] = sz;
+  decimationAverage = false;
+}
+
+//each written point is the average of a block of fx*fy*fz grid points
+void outDomain::setBlockAverage(int fx, int fy, int fz){
+  setStride(fx, fy, fz);
+  decimationAverage = true;
+}
+
+//quantized compression keeps every value within tolerance (absolute) of the original
+void outDomain::setCompression(outputCompression type, double tolerance){
+  if (type == COMPRESSION_QUANTIZED && !(tolerance > 0)){
+    printf("ERROR: quantized compression needs a positive tolerance\n");
+    exit(17);
+  }
+  compression = type;
+  compressionTolerance = (type == COMPRESSION_QUANTIZED) ? tolerance : 0;
+}
+
+void outDomain::setChunkSize(int cx, int cy, int cz){
+  if (cx < 1 || cy < 1 || cz < 1){
+    printf("ERROR: the chunk size must be at least 1\n");
+    exit(17);
+  }
+  chunkSize[0] = cx;
+  chunkSize[1] = cy;
+  chunkSize[2] = cz;
+}
+
+//phase space outputs of this domain only contain the particles with gamma in [min, max)
+void outDomain::setGammaRange(double min, double max){
+  gammaRange[0] = min;
+  gammaRange[1] = max;
+}
+
+//particles whose momentum is within halfAngle (radians) from (ux, uy, uz)
+void outDomain::setMomentumCone(double ux, double uy, double uz, double halfAngle){
+  double norm = sqrt(ux*ux + uy*uy + uz*uz);
+  if (norm == 0){
+    printf("ERROR: the momentum cone needs a non zero axis\n");
+    exit(17);
+  }
+  coneFlag = true;
+  coneAxis[0] = ux / norm;
+  coneAxis[1] = uy / norm;
+  coneAxis[2] = uz / norm;
+  coneCosAngle = cos(halfAngle);
+}
+
+//particles with marker in [min, max] (species with markers only)
+void outDomain::setMarkerRange(long int min, long int max){
+  markerFlag = true;
+  markerRange[0] = min;
+  markerRange[1] = max;
+}
+
+//one selected particle every stride is written, with its weight multiplied by stride
+void outDomain::setParticleStride(int stride){
+  if (stride < 1){
+    printf("ERROR: the particle stride must be at least 1\n");
+    exit(17);
+  }
+  particleStride = stride;
+}
+
+//each selected particle is written with probability fraction (weight divided by fraction);
+//the choice only depends on seed and on the marker (or on time, task and particle index)
+void outDomain::setRandomSubsampling(double fraction, int seed){
+  if (!(fraction > 0 && fraction <= 1)){
+    printf("ERROR: the subsampling fraction must be in (0, 1]\n");
+    exit(17);
+  }
+  sampleFraction = fraction;
+  sampleSeed = seed;
+}
+
+//components written in the phase space outputs, e.g. PS_X | PS_PX | PS_W
+void outDomain::setPhaseSpaceComponents(int components){
+  if (!(components & PS_ALL)){
+    printf("ERROR: no phase space component selected\n");
+    exit(17);
+  }
+  phaseSpaceComponents = components & PS_ALL;
+}
+
+//the outputs of this domain are sent to the consumer set with OUTPUT_MANAGER::setStreaming,
+//and also written to file if withFiles
+void outDomain::setStreaming(bool withFiles){
+  streamFlag = true;
+  streamFiles = withFiles;
+}
+
 bool outDomain::compareDomains(outDomain *rhs){
   if (coordinates[0] == rhs->coordinates[0] &&
     coordinates[1] == rhs->coordinates[1] &&
@@ -77,6 +204,31 @@ bool outDomain::compareDomains(outDomain *rhs){
     name.c_str() == rhs->name.c_str() &&
     subselection == rhs->subselection&&
     followMovingWindowFlag == rhs->followMovingWindowFlag&&
+    decimation[0] == rhs->decimation[0] &&
+    decimation[1] == rhs->decimation[1] &&
+    decimation[2] == rhs->decimation[2] &&
+    decimationAverage == rhs->decimationAverage&&
+    compression == rhs->compression&&
+    compressionTolerance == rhs->compressionTolerance&&
+    chunkSize[0] == rhs->chunkSize[0] &&
+    chunkSize[1] == rhs->chunkSize[1] &&
+    chunkSize[2] == rhs->chunkSize[2] &&
+    gammaRange[0] == rhs->gammaRange[0] &&
+    gammaRange[1] == rhs->gammaRange[1] &&
+    coneFlag == rhs->coneFlag &&
+    coneAxis[0] == rhs->coneAxis[0] &&
+    coneAxis[1] == rhs->coneAxis[1] &&
+    coneAxis[2] == rhs->coneAxis[2] &&
+    coneCosAngle == rhs->coneCosAngle &&
+    markerFlag == rhs->markerFlag &&
+    markerRange[0] == rhs->markerRange[0] &&
+    markerRange[1] == rhs->markerRange[1] &&
+    particleStride == rhs->particleStride &&
+    sampleFraction == rhs->sampleFraction &&
+    sampleSeed == rhs->sampleSeed &&
+    phaseSpaceComponents == rhs->phaseSpaceComponents &&
+    streamFlag == rhs->streamFlag &&
+    streamFiles == rhs->streamFiles &&
     overrideFlag == rhs->overrideFlag){
     if (!subselection)
       return true;
@@ -122,6 +274,69 @@ void outDomain::setZRange(double min, double max){
   rmax[2] = max;
 }
 
+outHistogram::outHistogram(){
+  nAxes = 0;
+  for (int a = 0; a < 3; a++){
+    quantity[a] = HIST_X;
+    nbins[a] = 1;
+    range[a][0] = 0;
+    range[a][1] = 1;
+  }
+  weighted = true;
+  name = "";
+}
+
+//up to three axes, n equal bins in [min, max): particles outside the range of any axis are skipped
+void outHistogram::addAxis(histogramQuantity q, int n, double min, double max){
+  if (nAxes >= 3){
+    printf("ERROR: a histogram has at most 3 axes\n");
+    exit(17);
+  }
+  if (n < 1 || !(max > min)){
+    printf("ERROR: a histogram axis needs at least one bin and max > min\n");
+    exit(17);
+  }
+  quantity[nAxes] = q;
+  nbins[nAxes] = n;
+  range[nAxes][0] = min;
+  range[nAxes][1] = max;
+  nAxes++;
+}
+
+//weighted: each particle adds its weight (as written in the phase space), otherwise 1
+void outHistogram::setWeighted(bool flag){
+  weighted = flag;
+}
+
+void outHistogram::setName(std::string iname){
+  name = iname;
+}
+
+outAccumulator::outAccumulator(){
+  quantity = ACC_E2;
+  species = "";
+  average = false;
+  name = "E2";
+}
+
+void outAccumulator::setQuantity(accumulatorQuantity q){
+  quantity = q;
+}
+
+void outAccumulator::setSpeciesDensity(std::string specName){
+  quantity = ACC_SPEC_DENSITY;
+  species = specName;
+}
+
+//average: the sum is divided by the number of samples, otherwise it is multiplied by the time between samples
+void outAccumulator::setAverage(bool flag){
+  average = flag;
+}
+
+void outAccumulator::setName(std::string iname){
+  name = iname;
+}
+
 bool requestCompTime(const request &first, const request &second){
   if (first.itime != second.itime)
     return (first.itime < second.itime);
@@ -143,6 +358,210 @@ bool requestCompUnique(const request &first, const request &second){
     (first.domain == second.domain));
 }
 
+//chunk payload: int codec (LOSSLESS or QUANTIZED), int lz (1 if LZ coded), then the stream.
+//The stream holds one 32 bit word per value, component by component: the float itself or the
+//zigzag delta of the quantized values, with the bytes shuffled in 4 planes before LZ coding.
+static void lzPutLength(std::vector<char> &out, int len){
+  for (; len >= 255; len -= 255)
+    out.push_back((char)255);
+  out.push_back((char)len);
+}
+
+static int lzGetLength(const unsigned char *in, int64_t *ip, int64_t bytes){
+  int len = 0;
+  while (*ip < bytes){
+    int b = in[(*ip)++];
+    len += b;
+    if (b != 255)
+      break;
+  }
+  return len;
+}
+
+//token: 4 bits of literal count, 4 bits of match length - 4; then literals, 2 bytes offset
+static void lzPutSequence(std::vector<char> &out, const unsigned char *lit, int nLit, int offset, int len){
+  int litCode = (nLit < 15) ? nLit : 15;
+  int matchCode = 0;
+  if (len)
+    matchCode = (len - 4 < 15) ? (len - 4) : 15;
+  out.push_back((char)((litCode << 4) | matchCode));
+  if (litCode == 15)
+    lzPutLength(out, nLit - 15);
+  out.insert(out.end(), lit, lit + nLit);
+  if (!len)
+    return;
+  out.push_back((char)(offset & 255));
+  out.push_back((char)(offset >> 8));
+  if (matchCode == 15)
+    lzPutLength(out, len - 19);
+}
+
+static void lzCompress(std::vector<char> &out, const unsigned char *in, int n){
+  const int hashBits = 14;
+  std::vector<int> table(1 << hashBits, -1);
+  int anchor = 0, ip = 0;
+  while (ip + 4 <= n){
+    uint32_t seq;
+    memcpy(&seq, in + ip, 4);
+    int h = (int)((seq * 2654435761u) >> (32 - hashBits));
+    int ref = table[h];
+    table[h] = ip;
+    if (ref < 0 || ip - ref > 65535 || memcmp(in + ref, in + ip, 4)){
+      ip++;
+      continue;
+    }
+    int len = 4;
+    while (ip + len < n && in[ref + len] == in[ip + len])
+      len++;
+    lzPutSequence(out, in + anchor, ip - anchor, ip - ref, len);
+    ip += len;
+    anchor = ip;
+  }
+  lzPutSequence(out, in + anchor, n - anchor, 0, 0);
+}
+
+static bool lzDecompress(unsigned char *out, int n, const unsigned char *in, int64_t bytes){
+  int64_t ip = 0;
+  int op = 0;
+  while (ip < bytes){
+    int token = in[ip++];
+    int nLit = token >> 4;
+    if (nLit == 15)
+      nLit += lzGetLength(in, &ip, bytes);
+    if (op + nLit > n || ip + nLit > bytes)
+      return false;
+    memcpy(out + op, in + ip, nLit);
+    op += nLit;
+    ip += nLit;
+    if (ip >= bytes)
+      break;
+    if (ip + 2 > bytes)
+      return false;
+    int offset = in[ip] | (in[ip + 1] << 8);
+    ip += 2;
+    int len = (token & 15) + 4;
+    if ((token & 15) == 15)
+      len += lzGetLength(in, &ip, bytes);
+    if (offset == 0 || offset > op || op + len > n)
+      return false;
+    for (int m = 0; m < len; m++, op++)
+      out[op] = out[op - offset];
+  }
+  return op == n;
+}
+
+//the step is 1/256 below 2*tolerance: the margin absorbs the float rounding of the decoded value
+//as long as |v| < 65536*tolerance, so that half-step values stay within tolerance
+static inline double quantizationStep(double tolerance){
+  return 2 * tolerance * (1 - 1.0 / 256);
+}
+
+//the decoded value of a quantized word, shared by the encoder check and the decoder
+static inline float dequantize(int64_t iq, double step){
+  return (float)(iq*step);
+}
+
+//values are laid out as in the .bin files: c + Ncomp*(i + n[0]*(j + n[1]*k))
+//a quantized chunk is kept only if every value decodes within tolerance, otherwise it is stored lossless
+void compressFieldChunk(std::vector<char> &out, float *values, int n[3], int Ncomp, outputCompression codec, double tolerance){
+  int nPoints = n[0] * n[1] * n[2];
+  int nValues = Ncomp*nPoints;
+  std::vector<uint32_t> words(nValues);
+  int head[2] = { COMPRESSION_LOSSLESS, 0 };
+
+  if (codec == COMPRESSION_QUANTIZED){
+    double step = quantizationStep(tolerance);
+    int64_t previous = 0;
+    bool fits = true;
+    for (int c = 0; c < Ncomp && fits; c++){
+      for (int p = 0; p < nPoints; p++){
+        double q = values[c + Ncomp*p] / step;
+        //non finite values, or beyond the float precision: the chunk is stored lossless
+        if (!(fabs(q) < (double)(1 << 24))){
+          fits = false;
+          break;
+        }
+        int64_t iq = (int64_t)floor(q + 0.5);
+        //the float rounding can still exceed the margin above 65536*tolerance, where a float ulp
+        //is more than 1/256 of the tolerance
+        if (fabs((double)dequantize(iq, step) - values[c + Ncomp*p]) > tolerance){
+          fits = false;
+          break;
+        }
+        int32_t d = (int32_t)(iq - previous);
+        previous = iq;
+        words[c*nPoints + p] = ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+      }
+    }
+    if (fits)
+      head[0] = COMPRESSION_QUANTIZED;
+  }
+  if (head[0] == COMPRESSION_LOSSLESS){
+    for (int c = 0; c < Ncomp; c++)
+      for (int p = 0; p < nPoints; p++)
+        memcpy(&words[c*nPoints + p], &values[c + Ncomp*p], 4);
+  }
+
+  std::vector<unsigned char> shuffled(4 * (size_t)nValues);
+  for (int v = 0; v < nValues; v++)
+    for (int b = 0; b < 4; b++)
+      shuffled[b*nValues + v] = (unsigned char)(words[v] >> (8 * b));
+
+  std::vector<char> packed;
+  if (nValues)
+    lzCompress(packed, &shuffled[0], 4 * nValues);
+  head[1] = (nValues && packed.size() < shuffled.size()) ? 1 : 0;
+  out.resize(sizeof(head));
+  memcpy(&out[0], head, sizeof(head));
+  if (head[1])
+    out.insert(out.end(), packed.begin(), packed.end());
+  else
+    out.insert(out.end(), shuffled.begin(), shuffled.end());
+}
+
+//tolerance is the one written in the file header; false if the payload is corrupted
+bool decompressFieldChunk(float *values, int n[3], int Ncomp, const char *in, int64_t bytes, double tolerance){
+  int nPoints = n[0] * n[1] * n[2];
+  int nValues = Ncomp*nPoints;
+  int head[2];
+  if (bytes < (int64_t)sizeof(head))
+    return false;
+  memcpy(head, in, sizeof(head));
+  const unsigned char *stream = (const unsigned char*)in + sizeof(head);
+  int64_t streamBytes = bytes - sizeof(head);
+
+  std::vector<unsigned char> shuffled(4 * (size_t)nValues);
+  if (head[1]){
+    if (!lzDecompress(nValues ? &shuffled[0] : NULL, 4 * nValues, stream, streamBytes))
+      return false;
+  }
+  else{
+    if (streamBytes != 4 * (int64_t)nValues)
+      return false;
+    if (nValues)
+      memcpy(&shuffled[0], stream, 4 * (size_t)nValues);
+  }
+
+  double step = quantizationStep(tolerance);
+  int64_t previous = 0;
+  for (int c = 0; c < Ncomp; c++){
+    for (int p = 0; p < nPoints; p++){
+      int v = c*nPoints + p;
+      uint32_t word = 0;
+      for (int b = 0; b < 4; b++)
+        word |= (uint32_t)shuffled[b*nValues + v] << (8 * b);
+      if (head[0] == COMPRESSION_QUANTIZED){
+        int32_t d = (int32_t)(word >> 1) ^ -(int32_t)(word & 1);
+        previous += d;
+        values[c + Ncomp*p] = dequantize(previous, step);
+      }
+      else
+        memcpy(&values[c + Ncomp*p], &word, 4);
+    }
+  }
+  return true;
+}
+
 
 OUTPUT_MANAGER::OUTPUT_MANAGER(GRID* _mygrid, EM_FIELD* _myfield, CURRENT* _mycurrent, std::vector<SPECIE*> _myspecies){
   mygrid = _mygrid;
@@ -160,6 +579,25 @@ OUTPUT_MANAGER::OUTPUT_MANAGER(GRID* _mygrid, EM_FIELD* _myfield, CURRENT* _mycu
   amIInit = false;
 
   isThereDiag = false;
+  isThereEMProbe = false;
+
+  probeFlushSteps = probeBufferedSteps = 0;
+  probeGather = false;
+
+  asyncOutput = false;
+  asyncBudget = stagedBytes = 0;
+  subfileNumber = 0;
+  streamBudget = streamQueuedBytes = 0;
+  streamDropped = streamCoalesced = 0;
+  streamSocket = -1;
+  streamSent = 0;
+  hdf5Output = false;
+  hdf5Deflate = 0;
+#if defined(USE_HDF5)
+  hdf5File = -1;
+#endif
+
+  ioInfo = MPI_INFO_NULL;
 
   outDomain *domain1 = new outDomain;
   domain1->overrideFlag = true;
@@ -169,6 +607,17 @@ OUTPUT_MANAGER::OUTPUT_MANAGER(GRID* _mygrid, EM_FIELD* _myfield, CURRENT* _mycu
 OUTPUT_MANAGER::~OUTPUT_MANAGER(){
   for (std::vector<outDomain*>::iterator it = myDomains.begin(); it != myDomains.end(); ++it)
     delete(*it);
+  int finalized;
+  MPI_Finalized(&finalized);
+  if (ioInfo != MPI_INFO_NULL && !finalized)
+    MPI_Info_free(&ioInfo);
+  for (std::map<std::pair<int, int>, outputPlan>::iterator it = outputPlans.begin(); it != outputPlans.end(); it++){
+    if (!finalized){
+      MPI_Comm_free(&it->second.outputCommunicator);
+      if (it->second.aggregationCommunicator != MPI_COMM_NULL)
+        MPI_Comm_free(&it->second.aggregationCommunicator);
+    }
+  }
 }
 
 void OUTPUT_MANAGER::createDiagFile(){
@@ -249,6 +698,12 @@ void OUTPUT_MANAGER::createEMProbeFiles(){
       return;
   }
 
+  if (probeFlushSteps){
+    if (probeGather)
+      openProbeFile(outputDir + "/EMProbes.bin");
+    return;
+  }
+
   if (checkEMField()){
     for (std::vector<emProbe*>::iterator it = myEMProbes.begin(); it != myEMProbes.end(); it++){
       std::ofstream of0;
@@ -285,7 +740,20 @@ void OUTPUT_MANAGER::initialize(std::string _outputDir){
   }
 #endif
   outputDir = _outputDir;
-  prepareOutputMap();
+  if (hdf5Output){
+    if (subfileNumber){
+      printf("ERROR: subfiling and HDF5 output cannot be used together\n");
+      exit(17);
+    }
+    for (std::vector<outDomain*>::iterator it = myDomains.begin(); it != myDomains.end(); it++){
+      if ((*it)->streamFlag){
+        printf("ERROR: streamed domains need the binary output, not HDF5\n");
+        exit(17);
+      }
+    }
+  }
+  prepareOutputSchedule();
+  allocateDensityScratch();
 
   if (!checkGrid()){
     return;
@@ -298,12 +766,407 @@ void OUTPUT_MANAGER::initialize(std::string _outputDir){
   if (isThereEMProbe){
     createEMProbeFiles();
   }
+  prepareOutputPlans();
 
   amIInit = true;
 }
 
+//the hints are merged to those already set with setIOHint
+void OUTPUT_MANAGER::initialize(std::string _outputDir, MPI_Info hints){
+  if (hints != MPI_INFO_NULL){
+    int nkeys, flag;
+    char key[MPI_MAX_INFO_KEY + 1], value[MPI_MAX_INFO_VAL + 1];
+    MPI_Info_get_nkeys(hints, &nkeys);
+    for (int n = 0; n < nkeys; n++){
+      MPI_Info_get_nthkey(hints, n, key);
+      MPI_Info_get(hints, key, MPI_MAX_INFO_VAL, value, &flag);
+      if (flag)
+        setIOHint(key, value);
+    }
+  }
+  initialize(_outputDir);
+}
+
+void OUTPUT_MANAGER::setIOHint(std::string key, std::string value){
+  if (ioInfo == MPI_INFO_NULL)
+    MPI_Info_create(&ioInfo);
+  MPI_Info_set(ioInfo, (char*)key.c_str(), (char*)value.c_str());
+}
+
 void OUTPUT_MANAGER::close(){
+  flushProbeBuffer();
+  if (probeFile.is_open())
+    probeFile.close();
+  completePendingOutput();
+  if (streamPath.size())
+    finishStream();
+#if defined(USE_HDF5)
+  closeHDF5File();
+#endif
+}
+
+//to be called before initialize; the buffers are flushed every "steps" probe outputs and in close()
+void OUTPUT_MANAGER::setProbeBuffer(int steps, bool gatherToOneFile){
+  if (steps < 1){
+    printf("ERROR: setProbeBuffer needs at least one step\n");
+    exit(17);
+  }
+  probeFlushSteps = steps;
+  probeGather = gatherToOneFile;
+}
+
+//the writes are staged in copies of the buffers and started with MPI_File_iwrite; the files are closed
+//(collectively) at the next output step, which every task reaches in the same order
+void OUTPUT_MANAGER::setAsyncOutput(long int bufferBytes){
+  if (bufferBytes <= 0){
+    printf("ERROR: setAsyncOutput needs a positive buffer size in bytes\n");
+    exit(17);
+  }
+  asyncOutput = true;
+  asyncBudget = bufferBytes;
+}
+
+stagedWrite* OUTPUT_MANAGER::stageOutputBuffer(void *buf, int count, MPI_Datatype datatype){
+  int typeSize;
+  MPI_Type_size(datatype, &typeSize);
+  stagedWrite staged;
+  staged.bytes = (long int)count*typeSize;
+  // back-pressure: the oldest writes are completed until the new one fits in the budget
+  while (stagedWrites.size() && (stagedBytes + staged.bytes) > asyncBudget)
+    completeOldestWrite();
+  staged.buffer = malloc(staged.bytes > 0 ? staged.bytes : 1);
+  memcpy(staged.buffer, buf, staged.bytes);
+  stagedWrites.push_back(staged);
+  stagedBytes += staged.bytes;
+  return &stagedWrites.back();
+}
+
+void OUTPUT_MANAGER::outputWrite(MPI_File thefile, void *buf, int count, MPI_Datatype datatype){
+  if (!asyncOutput){
+    MPI_Status status;
+    MPI_File_write(thefile, buf, count, datatype, &status);
+    return;
+  }
+  stagedWrite *staged = stageOutputBuffer(buf, count, datatype);
+  MPI_File_iwrite(thefile, staged->buffer, count, datatype, &staged->request);
+}
+
+//collective write at an explicit byte offset (default file view): every task that opened
+//the file must call it the same number of times, with count = 0 if it has nothing to write
+void OUTPUT_MANAGER::outputWriteAtAll(MPI_File thefile, MPI_Offset disp, void *buf, int count, MPI_Datatype datatype){
+#if (MPI_VERSION > 3) || (MPI_VERSION == 3 && MPI_SUBVERSION >= 1)
+  if (asyncOutput){
+    stagedWrite *staged = stageOutputBuffer(buf, count, datatype);
+    MPI_File_iwrite_at_all(thefile, disp, staged->buffer, count, datatype, &staged->request);
+    return;
+  }
+#endif
+  MPI_Status status;
+  MPI_File_write_at_all(thefile, disp, buf, count, datatype, &status);
+}
+
+void OUTPUT_MANAGER::outputClose(MPI_File *thefile){
+  if (!asyncOutput)
+    MPI_File_close(thefile);
+  else
+    pendingFiles.push_back(*thefile);
+}
+
+//with nSubfiles aggregators the domain outputs are written as nSubfiles files <name>.<n>, each one
+//holding the blocks of a contiguous range of tasks, and an index <name>.idx (see writeOutputBlocks)
+void OUTPUT_MANAGER::setSubfiling(int nSubfiles){
+  if (nSubfiles < 1){
+    printf("ERROR: setSubfiling needs at least one subfile\n");
+    exit(17);
+  }
+  subfileNumber = nSubfiles;
+}
+
+//the writing tasks of the plan are split in (at most) subfileNumber groups of consecutive tasks
+void OUTPUT_MANAGER::prepareAggregation(outputPlan *plan){
+  if (plan->aggregationCommunicator != MPI_COMM_NULL)
+    return;
+  int outputNProc;
+  MPI_Comm_size(plan->outputCommunicator, &outputNProc);
+  int nSubfiles = (subfileNumber < outputNProc) ? subfileNumber : outputNProc;
+  plan->subfileID = (int)(((long int)plan->myOutputID)*nSubfiles / outputNProc);
+  MPI_Comm_split(plan->outputCommunicator, plan->subfileID, plan->myOutputID, &plan->aggregationCommunicator);
+}
+
+//collective over the writing tasks of the plan: each one writes count elements at disp of fileName.
+//With subfiling the blocks of a group are gathered on its first task and written as one contiguous
+//block in fileName.<group>; the first task of the output writes fileName.idx: int endian, number of
+//subfiles, number of tasks, then one subfileIndexEntry per task (box: first sample and number of
+//samples along x, y, z, as in the small header, zero for particles)
+void OUTPUT_MANAGER::writeOutputBlocks(std::string fileName, outputPlan *plan, MPI_Offset disp, void *buf, int count, MPI_Datatype datatype, int *box){
+  MPI_File thefile;
+  outDomain *domain = myDomains[plan->domain];
+  if (domain->streamFlag){
+    int typeSize, outputNProc;
+    MPI_Type_size(datatype, &typeSize);
+    MPI_Comm_size(plan->outputCommunicator, &outputNProc);
+    streamBlock(fileName, plan->myOutputID, outputNProc, box, disp, buf, (long int)count*typeSize);
+    if (!domain->streamFiles)
+      return;
+  }
+  if (!subfileNumber){
+    MPI_File_open(plan->outputCommunicator, (char*)fileName.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, ioInfo, &thefile);
+    outputWriteAtAll(thefile, disp, buf, count, datatype);
+    outputClose(&thefile);
+    return;
+  }
+  prepareAggregation(plan);
+  int typeSize, aggID, aggNProc, outputNProc;
+  MPI_Type_size(datatype, &typeSize);
+  MPI_Comm_rank(plan->aggregationCommunicator, &aggID);
+  MPI_Comm_size(plan->aggregationCommunicator, &aggNProc);
+  MPI_Comm_size(plan->outputCommunicator, &outputNProc);
+
+  subfileIndexEntry entry;
+  entry.task = plan->myOutputID;
+  entry.subfile = plan->subfileID;
+  for (int c = 0; c < 6; c++)
+    entry.box[c] = box ? box[c] : 0;
+  entry.fileOffset = disp;
+  entry.bytes = (int64_t)count*typeSize;
+  MPI_Offset myBytes = entry.bytes, bytesBefore = 0;
+  MPI_Exscan(&myBytes, &bytesBefore, 1, MPI_OFFSET, MPI_SUM, plan->aggregationCommunicator);
+  if (aggID == 0)
+    bytesBefore = 0;
+  entry.subfileOffset = bytesBefore;
+
+  int myCount = (int)entry.bytes;
+  std::vector<int> counts(aggNProc), displs(aggNProc, 0);
+  MPI_Gather(&myCount, 1, MPI_INT, &counts[0], 1, MPI_INT, 0, plan->aggregationCommunicator);
+  long int total = 0;
+  if (aggID == 0){
+    for (int rank = 0; rank < aggNProc; rank++){
+      displs[rank] = (int)total;
+      total += counts[rank];
+    }
+    if (total > 2147483647L){
+      printf("ERROR: more than 2 GB for aggregator %d of %s, use more subfiles\n", plan->subfileID, fileName.c_str());
+      exit(17);
+    }
+  }
+  char *gathered = (aggID == 0) ? new char[total + 1] : NULL;
+  MPI_Gatherv(buf, myCount, MPI_BYTE, gathered, &counts[0], &displs[0], MPI_BYTE, 0, plan->aggregationCommunicator);
+  if (aggID == 0){
+    std::stringstream ss;
+    ss << fileName << "." << plan->subfileID;
+    MPI_File_open(MPI_COMM_SELF, (char*)ss.str().c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, ioInfo, &thefile);
+    outputWriteAtAll(thefile, 0, gathered, (int)total, MPI_BYTE);
+    outputClose(&thefile);
+    delete[] gathered;
+  }
+
+  std::vector<subfileIndexEntry> index((plan->myOutputID == 0) ? outputNProc : 1);
+  MPI_Gather(&entry, sizeof(entry), MPI_BYTE, &index[0], sizeof(entry), MPI_BYTE, 0, plan->outputCommunicator);
+  if (plan->myOutputID == 0){
+    int itodo[3] = { is_big_endian(), index[outputNProc - 1].subfile + 1, outputNProc };
+    std::ofstream of1((fileName + ".idx").c_str(), std::ofstream::binary | std::ofstream::trunc);
+    of1.write((char*)itodo, sizeof(itodo));
+    of1.write((char*)&index[0], outputNProc*sizeof(subfileIndexEntry));
+    of1.close();
+  }
+}
+
+//local consumer (e.g. tools/stream_consumer) listening on a unix socket: the simulation never waits
+//for it, frames are coalesced or dropped when more than queueBytes are waiting to be sent
+void OUTPUT_MANAGER::setStreaming(std::string socketPath, long int queueBytes){
+#if defined(_MSC_VER)
+  printf("ERROR: streaming needs unix domain sockets\n");
+  exit(17);
+#else
+  struct sockaddr_un address;
+  if (socketPath.empty() || socketPath.size() >= sizeof(address.sun_path)){
+    printf("ERROR: invalid stream socket path \"%s\"\n", socketPath.c_str());
+    exit(17);
+  }
+  if (queueBytes <= 0){
+    printf("ERROR: setStreaming needs a positive queue size in bytes\n");
+    exit(17);
+  }
+  streamPath = socketPath;
+  streamBudget = queueBytes;
+#endif
+}
+
+//each task queues its own block (header, name, payload): a queued frame of the same output and task
+//is replaced, otherwise the oldest frames are dropped until the new one fits in the budget
+void OUTPUT_MANAGER::streamBlock(std::string fileName, int task, int tasks, int *box, MPI_Offset disp, void *buf, long int bytes){
+  if (streamPath.empty())
+    return;
+  std::string name = fileName.substr(fileName.find_last_of('/') + 1);
+  streamFrameHeader header;
+  header.magic = STREAM_FRAME_MAGIC;
+  header.task = task;
+  header.tasks = tasks;
+  header.nameLength = (int)name.size();
+  for (int c = 0; c < 6; c++)
+    header.box[c] = box ? box[c] : 0;
+  header.fileOffset = disp;
+  header.bytes = bytes;
+
+  long int frameBytes = sizeof(header) + name.size() + bytes;
+  if (frameBytes > streamBudget){
+    streamDropped++;
+    return;
+  }
+  std::stringstream ss;
+  ss << name.substr(0, name.find_last_of('_')) << ":" << task;
+  streamFrame frame;
+  frame.key = ss.str();
+  frame.data.resize(frameBytes);
+  memcpy(&frame.data[0], &header, sizeof(header));
+  memcpy(&frame.data[sizeof(header)], name.c_str(), name.size());
+  if (bytes)
+    memcpy(&frame.data[sizeof(header) + name.size()], buf, bytes);
+
+  //the frame being sent (streamSent > 0) can be neither replaced nor dropped
+  std::deque<streamFrame>::iterator first = streamQueue.begin();
+  if (streamSent && first != streamQueue.end())
+    first++;
+  for (std::deque<streamFrame>::iterator it = first; it != streamQueue.end(); it++){
+    if (it->key == frame.key){
+      streamQueuedBytes += frameBytes - (long int)it->data.size();
+      it->data.swap(frame.data);
+      streamCoalesced++;
+      pumpStream();
+      return;
+    }
+  }
+  while (streamQueuedBytes + frameBytes > streamBudget && first != streamQueue.end()){
+    streamQueuedBytes -= first->data.size();
+    first = streamQueue.erase(first);
+    streamDropped++;
+  }
+  if (streamQueuedBytes + frameBytes > streamBudget){
+    streamDropped++;
+    return;
+  }
+  streamQueue.push_back(frame);
+  streamQueuedBytes += frameBytes;
+  pumpStream();
+}
+
+//sends as much as the socket takes without blocking; (re)connects when there is something to send
+void OUTPUT_MANAGER::pumpStream(){
+#if !defined(_MSC_VER)
+  if (streamPath.empty() || streamQueue.empty())
+    return;
+  if (streamSocket < 0){
+    streamSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (streamSocket < 0)
+      return;
+    fcntl(streamSocket, F_SETFL, fcntl(streamSocket, F_GETFL) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+    int one = 1;
+    setsockopt(streamSocket, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, streamPath.c_str(), sizeof(address.sun_path) - 1);
+    if (connect(streamSocket, (struct sockaddr*)&address, sizeof(address)) != 0){
+      closeStream();
+      return;
+    }
+  }
+  int flags = MSG_DONTWAIT;
+#ifdef MSG_NOSIGNAL
+  flags |= MSG_NOSIGNAL;
+#endif
+  while (streamQueue.size()){
+    std::vector<char> &data = streamQueue.front().data;
+    ssize_t sent = send(streamSocket, &data[streamSent], data.size() - streamSent, flags);
+    if (sent < 0){
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        closeStream();
+      return;
+    }
+    streamSent += sent;
+    if (streamSent == data.size()){
+      streamQueuedBytes -= data.size();
+      streamQueue.pop_front();
+      streamSent = 0;
+    }
+  }
+#endif
+}
+
+//a frame interrupted by a lost connection is sent again from its beginning
+void OUTPUT_MANAGER::closeStream(){
+#if !defined(_MSC_VER)
+  if (streamSocket >= 0)
+    ::close(streamSocket);
+#endif
+  streamSocket = -1;
+  streamSent = 0;
+}
+
+//the consumer gets (at most) two seconds to take the last frames; what is left counts as dropped
+void OUTPUT_MANAGER::finishStream(){
+#if !defined(_MSC_VER)
+  double start = MPI_Wtime();
+  pumpStream();
+  while (streamQueue.size() && streamSocket >= 0 && MPI_Wtime() - start < 2.0){
+    struct pollfd pfd;
+    pfd.fd = streamSocket;
+    pfd.events = POLLOUT;
+    poll(&pfd, 1, 100);
+    pumpStream();
+  }
+#endif
+  closeStream();
+  streamDropped += streamQueue.size();
+  streamQueue.clear();
+  streamQueuedBytes = 0;
+  long int counts[2] = { streamDropped, streamCoalesced }, totals[2];
+  MPI_Reduce(counts, totals, 2, MPI_LONG, MPI_SUM, mygrid->master_proc, MPI_COMM_WORLD);
+  if (mygrid->myid == mygrid->master_proc)
+    printf("stream: %ld frames dropped, %ld coalesced\n", totals[0], totals[1]);
+}
+
+//to be called before initialize: the fields, densities, currents, accumulators, phase spaces and
+//histograms of a step go in OUTPUT_<time>.h5 instead of the binary files; deflateLevel (0-9) > 0
+//adds the shuffle and deflate filters
+void OUTPUT_MANAGER::setHDF5Output(int deflateLevel){
+#if defined(USE_HDF5)
+  if (deflateLevel < 0 || deflateLevel > 9){
+    printf("ERROR: the HDF5 deflate level must be in [0, 9]\n");
+    exit(17);
+  }
+#if !H5_VERSION_GE(1, 10, 2)
+  int nproc;
+  MPI_Comm_size(MPI_COMM_WORLD, &nproc);
+  if (deflateLevel && nproc > 1){
+    printf("ERROR: parallel writes with filters need HDF5 1.10.2 or newer\n");
+    exit(17);
+  }
+#endif
+  hdf5Output = true;
+  hdf5Deflate = deflateLevel;
+#else
+  (void)deflateLevel;
+  printf("ERROR: HDF5 output needs a build with USE_HDF5\n");
+  exit(17);
+#endif
+}
 
+void OUTPUT_MANAGER::completeOldestWrite(){
+  MPI_Wait(&stagedWrites.front().request, MPI_STATUS_IGNORE);
+  free(stagedWrites.front().buffer);
+  stagedBytes -= stagedWrites.front().bytes;
+  stagedWrites.pop_front();
+}
+
+void OUTPUT_MANAGER::completePendingOutput(){
+  while (stagedWrites.size())
+    completeOldestWrite();
+  for (std::vector<MPI_File>::iterator it = pendingFiles.begin(); it != pendingFiles.end(); it++)
+    MPI_File_close(&(*it));
+  pendingFiles.clear();
 }
 
 bool OUTPUT_MANAGER::checkGrid(){
@@ -394,20 +1257,21 @@ int OUTPUT_MANAGER::findDomainIndexInMydomainsVector(outDomain *newDomain){
 
 }
 
-void OUTPUT_MANAGER::addRequestToList(std::list<request>& reqList, diagType type, int target, int domain, double startTime, double frequency, double endTime){
-  std::list<request> tempList;
-
-  for (double ttime = startTime; ttime <= endTime; ttime += frequency){
-    request req;
-    req.dtime = ttime;
-    req.itime = getIntegerTime(ttime);
-    req.type = type;
-    req.target = target;
-    req.domain = domain;
-    tempList.push_back(req);
+//only the series is stored, its requests are generated by callDiags when they are due
+void OUTPUT_MANAGER::addRequestToList(std::vector<scheduledOutput>& schedule, diagType type, int target, int domain, double startTime, double frequency, double endTime){
+  if (!(frequency > 0)){
+    printf("ERROR: the output frequency must be positive\n");
+    exit(17);
   }
-  tempList.sort(requestCompTime);
-  reqList.merge(tempList, requestCompTime);
+  scheduledOutput entry;
+  entry.type = type;
+  entry.target = target;
+  entry.domain = domain;
+  entry.startTime = startTime;
+  entry.frequency = frequency;
+  entry.endTime = endTime;
+  entry.dtime = startTime;
+  schedule.push_back(entry);
 }
 
 
@@ -497,14 +1361,14 @@ void OUTPUT_MANAGER::addEBField(outDomain* _domain, double startTime, double fre
   }
 
   if (whichOut == WHICH_E_AND_B){
-    addRequestToList(requestList, OUT_E_FIELD, 0, domainID, startTime, frequency, endTime);
-    addRequestToList(requestList, OUT_B_FIELD, 0, domainID, startTime, frequency, endTime);
+    addRequestToList(outputSchedule, OUT_E_FIELD, 0, domainID, startTime, frequency, endTime);
+    addRequestToList(outputSchedule, OUT_B_FIELD, 0, domainID, startTime, frequency, endTime);
   }
   else if (whichOut == WHICH_E_ONLY){
-    addRequestToList(requestList, OUT_E_FIELD, 0, domainID, startTime, frequency, endTime);
+    addRequestToList(outputSchedule, OUT_E_FIELD, 0, domainID, startTime, frequency, endTime);
   }
   else if (whichOut == WHICH_B_ONLY){
-    addRequestToList(requestList, OUT_B_FIELD, 0, domainID, startTime, frequency, endTime);
+    addRequestToList(outputSchedule, OUT_B_FIELD, 0, domainID, startTime, frequency, endTime);
   }
 
 }
@@ -530,7 +1394,7 @@ void OUTPUT_MANAGER::addEBFieldProbe(emProbe* Probe, double startTime, double fr
     isThereEMProbe = true;
     domainID = myEMProbes.size() - 1;
   }
-  addRequestToList(requestList, OUT_EB_PROBE, 0, domainID, startTime, frequency, endTime);
+  addRequestToList(outputSchedule, OUT_EB_PROBE, 0, domainID, startTime, frequency, endTime);
 }
 
 // ++++++++++++++++++++++++++++     species density
@@ -572,7 +1436,7 @@ void OUTPUT_MANAGER::addSpeciesDensity(outDomain* domain_in, std::string name, d
       domainID = myDomains.size() - 1;
     }
   }
-  addRequestToList(requestList, OUT_SPEC_DENSITY, specNum, domainID, startTime, frequency, endTime);
+  addRequestToList(outputSchedule, OUT_SPEC_DENSITY, specNum, domainID, startTime, frequency, endTime);
 }
 
 // ++++++++++++++++++++++++++++     current
@@ -612,7 +1476,7 @@ void OUTPUT_MANAGER::addCurrent(outDomain* domain_in, double startTime, double f
       domainID = myDomains.size() - 1;
     }
   }
-  addRequestToList(requestList, OUT_CURRENT, 0, domainID, startTime, frequency, endTime);
+  addRequestToList(outputSchedule, OUT_CURRENT, 0, domainID, startTime, frequency, endTime);
 }
 
 // ++++++++++++++++++++++++++++     species binary
@@ -655,59 +1519,424 @@ void OUTPUT_MANAGER::addSpeciesPhaseSpace(outDomain* domain_in, std::string name
       domainID = myDomains.size() - 1;
     }
   }
-  addRequestToList(requestList, OUT_SPEC_PHASE_SPACE, specNum, domainID, startTime, frequency, endTime);
+  addRequestToList(outputSchedule, OUT_SPEC_PHASE_SPACE, specNum, domainID, startTime, frequency, endTime);
 }
 
-// ++++++++++++++++++++++++++++     diag
-
-void OUTPUT_MANAGER::addDiagFrom(double startTime, double frequency){
-  addDiag(startTime, frequency, mygrid->getTotalTime());
-}
+// ++++++++++++++++++++++++++++     particle tracking
 
-void OUTPUT_MANAGER::addDiagAt(double atTime){
-  addDiag(atTime, 1.0, atTime);
+void OUTPUT_MANAGER::addSpeciesTrackingFrom(outDomain* domain_in, std::string name, int maxParticles, double startTime, double frequency){
+  addSpeciesTracking(domain_in, name, maxParticles, startTime, frequency, mygrid->getTotalTime());
 }
 
-void OUTPUT_MANAGER::addDiagFromTo(double startTime, double frequency, double endTime){
-  addDiag(startTime, frequency, endTime);
+void OUTPUT_MANAGER::addSpeciesTrackingFromTo(outDomain* domain_in, std::string name, int maxParticles, double startTime, double frequency, double endTime){
+  addSpeciesTracking(domain_in, name, maxParticles, startTime, frequency, endTime);
 }
 
-void OUTPUT_MANAGER::addDiag(double startTime, double frequency, double endTime){
-  if (!(checkGrid() && checkCurrent() && checkEMField()))
+void OUTPUT_MANAGER::addSpeciesTracking(outDomain* domain_in, std::string name, int maxParticles, double startTime, double frequency, double endTime){
+  if (!(checkGrid() && checkSpecies()))
     return;
-  addRequestToList(requestList, OUT_DIAG, 0, 0, startTime, frequency, endTime);
-  isThereDiag = true;
+  int specNum = findSpecIndexInMyspeciesVector(name);
+  if (specNum < 0)
+    return;
+  if (maxParticles < 1){
+    printf("ERROR: at least one particle must be tracked\n");
+    exit(17);
+  }
+  int domainID = 0;
+  if (domain_in != NULL){
+    domainID = findDomainIndexInMydomainsVector(domain_in);
+    if (domainID < 0){
+      myDomains.push_back(domain_in);
+      domainID = myDomains.size() - 1;
+    }
+  }
+  if (myTrackings.count(specNum)){
+    printf("ERROR: species %s is already tracked\n", name.c_str());
+    exit(17);
+  }
+  trackingOutput track;
+  track.domain = domainID;
+  track.maxParticles = maxParticles;
+  track.selected = false;
+  track.components = myDomains[domainID]->phaseSpaceComponents & ~PS_MARKER;
+  myTrackings[specNum] = track;
+  addRequestToList(outputSchedule, OUT_SPEC_TRACK, specNum, domainID, startTime, frequency, endTime);
 }
 
-void OUTPUT_MANAGER::prepareOutputMap(){
+// ++++++++++++++++++++++++++++     histograms
+
+void OUTPUT_MANAGER::addSpeciesHistogramFrom(outDomain* domain_in, outHistogram* hist, std::string name, double startTime, double frequency){
+  addSpeciesHistogram(domain_in, hist, name, startTime, frequency, mygrid->getTotalTime());
+}
 
-  requestList.sort(requestCompTime);
-  requestList.unique(requestCompUnique);
+void OUTPUT_MANAGER::addSpeciesHistogramAt(outDomain* domain_in, outHistogram* hist, std::string name, double atTime){
+  addSpeciesHistogram(domain_in, hist, name, atTime, 1.0, atTime);
+}
 
-  std::map< int, std::vector<request> >::iterator itMap;
+void OUTPUT_MANAGER::addSpeciesHistogramFromTo(outDomain* domain_in, outHistogram* hist, std::string name, double startTime, double frequency, double endTime){
+  addSpeciesHistogram(domain_in, hist, name, startTime, frequency, endTime);
+}
 
-  for (std::list<request>::iterator itList = requestList.begin(); itList != requestList.end(); itList++){
-    itMap = allOutputs.find(itList->itime);
-    if (itMap != allOutputs.end()){
-      itMap->second.push_back(*itList);
+void OUTPUT_MANAGER::addSpeciesHistogram(outDomain* domain_in, outHistogram* hist, std::string name, double startTime, double frequency, double endTime){
+  if (!(checkGrid() && checkSpecies()))
+    return;
+  int specNum = findSpecIndexInMyspeciesVector(name);
+  if (specNum < 0)
+    return;
+  if (hist->nAxes < 1){
+    printf("ERROR: histogram %s has no axis\n", hist->name.c_str());
+    exit(17);
+  }
+  int domainID = 0;
+  if (domain_in != NULL){
+    domainID = findDomainIndexInMydomainsVector(domain_in);
+    if (domainID < 0){
+      myDomains.push_back(domain_in);
+      domainID = myDomains.size() - 1;
     }
-    else{
-      std::vector<request> newTimeVec;
-      newTimeVec.push_back(*itList);
-      allOutputs.insert(std::pair<int, std::vector<request> >(itList->itime, newTimeVec));
-      timeList.push_back(itList->itime);
+  }
+  int histID = -1;
+  for (size_t h = 0; h < myHistograms.size(); h++){
+    if (myHistograms[h] == hist && histogramSpecies[h] == specNum)
+      histID = h;
+    else if (myHistograms[h]->name == hist->name && histogramSpecies[h] == specNum){
+      printf("ERROR: species %s has two histograms named \"%s\"\n", name.c_str(), hist->name.c_str());
+      exit(17);
     }
   }
-
+  if (histID < 0){
+    myHistograms.push_back(hist);
+    histogramSpecies.push_back(specNum);
+    histID = myHistograms.size() - 1;
+  }
+  addRequestToList(outputSchedule, OUT_SPEC_HISTOGRAM, histID, domainID, startTime, frequency, endTime);
 }
 
+// ++++++++++++++++++++++++++++     accumulators
 
-void OUTPUT_MANAGER::processOutputEntry(request req){
-  switch (req.type){
+void OUTPUT_MANAGER::addFieldAccumulatorFrom(outDomain* domain_in, outAccumulator* acc, double startTime, int everySteps, double window){
+  addFieldAccumulator(domain_in, acc, startTime, everySteps, window, mygrid->getTotalTime());
+}
 
-  case OUT_E_FIELD:
-    callEMFieldDomain(req);
-    break;
+void OUTPUT_MANAGER::addFieldAccumulatorFromTo(outDomain* domain_in, outAccumulator* acc, double startTime, int everySteps, double window, double endTime){
+  addFieldAccumulator(domain_in, acc, startTime, everySteps, window, endTime);
+}
+
+//the accumulator is updated every everySteps steps from startTime and written (then reset)
+//at the last sample of each window, and at the last sample before endTime
+void OUTPUT_MANAGER::addFieldAccumulator(outDomain* domain_in, outAccumulator* acc, double startTime, int everySteps, double window, double endTime){
+  if (!(checkGrid() && checkEMField() && checkCurrent()))
+    return;
+  if (everySteps < 1){
+    printf("ERROR: accumulators are updated at least every step\n");
+    exit(17);
+  }
+  int windowSteps = (int)floor(window / mygrid->dt + 0.5);
+  if (windowSteps < everySteps){
+    printf("ERROR: the window of accumulator %s is shorter than the update interval\n", acc->name.c_str());
+    exit(17);
+  }
+  int specNum = -1;
+  if (acc->quantity == ACC_SPEC_DENSITY){
+    if (!checkSpecies())
+      return;
+    specNum = findSpecIndexInMyspeciesVector(acc->species);
+    if (specNum < 0)
+      return;
+  }
+  int domainID = 0;
+  if (domain_in != NULL){
+    domainID = findDomainIndexInMydomainsVector(domain_in);
+    if (domainID < 0){
+      myDomains.push_back(domain_in);
+      domainID = myDomains.size() - 1;
+    }
+  }
+  for (size_t a = 0; a < myAccumulators.size(); a++){
+    if (myAccumulators[a].acc->name == acc->name){
+      printf("ERROR: two accumulators named \"%s\"\n", acc->name.c_str());
+      exit(17);
+    }
+  }
+  accumulatorOutput accum;
+  accum.acc = acc;
+  accum.spec = specNum;
+  accum.everySteps = everySteps;
+  accum.windowSteps = windowSteps;
+  accum.windowEnd = getIntegerTime(startTime) + windowSteps;
+  accum.samples = 0;
+  accum.gridXmin = mygrid->rmin[0];
+  myAccumulators.push_back(accum);
+  int accID = myAccumulators.size() - 1;
+  addRequestToList(outputSchedule, OUT_FIELD_ACCUMULATOR, accID, domainID, startTime, everySteps*mygrid->dt, endTime);
+}
+
+// ++++++++++++++++++++++++++++     diag
+
+void OUTPUT_MANAGER::addDiagFrom(double startTime, double frequency){
+  addDiag(startTime, frequency, mygrid->getTotalTime());
+}
+
+void OUTPUT_MANAGER::addDiagAt(double atTime){
+  addDiag(atTime, 1.0, atTime);
+}
+
+void OUTPUT_MANAGER::addDiagFromTo(double startTime, double frequency, double endTime){
+  addDiag(startTime, frequency, endTime);
+}
+
+void OUTPUT_MANAGER::addDiag(double startTime, double frequency, double endTime){
+  if (!(checkGrid() && checkCurrent() && checkEMField()))
+    return;
+  addRequestToList(outputSchedule, OUT_DIAG, 0, 0, startTime, frequency, endTime);
+  isThereDiag = true;
+}
+
+void OUTPUT_MANAGER::prepareOutputSchedule(){
+  while (!nextOutputs.empty())
+    nextOutputs.pop();
+  for (size_t id = 0; id < outputSchedule.size(); id++){
+    outputSchedule[id].dtime = outputSchedule[id].startTime;
+    pushScheduledOutput(id);
+  }
+}
+
+//queues the current request of the series, false when the series is over (or beyond the last step)
+bool OUTPUT_MANAGER::pushScheduledOutput(int id){
+  scheduledOutput &entry = outputSchedule[id];
+  if (entry.dtime > entry.endTime)
+    return false;
+  int step = getIntegerTime(entry.dtime);
+  if (step < 0 && entry.dtime > 0)
+    return false;
+  nextOutputs.push(std::make_pair(step, id));
+  return true;
+}
+
+
+//one scratch component for each species with density outputs
+void OUTPUT_MANAGER::allocateDensityScratch(){
+  int Ncomp = 0;
+  densityComp.assign(myspecies.size(), -1);
+  for (std::vector<scheduledOutput>::iterator it = outputSchedule.begin(); it != outputSchedule.end(); it++){
+    if (it->type == OUT_SPEC_DENSITY && densityComp[it->target] < 0)
+      densityComp[it->target] = Ncomp++;
+  }
+  for (size_t a = 0; a < myAccumulators.size(); a++){
+    int spec = myAccumulators[a].spec;
+    if (spec >= 0 && densityComp[spec] < 0)
+      densityComp[spec] = Ncomp++;
+  }
+  if (Ncomp > 0 && checkGrid())
+    densityScratch.allocate(mygrid, Ncomp);
+}
+
+//all the densities requested at this step are deposited in a single pass and exchanged with a single pbc
+void OUTPUT_MANAGER::depositSpecDensities(std::vector<request> &diagList){
+  std::vector<bool> requested(myspecies.size(), false);
+  bool isThereDensity = false;
+  for (std::vector<request>::iterator it = diagList.begin(); it != diagList.end(); it++){
+    if (it->type == OUT_SPEC_DENSITY){
+      requested[it->target] = true;
+      isThereDensity = true;
+    }
+    else if (it->type == OUT_FIELD_ACCUMULATOR && myAccumulators[it->target].spec >= 0){
+      requested[myAccumulators[it->target].spec] = true;
+      isThereDensity = true;
+    }
+  }
+  if (!isThereDensity)
+    return;
+
+  densityScratch.setAllValuesToZero();
+  for (size_t spec = 0; spec < myspecies.size(); spec++){
+    if (requested[spec])
+      myspecies[spec]->density_deposition_standard(&densityScratch, densityComp[spec]);
+  }
+  densityScratch.pbc();
+}
+
+//the communicators of all the requested outputs are created here, once, instead of at each output step
+void OUTPUT_MANAGER::prepareOutputPlans(){
+  for (std::vector<scheduledOutput>::iterator it = outputSchedule.begin(); it != outputSchedule.end(); it++){
+    if (it->type == OUT_E_FIELD || it->type == OUT_B_FIELD || it->type == OUT_SPEC_DENSITY || it->type == OUT_FIELD_ACCUMULATOR)
+      getOutputPlan(it->domain, PLAN_GRID);
+    else if (it->type == OUT_CURRENT)
+      getOutputPlan(it->domain, hdf5Output ? PLAN_GRID : PLAN_SLICE);
+    else if (it->type == OUT_SPEC_PHASE_SPACE && (it->domain != 0 || subfileNumber))
+      getOutputPlan(it->domain, PLAN_PARTICLES);
+  }
+}
+
+//collective over cart_comm when the plan has to be (re)built; every task sees the same window position
+outputPlan* OUTPUT_MANAGER::getOutputPlan(int domain, planType type){
+  std::pair<int, int> key(domain, type);
+  std::map<std::pair<int, int>, outputPlan>::iterator it = outputPlans.find(key);
+  if (it != outputPlans.end()){
+    if (it->second.gridXmin == mygrid->rmin[0])
+      return &it->second;
+    MPI_Comm_free(&it->second.outputCommunicator);
+    if (it->second.aggregationCommunicator != MPI_COMM_NULL)
+      MPI_Comm_free(&it->second.aggregationCommunicator);
+  }
+  outputPlan *plan = &outputPlans[key];
+  if (type == PLAN_GRID)
+    buildGridOutputPlan(plan, domain);
+  else if (type == PLAN_SLICE)
+    buildSliceOutputPlan(plan, domain);
+  else
+    buildParticleOutputPlan(plan, domain);
+  plan->gridXmin = mygrid->rmin[0];
+  plan->aggregationCommunicator = MPI_COMM_NULL;
+  plan->subfileID = 0;
+  plan->domain = domain;
+  return plan;
+}
+
+void OUTPUT_MANAGER::buildGridOutputPlan(outputPlan *plan, int domain){
+  int isInMyHyperplane = false;
+  int imax[3], locimax[3];
+  outDomain *dom = myDomains[domain];
+
+  setAndCheckRemains(plan->remains, dom->remainingCoord);
+  findGlobalIntegerBoundaries(dom->rmin, dom->rmax, plan->imin, imax);
+  findLocalIntegerBoundaries(dom->rmin, dom->rmax, plan->locimin, locimax);
+  findNumberOfProcsWithinSubdomain(plan->slice_rNproc, plan->imin, imax, plan->remains);
+
+  findGlobalSubdomainUniquePointsNumber(plan->uniqueN, plan->imin, imax, plan->remains);
+  findLocalSubdomainUniquePointsNumber(plan->uniqueLocN, plan->locimin, locimax, plan->remains);
+  nearestInt(dom->coordinates, plan->ri, plan->globalri);
+
+  //sample k of a decimated axis is the point (or the block starting at) imin + k*decimation
+  plan->average = dom->decimationAverage;
+  for (int c = 0; c < 3; c++){
+    plan->decimation[c] = plan->remains[c] ? dom->decimation[c] : 1;
+    plan->fineFirst[c] = 0;
+    if (plan->remains[c] && mygrid->rproc_imin[c][mygrid->rmyid[c]] > plan->imin[c])
+      plan->fineFirst[c] = mygrid->rproc_imin[c][mygrid->rmyid[c]] - plan->imin[c];
+    int s = plan->decimation[c];
+    plan->sampleN[c] = (plan->uniqueN[c] + s - 1) / s;
+    plan->sampleFirst[c] = (plan->fineFirst[c] + s - 1) / s;
+    plan->sampleLocN[c] = (plan->fineFirst[c] + plan->uniqueLocN[c] + s - 1) / s - plan->sampleFirst[c];
+  }
+
+  isInMyHyperplane = isThePointInMyDomain(dom->coordinates);
+
+  MPI_Comm sliceCommunicator;
+  MPI_Cart_sub(mygrid->cart_comm, plan->remains, &sliceCommunicator);
+  MPI_Allreduce(MPI_IN_PLACE, &isInMyHyperplane, 1, MPI_INT, MPI_LOR, sliceCommunicator);
+  MPI_Comm_free(&sliceCommunicator);
+
+  plan->shouldIWrite = false;
+  if (isInMyHyperplane)
+    plan->shouldIWrite = amIInTheSubDomain(domain);
+
+  MPI_Comm_split(mygrid->cart_comm, plan->shouldIWrite, 0, &plan->outputCommunicator);
+  int outputNProc;
+  MPI_Comm_rank(plan->outputCommunicator, &plan->myOutputID);
+  MPI_Comm_size(plan->outputCommunicator, &outputNProc);
+
+  int *totUniquePoints = new int[outputNProc];
+  totUniquePoints[plan->myOutputID] = plan->sampleLocN[0] * plan->sampleLocN[1] * plan->sampleLocN[2];
+  MPI_Allgather(MPI_IN_PLACE, 1, MPI_INT, totUniquePoints, 1, MPI_INT, plan->outputCommunicator);
+  plan->pointsBefore = 0;
+  for (int rank = 0; rank < plan->myOutputID; rank++)
+    plan->pointsBefore += totUniquePoints[rank];
+  delete[] totUniquePoints;
+
+  //block averages need the ranges of the writing tasks on the same grid lines
+  if (plan->shouldIWrite && plan->average){
+    int mine[9];
+    int *all = new int[9 * outputNProc];
+    for (int c = 0; c < 3; c++){
+      mine[c] = mygrid->rmyid[c];
+      mine[c + 3] = plan->fineFirst[c];
+      mine[c + 6] = plan->uniqueLocN[c];
+      plan->lineStart[c].assign(mygrid->rnproc[c], 0);
+      plan->lineEnd[c].assign(mygrid->rnproc[c], 0);
+    }
+    MPI_Allgather(mine, 9, MPI_INT, all, 9, MPI_INT, plan->outputCommunicator);
+    for (int rank = 0; rank < outputNProc; rank++){
+      int *rid = &all[9 * rank];
+      for (int c = 0; c < 3; c++){
+        if (rid[(c + 1) % 3] == mine[(c + 1) % 3] && rid[(c + 2) % 3] == mine[(c + 2) % 3]){
+          plan->lineStart[c][rid[c]] = rid[c + 3];
+          plan->lineEnd[c][rid[c]] = rid[c + 3] + rid[c + 6];
+        }
+      }
+    }
+    delete[] all;
+  }
+}
+
+//the current is written on the whole hyperplane through the domain point
+void OUTPUT_MANAGER::buildSliceOutputPlan(outputPlan *plan, int domain){
+  outDomain *dom = myDomains[domain];
+  double rr[3] = { dom->coordinates[0], dom->coordinates[1], dom->coordinates[2] };
+  for (int c = 0; c < 3; c++)
+    plan->remains[c] = dom->remainingCoord[c];
+
+  if (dom->overrideFlag){
+    for (int c = 0; c < 3; c++){
+      rr[c] = 0.5*(mygrid->rmin[c] + mygrid->rmax[c]);
+      plan->remains[c] = 1;
+    }
+  }
+
+  plan->average = false;
+  for (int c = 0; c < 3; c++){
+    plan->imin[c] = plan->locimin[c] = 0;
+    plan->decimation[c] = 1;
+    if (plan->remains[c]){
+      plan->uniqueN[c] = mygrid->uniquePoints[c];
+      plan->uniqueLocN[c] = mygrid->uniquePointsloc[c];
+      plan->slice_rNproc[c] = mygrid->rnproc[c];
+    }
+    else{
+      plan->uniqueN[c] = 1;
+      plan->uniqueLocN[c] = 1;
+      plan->slice_rNproc[c] = 1;
+    }
+  }
+  nearestInt(rr, plan->ri, plan->globalri);
+
+  plan->shouldIWrite = isThePointInMyDomain(rr);
+
+  int dimension;
+  MPI_Cart_sub(mygrid->cart_comm, plan->remains, &plan->outputCommunicator);
+  MPI_Comm_rank(plan->outputCommunicator, &plan->myOutputID);
+  MPI_Cartdim_get(plan->outputCommunicator, &dimension);
+  MPI_Allreduce(MPI_IN_PLACE, &plan->shouldIWrite, 1, MPI_INT, MPI_LOR, plan->outputCommunicator);
+
+  plan->pointsBefore = 0;
+  for (int rank = 0; rank < plan->myOutputID; rank++){
+    int rid[3], idbookmark = 0;
+    MPI_Offset points = 1;
+    MPI_Cart_coords(plan->outputCommunicator, rank, dimension, rid);
+    for (int c = 0; c < 3; c++){
+      if (plan->remains[c]){
+        points *= mygrid->rproc_NuniquePointsloc[c][rid[idbookmark]];
+        idbookmark++;
+      }
+    }
+    plan->pointsBefore += points;
+  }
+}
+
+//the number of particles changes at every output, only the communicator is kept
+void OUTPUT_MANAGER::buildParticleOutputPlan(outputPlan *plan, int domain){
+  plan->shouldIWrite = amIInTheSubDomain(domain);
+  MPI_Comm_split(mygrid->cart_comm, plan->shouldIWrite, 0, &plan->outputCommunicator);
+  MPI_Comm_rank(plan->outputCommunicator, &plan->myOutputID);
+  plan->pointsBefore = 0;
+}
+
+void OUTPUT_MANAGER::processOutputEntry(request req){
+  switch (req.type){
+
+  case OUT_E_FIELD:
+    callEMFieldDomain(req);
+    break;
   case OUT_B_FIELD:
     callEMFieldDomain(req);
     break;
@@ -728,6 +1957,18 @@ void OUTPUT_MANAGER::processOutputEntry(request req){
     callSpecPhaseSpace(req);
     break;
 
+  case OUT_SPEC_TRACK:
+    callSpecTracking(req);
+    break;
+
+  case OUT_SPEC_HISTOGRAM:
+    callSpecHistogram(req);
+    break;
+
+  case OUT_FIELD_ACCUMULATOR:
+    callFieldAccumulator(req);
+    break;
+
   case OUT_DIAG:
     callDiag(req);
     break;
@@ -737,18 +1978,44 @@ void OUTPUT_MANAGER::processOutputEntry(request req){
   }
 }
 
+//the series due at istep are expanded in requests and moved to their next time
+//(the requests of steps which were never called, e.g. before a restart, are skipped)
 void OUTPUT_MANAGER::callDiags(int istep){
-  std::map< int, std::vector<request> >::iterator itMap;
-  itMap = allOutputs.find(istep);
-
-  if (itMap == allOutputs.end())
+  std::vector<request> diagList;
+  pumpStream();
+  while (!nextOutputs.empty() && nextOutputs.top().first <= istep){
+    int step = nextOutputs.top().first, id = nextOutputs.top().second;
+    nextOutputs.pop();
+    scheduledOutput &entry = outputSchedule[id];
+    request req;
+    req.dtime = entry.dtime;
+    req.itime = step;
+    req.type = entry.type;
+    req.target = entry.target;
+    req.domain = entry.domain;
+    entry.dtime += entry.frequency;
+    req.last = !pushScheduledOutput(id);
+    if (step == istep)
+      diagList.push_back(req);
+  }
+  if (diagList.empty())
     return;
+  std::stable_sort(diagList.begin(), diagList.end(), requestCompTime);
+  diagList.erase(std::unique(diagList.begin(), diagList.end(), requestCompUnique), diagList.end());
 
-  std::vector<request> diagList = itMap->second;
+  completePendingOutput();
+  depositSpecDensities(diagList);
 
+  bool withProbes = false;
   for (std::vector<request>::iterator it = diagList.begin(); it != diagList.end(); it++){
     processOutputEntry(*it);
+    withProbes = withProbes || (it->type == OUT_EB_PROBE);
   }
+  if (withProbes && probeFlushSteps && (++probeBufferedSteps) >= probeFlushSteps)
+    flushProbeBuffer();
+#if defined(USE_HDF5)
+  closeHDF5File();
+#endif
 }
 
 std::string OUTPUT_MANAGER::composeOutputName(std::string dir, std::string out, std::string opt, double time, std::string ext){
@@ -791,32 +2058,31 @@ void OUTPUT_MANAGER::writeEMFieldBinary(std::string fileName, request req){
     + sizeof(int) + myfield->getNcomp() * 3 * sizeof(int);
 
   MPI_File thefile;
-  MPI_Status status;
 
   char* nomefile = new char[fileName.size() + 1];
 
   nomefile[fileName.size()] = 0;
   sprintf(nomefile, "%s", fileName.c_str());
 
-  MPI_File_open(MPI_COMM_WORLD, nomefile, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &thefile);
+  MPI_File_open(MPI_COMM_WORLD, nomefile, MPI_MODE_CREATE | MPI_MODE_WRONLY, ioInfo, &thefile);
 
   //+++++++++++ FILE HEADER  +++++++++++++++++++++
   // We are not using the mygrid->master_proc to write them since it would require a double MPI_File_set_view
   // in case it is not the #0. Doing a double MPI_File_set_view from the same task to the same file is not guaranteed to work.
   if (mygrid->myid == 0){
     MPI_File_set_view(thefile, 0, MPI_FLOAT, MPI_FLOAT, (char *) "native", MPI_INFO_NULL);
-    MPI_File_write(thefile, uniqueN, 3, MPI_INT, &status);
-    MPI_File_write(thefile, mygrid->rnproc, 3, MPI_INT, &status);
-    MPI_File_write(thefile, &Ncomp, 1, MPI_INT, &status);
+    outputWrite(thefile, uniqueN, 3, MPI_INT);
+    outputWrite(thefile, mygrid->rnproc, 3, MPI_INT);
+    outputWrite(thefile, &Ncomp, 1, MPI_INT);
     for (int c = 0; c < Ncomp; c++){
       integer_or_halfinteger crd = myfield->getCompCoords(c);
       int tp[3] = { (int)crd.x, (int)crd.y, (int)crd.z };
-      MPI_File_write(thefile, tp, 3, MPI_INT, &status);
+      outputWrite(thefile, tp, 3, MPI_INT);
     }
     for (int c = 0; c < 3; c++)
-      MPI_File_write(thefile, mygrid->cir[c], uniqueN[c], MPI_DOUBLE, &status);
+      outputWrite(thefile, mygrid->cir[c], uniqueN[c], MPI_DOUBLE);
     for (int c = 0; c < 3; c++)
-      MPI_File_write(thefile, mygrid->chr[c], uniqueN[c], MPI_DOUBLE, &status);
+      outputWrite(thefile, mygrid->chr[c], uniqueN[c], MPI_DOUBLE);
   }
   //*********** END HEADER *****************
 
@@ -844,7 +2110,7 @@ void OUTPUT_MANAGER::writeEMFieldBinary(std::string fileName, request req){
       todo[3] = mygrid->uniquePointsloc[0];
       todo[4] = mygrid->uniquePointsloc[1];
       todo[5] = mygrid->uniquePointsloc[2];
-      MPI_File_write(thefile, todo, 6, MPI_INT, &status);
+      outputWrite(thefile, todo, 6, MPI_INT);
     }
   //+++++++++++ Start CPU Field Values  +++++++++++++++++++++
     {
@@ -860,12 +2126,12 @@ void OUTPUT_MANAGER::writeEMFieldBinary(std::string fileName, request req){
           for (int i = 0; i < Nx; i++)
             for (int c = 0; c < Ncomp; c++)
               todo[c + i*Ncomp + j*Nx*Ncomp + k*Ny*Nx*Ncomp] = (float)myfield->VEB(c, i, j, k);
-      MPI_File_write(thefile, todo, size, MPI_FLOAT, &status);
+      outputWrite(thefile, todo, size, MPI_FLOAT);
       delete[]todo;
     }
 
 
-  MPI_File_close(&thefile);
+  outputClose(&thefile);
   delete[] nomefile;
   //////////////////////////// END of collective binary file write
 }
@@ -874,152 +2140,260 @@ void OUTPUT_MANAGER::writeEMFieldBinary(std::string fileName, request req){
 
 #if defined(USE_HDF5)
 
-void OUTPUT_MANAGER::writeEMFieldBinaryHDF5(std::string fileName, request req){
-  int dimensionality = mygrid->accesso.dimensions;
-  int Ncomp = myfield->getNcomp();
-
-  MPI_Info info = MPI_INFO_NULL;
-  char nomi[6][3] = { "Ex", "Ey", "Ez", "Bx", "By", "Bz" };
-  char* nomefile = new char[fileName.size() + 4];
-  nomefile[fileName.size()] = 0;
-  sprintf(nomefile, "%s.h5", fileName.c_str());
-
-  hid_t       file_id, dset_id[6];         /* file and dataset identifiers */
-  hid_t       filespace[6], memspace[6];      /* file and memory dataspace identifiers */
-  hsize_t     dimsf[3];                 /* dataset dimensions */
-  hsize_t	count[3];	          /* hyperslab selection parameters */
-  hsize_t	offset[3];
-  hid_t	plist_id;                 /* property list identifier */
-  int         i;
-  herr_t	status;
-  /*
-       * Set up file access property list with parallel I/O access
-       */
-  plist_id = H5Pcreate(H5P_FILE_ACCESS);
-  H5Pset_fapl_mpio(plist_id, MPI_COMM_WORLD, info);
-
-  /*
-       * Create a new file collectively and release property list identifier.
-       */
-  file_id = H5Fcreate(nomefile, H5F_ACC_TRUNC, H5P_DEFAULT, plist_id);
+//one file per output step, created at the first HDF5 output of the step and closed at the end of callDiags
+void OUTPUT_MANAGER::openHDF5File(request req){
+  if (hdf5File >= 0)
+    return;
+  std::string fileName = composeOutputName(outputDir, "OUTPUT", "", req.dtime, ".h5");
+  hid_t plist_id = H5Pcreate(H5P_FILE_ACCESS);
+  H5Pset_fapl_mpio(plist_id, MPI_COMM_WORLD, ioInfo);
+  hdf5File = H5Fcreate(fileName.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, plist_id);
   H5Pclose(plist_id);
-  /*
-           * Create the dataspace for the dataset.
-           */
-  if (dimensionality == 1){
-    dimsf[0] = mygrid->uniquePoints[0];
+  if (hdf5File < 0){
+    printf("ERROR: cannot create %s\n", fileName.c_str());
+    exit(17);
   }
-  else if (dimensionality == 2){
-    dimsf[0] = mygrid->uniquePoints[1];
-    dimsf[1] = mygrid->uniquePoints[0];
+}
+
+void OUTPUT_MANAGER::closeHDF5File(){
+  if (hdf5File < 0)
+    return;
+  H5Fclose(hdf5File);
+  hdf5File = -1;
+}
+
+//the group of an output is named as its binary file, without directory and time
+hid_t OUTPUT_MANAGER::createHDF5Group(std::string fileName, request req){
+  openHDF5File(req);
+  std::string name = fileName.substr(fileName.find_last_of('/') + 1);
+  name = name.substr(0, name.find_last_of('_'));
+  hid_t group = H5Gcreate2(hdf5File, name.c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+  if (group < 0){
+    printf("ERROR: cannot create the HDF5 group %s\n", name.c_str());
+    exit(17);
+  }
+  writeHDF5Attribute(group, "time", H5T_NATIVE_DOUBLE, 1, &req.dtime);
+  writeHDF5Attribute(group, "step", H5T_NATIVE_INT, 1, &req.itime);
+  return group;
+}
+
+//chunk == NULL or an empty dataset: contiguous layout, without filters
+hid_t OUTPUT_MANAGER::createHDF5Dataset(hid_t group, const char *name, hid_t type, int rank, hsize_t *dims, hsize_t *chunk){
+  hid_t filespace = H5Screate_simple(rank, dims, NULL);
+  hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_fill_time(dcpl, H5D_FILL_TIME_NEVER);
+  bool empty = false;
+  for (int c = 0; c < rank; c++)
+    empty = empty || (dims[c] == 0);
+  if (chunk && !empty){
+    hsize_t chunkDims[3];
+    for (int c = 0; c < rank; c++)
+      chunkDims[c] = (chunk[c] < dims[c]) ? chunk[c] : dims[c];
+    H5Pset_chunk(dcpl, rank, chunkDims);
+    if (hdf5Deflate){
+      H5Pset_shuffle(dcpl);
+      H5Pset_deflate(dcpl, hdf5Deflate);
+    }
+  }
+  hid_t dataset = H5Dcreate2(group, name, type, filespace, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+  H5Pclose(dcpl);
+  H5Sclose(filespace);
+  return dataset;
+}
+
+//collective: every task calls it, with count = NULL if it has nothing to write
+void OUTPUT_MANAGER::writeHDF5Dataset(hid_t dataset, hid_t type, int rank, hsize_t *offset, hsize_t *count, const void *buf){
+  hid_t filespace = H5Dget_space(dataset);
+  hid_t memspace;
+  float dummy;
+  if (count){
+    memspace = H5Screate_simple(rank, count, NULL);
+    H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, NULL, count, NULL);
   }
   else{
-    dimsf[0] = mygrid->uniquePoints[2];
-    dimsf[1] = mygrid->uniquePoints[1];
-    dimsf[2] = mygrid->uniquePoints[0];
-
-  }
-  for (int i = 0; i < 6; i++)
-    filespace[i] = H5Screate_simple(dimensionality, dimsf, NULL);
-
-  /*
-       * Create the dataset with default properties and close filespace.
-       */
-  for (int i = 0; i < 6; i++){
-    dset_id[i] = H5Dcreate1(file_id, nomi[i], H5T_NATIVE_FLOAT, filespace[i],
-      H5P_DEFAULT);
-    H5Sclose(filespace[i]);
-  }
-  /*
-          * Each process defines dataset in memory and writes it to the hyperslab
-          * in the file.
-          */
-  if (dimensionality == 1){
-    offset[0] = mygrid->rproc_imin[0][mygrid->rmyid[0]];
-    count[0] = mygrid->uniquePointsloc[0];
-  }
-  else if (dimensionality == 2){
-    offset[1] = mygrid->rproc_imin[0][mygrid->rmyid[0]];
-    offset[0] = mygrid->rproc_imin[1][mygrid->rmyid[1]];
-    count[1] = mygrid->uniquePointsloc[0];
-    count[0] = mygrid->uniquePointsloc[1];
+    memspace = H5Screate(H5S_SCALAR);
+    H5Sselect_none(memspace);
+    H5Sselect_none(filespace);
+    buf = &dummy;
+  }
+  hid_t plist_id = H5Pcreate(H5P_DATASET_XFER);
+  H5Pset_dxpl_mpio(plist_id, H5FD_MPIO_COLLECTIVE);
+  H5Dwrite(dataset, type, memspace, filespace, plist_id, buf);
+  H5Pclose(plist_id);
+  H5Sclose(memspace);
+  H5Sclose(filespace);
+}
+
+void OUTPUT_MANAGER::writeHDF5Attribute(hid_t object, const char *name, hid_t type, int n, const void *values){
+  hsize_t dims = n;
+  hid_t space = H5Screate_simple(1, &dims, NULL);
+  hid_t attribute = H5Acreate2(object, name, type, space, H5P_DEFAULT, H5P_DEFAULT);
+  H5Awrite(attribute, type, values);
+  H5Aclose(attribute);
+  H5Sclose(space);
+}
+
+static int greatestCommonDivisor(int a, int b){
+  while (b){
+    int r = a % b;
+    a = b;
+    b = r;
+  }
+  return a;
+}
+
+//fields, densities, currents and accumulators of any domain: one dataset per component, (z,)(y,)x
+//ordered, and the sampled coordinates x(, y, z). Along each axis the chunk is the gcd of the offsets
+//and extents of the task boxes, so that no chunk is shared by two tasks; when the boxes are so uneven
+//that this chunk would be tiny, the largest task box is used and the shared chunks are left to HDF5
+void OUTPUT_MANAGER::writeGridFieldHDF5(std::string fileName, request req){
+  const char *names[3];
+  int Ncomp = 3;
+  if (req.type == OUT_E_FIELD){
+    names[0] = "Ex"; names[1] = "Ey"; names[2] = "Ez";
+  }
+  else if (req.type == OUT_B_FIELD){
+    names[0] = "Bx"; names[1] = "By"; names[2] = "Bz";
+  }
+  else if (req.type == OUT_CURRENT){
+    names[0] = "Jx"; names[1] = "Jy"; names[2] = "Jz";
   }
   else{
-    offset[2] = mygrid->rproc_imin[0][mygrid->rmyid[0]];
-    offset[1] = mygrid->rproc_imin[1][mygrid->rmyid[1]];
-    offset[0] = mygrid->rproc_imin[2][mygrid->rmyid[2]];
-    count[2] = mygrid->uniquePointsloc[0];
-    count[1] = mygrid->uniquePointsloc[1];
-    count[0] = mygrid->uniquePointsloc[2];
-  }
-  /*
-       * Select hyperslab in the file.
-       */
-  for (int i = 0; i < 6; i++){
-    memspace[i] = H5Screate_simple(dimensionality, count, NULL);
-    filespace[i] = H5Dget_space(dset_id[i]);
-    H5Sselect_hyperslab(filespace[i], H5S_SELECT_SET, offset, NULL, count, NULL);
+    Ncomp = 1;
+    names[0] = (req.type == OUT_SPEC_DENSITY) ? "rho" : "value";
   }
-  //+++++++++++ Start CPU Field Values  +++++++++++++++++++++
-    {
-      float *Ex, *Ey, *Ez, *Bx, *By, *Bz;
-      int Nx, Ny, Nz;
-      Nx = mygrid->uniquePointsloc[0];
-      Ny = mygrid->uniquePointsloc[1];
-      Nz = mygrid->uniquePointsloc[2];
-      int size = Nx*Ny*Nz;
-      Ex = new float[size];
-      Ey = new float[size];
-      Ez = new float[size];
-      Bx = new float[size];
-      By = new float[size];
-      Bz = new float[size];
-      for (int k = 0; k < Nz; k++)
-        for (int j = 0; j < Ny; j++)
-          for (int i = 0; i < Nx; i++){
-        Ex[i + j*Nx + k*Ny*Nx] = (float)myfield->VEB(0, i, j, k);
-        Ey[i + j*Nx + k*Ny*Nx] = (float)myfield->VEB(1, i, j, k);
-        Ez[i + j*Nx + k*Ny*Nx] = (float)myfield->VEB(2, i, j, k);
-        Bx[i + j*Nx + k*Ny*Nx] = (float)myfield->VEB(3, i, j, k);
-        By[i + j*Nx + k*Ny*Nx] = (float)myfield->VEB(4, i, j, k);
-        Bz[i + j*Nx + k*Ny*Nx] = (float)myfield->VEB(5, i, j, k);
-          }
-      /*
-          * Create property list for collective dataset write.
-          */
-      plist_id = H5Pcreate(H5P_DATASET_XFER);
-      H5Pset_dxpl_mpio(plist_id, H5FD_MPIO_COLLECTIVE);
-
-      status = H5Dwrite(dset_id[0], H5T_NATIVE_FLOAT, memspace[0], filespace[0],
-        plist_id, Ex);
-      status = H5Dwrite(dset_id[1], H5T_NATIVE_FLOAT, memspace[1], filespace[1],
-        plist_id, Ey);
-      status = H5Dwrite(dset_id[2], H5T_NATIVE_FLOAT, memspace[2], filespace[2],
-        plist_id, Ez);
-      status = H5Dwrite(dset_id[3], H5T_NATIVE_FLOAT, memspace[3], filespace[3],
-        plist_id, Bx);
-      status = H5Dwrite(dset_id[4], H5T_NATIVE_FLOAT, memspace[4], filespace[4],
-        plist_id, By);
-      status = H5Dwrite(dset_id[5], H5T_NATIVE_FLOAT, memspace[5], filespace[5],
-        plist_id, Bz);
-
-      delete[]Ex;
-      delete[]Ey;
-      delete[]Ez;
-      delete[]Bx;
-      delete[]By;
-      delete[]Bz;
-    }
-
-  for (int i = 0; i < 6; i++){
-    H5Dclose(dset_id[i]);
-    H5Sclose(filespace[i]);
-    H5Sclose(memspace[i]);
+  const char *axisNames[3] = { "x", "y", "z" };
+  int dimensionality = mygrid->accesso.dimensions;
+  outputPlan *plan = getOutputPlan(req.domain, PLAN_GRID);
+
+  int maxLocN[3];
+  for (int c = 0; c < 3; c++)
+    maxLocN[c] = plan->shouldIWrite ? plan->sampleLocN[c] : 0;
+  MPI_Allreduce(MPI_IN_PLACE, maxLocN, 3, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+  //as for the binary files, nothing is written when no task writes
+  if (maxLocN[0] * maxLocN[1] * maxLocN[2] == 0)
+    return;
+  hsize_t dims[3], chunk[3], offset[3], count[3];
+  for (int c = 0; c < dimensionality; c++){
+    int a = dimensionality - 1 - c;
+    dims[c] = plan->sampleN[a];
+    offset[c] = plan->remains[a] ? plan->sampleFirst[a] : 0;
+    count[c] = plan->sampleLocN[a];
   }
-  H5Pclose(plist_id);
-  H5Fclose(file_id);
-  delete[] nomefile;
-  //////////////////////////// END of collective binary file write
+  int boxGcd[3] = { 0, 0, 0 };
+  if (plan->shouldIWrite){
+    for (int c = 0; c < dimensionality; c++)
+      boxGcd[c] = greatestCommonDivisor((int)offset[c], (int)count[c]);
+  }
+  std::vector<int> allBoxGcd(3 * mygrid->nproc);
+  MPI_Allgather(boxGcd, 3, MPI_INT, &allBoxGcd[0], 3, MPI_INT, MPI_COMM_WORLD);
+  for (int c = 0; c < dimensionality; c++){
+    int g = 0;
+    for (int p = 0; p < mygrid->nproc; p++)
+      g = greatestCommonDivisor(g, allBoxGcd[3 * p + c]);
+    int a = dimensionality - 1 - c;
+    chunk[c] = (g * HDF5_MIN_CHUNK_FRACTION >= maxLocN[a]) ? g : maxLocN[a];
+  }
+
+  hid_t group = createHDF5Group(fileName, req);
+  std::vector<float> header(8 + plan->sampleN[0] + plan->sampleN[1] + plan->sampleN[2]);
+  packBigHeader(&header[0], plan, Ncomp);
+  float *coordinates = &header[8];
+  for (int a = 0; a < dimensionality; a++){
+    hsize_t n = plan->sampleN[a], first = 0;
+    hid_t dataset = createHDF5Dataset(group, axisNames[a], H5T_NATIVE_FLOAT, 1, &n, NULL);
+    writeHDF5Dataset(dataset, H5T_NATIVE_FLOAT, 1, &first, (mygrid->myid == 0) ? &n : NULL, coordinates);
+    H5Dclose(dataset);
+    coordinates += plan->sampleN[a];
+  }
+
+  int size = plan->sampleLocN[0] * plan->sampleLocN[1] * plan->sampleLocN[2];
+  std::vector<float> values, component;
+  if (plan->shouldIWrite){
+    values.resize(Ncomp*size + 1);
+    packCPUFieldValues(&values[0], plan, req);
+    component.resize(size + 1);
+  }
+  for (int c = 0; c < Ncomp; c++){
+    hid_t dataset = createHDF5Dataset(group, names[c], H5T_NATIVE_FLOAT, dimensionality, dims, chunk);
+    if (plan->shouldIWrite && size){
+      for (int n = 0; n < size; n++)
+        component[n] = values[c + Ncomp*n];
+      writeHDF5Dataset(dataset, H5T_NATIVE_FLOAT, dimensionality, offset, count, &component[0]);
+    }
+    else
+      writeHDF5Dataset(dataset, H5T_NATIVE_FLOAT, dimensionality, offset, NULL, NULL);
+    H5Dclose(dataset);
+  }
+  H5Gclose(group);
+}
+
+//one 1D dataset per phase space component, the particles of each task after those of the lower ranks
+void OUTPUT_MANAGER::writeSpecPhaseSpaceHDF5(std::string fileName, request req){
+  const char *names[7] = { "x", "y", "z", "px", "py", "pz", "w" };
+  SPECIE* spec = myspecies[req.target];
+  outDomain *domain = myDomains[req.domain];
+  int components = domain->phaseSpaceComponents;
+  if (!spec->amIWithMarker())
+    components &= ~PS_MARKER;
+  double weightScale = domain->particleStride / domain->sampleFraction;
+
+  std::vector<int> selected;
+  long long outputNPart = selectParticlesInSubdomain(req, selected), before = 0, total = 0, maxNPart = 0;
+  MPI_Exscan(&outputNPart, &before, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+  if (mygrid->myid == 0)
+    before = 0;
+  MPI_Allreduce(&outputNPart, &total, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+  MPI_Allreduce(&outputNPart, &maxNPart, 1, MPI_LONG_LONG, MPI_MAX, MPI_COMM_WORLD);
+
+  hid_t group = createHDF5Group(fileName, req);
+  hsize_t dims = total, chunk = (maxNPart < (1 << 20)) ? maxNPart : (1 << 20), offset = before, count = outputNPart;
+  if (chunk < 1)
+    chunk = 1;
+  std::vector<float> column(outputNPart + 1);
+  for (int c = 0; c < 7; c++){
+    if (!(components & (1 << c)))
+      continue;
+    for (long long n = 0; n < outputNPart; n++)
+      column[n] = (c < 6) ? (float)spec->ru(c, selected[n]) : (float)(spec->w(selected[n])*weightScale);
+    hid_t dataset = createHDF5Dataset(group, names[c], H5T_NATIVE_FLOAT, 1, &dims, &chunk);
+    if (total)
+      writeHDF5Dataset(dataset, H5T_NATIVE_FLOAT, 1, &offset, outputNPart ? &count : NULL, &column[0]);
+    H5Dclose(dataset);
+  }
+  if (components & PS_MARKER){
+    std::vector<long int> markers(outputNPart + 1);
+    for (long long n = 0; n < outputNPart; n++)
+      markers[n] = spec->marker(selected[n]);
+    hid_t dataset = createHDF5Dataset(group, "marker", H5T_NATIVE_LONG, 1, &dims, &chunk);
+    if (total)
+      writeHDF5Dataset(dataset, H5T_NATIVE_LONG, 1, &offset, outputNPart ? &count : NULL, &markers[0]);
+    H5Dclose(dataset);
+  }
+  H5Gclose(group);
+}
+
+//the reduced bins (on master_proc) as one dataset, last axis first; the axes are attributes of the group
+void OUTPUT_MANAGER::writeSpecHistogramHDF5(std::string fileName, request req, std::vector<double> &bins){
+  outHistogram *hist = myHistograms[req.target];
+  hsize_t dims[3], offset[3] = { 0, 0, 0 };
+  double ranges[6];
+  int quantity[3], weighted = hist->weighted;
+  for (int a = 0; a < hist->nAxes; a++){
+    quantity[a] = hist->quantity[a];
+    dims[hist->nAxes - 1 - a] = hist->nbins[a];
+    ranges[2 * a] = hist->range[a][0];
+    ranges[2 * a + 1] = hist->range[a][1];
+  }
+  hid_t group = createHDF5Group(fileName, req);
+  writeHDF5Attribute(group, "quantity", H5T_NATIVE_INT, hist->nAxes, quantity);
+  writeHDF5Attribute(group, "nbins", H5T_NATIVE_INT, hist->nAxes, hist->nbins);
+  writeHDF5Attribute(group, "range", H5T_NATIVE_DOUBLE, 2 * hist->nAxes, ranges);
+  writeHDF5Attribute(group, "weighted", H5T_NATIVE_INT, 1, &weighted);
+  hid_t dataset = createHDF5Dataset(group, "bins", H5T_NATIVE_DOUBLE, hist->nAxes, dims, dims);
+  writeHDF5Dataset(dataset, H5T_NATIVE_DOUBLE, hist->nAxes, offset, (mygrid->myid == mygrid->master_proc) ? dims : NULL, &bins[0]);
+  H5Dclose(dataset);
+  H5Gclose(group);
 }
 #endif
 
@@ -1090,7 +2464,6 @@ void OUTPUT_MANAGER::writeEBFieldDomain(std::string fileName, request req){
     + (uniqueN[0] + uniqueN[1] + uniqueN[2])*sizeof(float);
 
   MPI_File thefile;
-  MPI_Status status;
 
   char* nomefile = new char[fileName.size() + 1];
 
@@ -1098,7 +2471,7 @@ void OUTPUT_MANAGER::writeEBFieldDomain(std::string fileName, request req){
   sprintf(nomefile, "%s", fileName.c_str());
 
   if (shouldIWrite){
-    MPI_File_open(sliceCommunicator, nomefile, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &thefile);
+    MPI_File_open(sliceCommunicator, nomefile, MPI_MODE_CREATE | MPI_MODE_WRONLY, ioInfo, &thefile);
     int globalri[3];
     nearestInt(rr, ri, globalri);
     //+++++++++++ FILE HEADER  +++++++++++++++++++++
@@ -1113,7 +2486,7 @@ void OUTPUT_MANAGER::writeEBFieldDomain(std::string fileName, request req){
       itodo[5] = slice_rNproc[1];
       itodo[6] = slice_rNproc[2];
       itodo[7] = Ncomp;
-      MPI_File_write(thefile, itodo, 8, MPI_INT, &status);
+      outputWrite(thefile, itodo, 8, MPI_INT);
 
       float *fcir[3];
       for (int c = 0; c < 3; c++){
@@ -1124,9 +2497,9 @@ void OUTPUT_MANAGER::writeEBFieldDomain(std::string fileName, request req){
       }
       for (int c = 0; c < 3; c++){
         if (remains[c])
-          MPI_File_write(thefile, fcir[c], uniqueN[c], MPI_FLOAT, &status);
+          outputWrite(thefile, fcir[c], uniqueN[c], MPI_FLOAT);
         else
-          MPI_File_write(thefile, &fcir[c][globalri[c]], 1, MPI_FLOAT, &status);
+          outputWrite(thefile, &fcir[c][globalri[c]], 1, MPI_FLOAT);
       }
       for (int c = 0; c < 3; c++){
         delete[] fcir[c];
@@ -1160,7 +2533,7 @@ void OUTPUT_MANAGER::writeEBFieldDomain(std::string fileName, request req){
               itodo[c + 3] = 1;
             }
           }
-          MPI_File_write(thefile, itodo, 6, MPI_INT, &status);
+          outputWrite(thefile, itodo, 6, MPI_INT);
         }
     //+++++++++++ Start CPU Field Values  +++++++++++++++++++++
         {
@@ -1193,10 +2566,10 @@ void OUTPUT_MANAGER::writeEBFieldDomain(std::string fileName, request req){
               }
             }
           }
-          MPI_File_write(thefile, todo, size, MPI_FLOAT, &status);
+          outputWrite(thefile, todo, size, MPI_FLOAT);
           delete[]todo;
         }
-    MPI_File_close(&thefile);
+    outputClose(&thefile);
     delete[] nomefile;
     delete[] totUniquePoints;
   }
@@ -1214,56 +2587,46 @@ void OUTPUT_MANAGER::prepareIntegerBigHeader(int *itodo, int uniqueN[3], int sli
   itodo[7] = Ncomp;
 }
 
-void OUTPUT_MANAGER::prepareFloatCoordinatesHeader(float *fcir[3], int uniqueN[3], int imin[]){
+//with block averages the coordinate of a sample is the centre of its block
+void OUTPUT_MANAGER::prepareFloatCoordinatesHeader(float *fcir[3], int uniqueN[3], int imin[], int decimation[3], bool average){
   for (int c = 0; c < 3; c++){
-    for (int m = 0; m < uniqueN[c]; m++){
-      fcir[c][m] = (float)mygrid->cir[c][m + imin[c]];
+    int s = decimation[c];
+    for (int m = 0; m*s < uniqueN[c]; m++){
+      int last = m*s;
+      if (average)
+        last = ((m*s + s < uniqueN[c]) ? (m*s + s) : uniqueN[c]) - 1;
+      fcir[c][m] = (float)(0.5*(mygrid->cir[c][m*s + imin[c]] + mygrid->cir[c][last + imin[c]]));
     }
   }
 }
-void OUTPUT_MANAGER::writeBigHeader(MPI_File thefile, int uniqueN[3], int imin[3], int slice_rNproc[3], int Ncomp){
-  MPI_Status status;
+int OUTPUT_MANAGER::packBigHeader(float *block, outputPlan *plan, int Ncomp){
   int itodo[8];
+  int *sampleN = plan->sampleN;
   float *fcir[3];
-  for (int c = 0; c < 3; c++){
-    fcir[c] = new float[uniqueN[c]];
-  }
-  prepareIntegerBigHeader(itodo, uniqueN, slice_rNproc, Ncomp);
-  prepareFloatCoordinatesHeader(fcir, uniqueN, imin);
-
-  MPI_File_write(thefile, itodo, 8, MPI_INT, &status);
-  for (int c = 0; c < 3; c++){
-    MPI_File_write(thefile, fcir[c], uniqueN[c], MPI_FLOAT, &status);
-  }
-
-  for (int c = 0; c < 3; c++){
-    delete[] fcir[c];
-  }
-
+  fcir[0] = block + 8;
+  fcir[1] = fcir[0] + sampleN[0];
+  fcir[2] = fcir[1] + sampleN[1];
+  prepareIntegerBigHeader(itodo, sampleN, plan->slice_rNproc, Ncomp);
+  prepareFloatCoordinatesHeader(fcir, plan->uniqueN, plan->imin, plan->decimation, plan->average);
+  memcpy(block, itodo, 8 * sizeof(int));
+  return 8 + sampleN[0] + sampleN[1] + sampleN[2];
 }
 
 
-void OUTPUT_MANAGER::prepareIntegerSmallHeader(int *itodo, int uniqueLocN[], int imin[3], int remains[3]){
-  for (int c = 0; c<3; c++){
-    if (remains[c]){
-      if (mygrid->rproc_imin[c][mygrid->rmyid[c]]>imin[c])
-        itodo[c] = mygrid->rproc_imin[c][mygrid->rmyid[c]] - imin[c];
-      else
-        itodo[c] = 0;
-      itodo[c + 3] = uniqueLocN[c];
+int OUTPUT_MANAGER::packSmallHeader(float *block, outputPlan *plan){
+  int itodo[6];
+  for (int c = 0; c < 3; c++){
+    if (plan->remains[c]){
+      itodo[c] = plan->sampleFirst[c];
+      itodo[c + 3] = plan->sampleLocN[c];
     }
     else{
       itodo[c] = 0;
       itodo[c + 3] = 1;
     }
   }
-}
-
-void OUTPUT_MANAGER::writeSmallHeader(MPI_File thefile, int uniqueLocN[], int imin[], int remains[]){
-  MPI_Status status;
-  int itodo[6];
-  prepareIntegerSmallHeader(itodo, uniqueLocN, imin, remains);
-  MPI_File_write(thefile, itodo, 6, MPI_INT, &status);
+  memcpy(block, itodo, 6 * sizeof(int));
+  return 6;
 }
 void OUTPUT_MANAGER::prepareFloatField(float *todo, int NN[3], int origin[3], request req){
   int offset = 0, Ncomp = 3;
@@ -1300,7 +2663,22 @@ void OUTPUT_MANAGER::prepareFloatField(float *todo, int NN[3], int origin[3], re
         jj = j + origin[1];
         for (int i = 0; i < Nx; i++){
           ii = i + origin[0];
-          todo[i + j*Nx + k*Ny*Nx] = (float)mycurrent->density(ii, jj, kk);
+          todo[i + j*Nx + k*Ny*Nx] = (float)densityScratch.JJ(densityComp[req.target], ii, jj, kk);
+        }
+      }
+    }
+  }
+  else if (req.type == OUT_FIELD_ACCUMULATOR){
+    accumulatorOutput &accum = myAccumulators[req.target];
+    int *Nloc = mygrid->Nloc;
+    double factor = accum.acc->average ? 1.0 / accum.samples : accum.everySteps*mygrid->dt;
+    for (int k = 0; k < Nz; k++){
+      kk = k + origin[2];
+      for (int j = 0; j < Ny; j++){
+        jj = j + origin[1];
+        for (int i = 0; i < Nx; i++){
+          ii = i + origin[0];
+          todo[i + j*Nx + k*Ny*Nx] = (float)(factor*accum.values[ii + Nloc[0] * (jj + Nloc[1] * kk)]);
         }
       }
     }
@@ -1314,7 +2692,7 @@ void OUTPUT_MANAGER::prepareFloatField(float *todo, int NN[3], int origin[3], re
         for (int i = 0; i < Nx; i++){
           ii = i + origin[0];
           for (int c = 0; c < Ncomp; c++)
-            todo[c + i*Ncomp + j*Nx + k*Ny*Nx] = (float)mycurrent->JJ(c, ii, jj, kk);
+            todo[c + i*Ncomp + j*Nx*Ncomp + k*Ny*Nx*Ncomp] = (float)mycurrent->JJ(c, ii, jj, kk);
         }
       }
     }
@@ -1322,18 +2700,6 @@ void OUTPUT_MANAGER::prepareFloatField(float *todo, int NN[3], int origin[3], re
 
 }
 
-void OUTPUT_MANAGER::findDispForSetView(MPI_Offset *disp, int myOutputID, int *totUniquePoints, int big_header, int small_header, int Ncomp){
-  MPI_Offset mydisp = big_header;
-  for (int rank = 0; rank < myOutputID; rank++)
-    mydisp += small_header + totUniquePoints[rank] * sizeof(float)*Ncomp;
-  if (mydisp < 0){
-    std::cout << "a problem occurred when trying to mpi_file_set_view in writeEMFieldBinary" << std::endl;
-    std::cout << "myrank=" << mygrid->myid << " disp=" << mydisp << std::endl;
-    exit(33);
-  }
-  disp[0] = mydisp;
-}
-
 void OUTPUT_MANAGER::setLocalOutputOffset(int *origin, int locimin[], int ri[], int remains[]){
   for (int c = 0; c < 3; c++){
     if (remains[c]){
@@ -1345,117 +2711,319 @@ void OUTPUT_MANAGER::setLocalOutputOffset(int *origin, int locimin[], int ri[],
   }
 }
 
-void OUTPUT_MANAGER::writeCPUFieldValues(MPI_File thefile, int uniqueLocN[], int locimin[], int remains[3], request req){
-  MPI_Status status;
+int OUTPUT_MANAGER::packCPUFieldValues(float *block, outputPlan *plan, request req){
   int Ncomp = 3;
   if ((req.type == OUT_E_FIELD) || (req.type == OUT_B_FIELD))
     Ncomp = 3;
-  else if (req.type == OUT_SPEC_DENSITY)
+  else if (req.type == OUT_SPEC_DENSITY || req.type == OUT_FIELD_ACCUMULATOR)
     Ncomp = 1;
   else if (req.type == OUT_CURRENT)
     Ncomp = 3;
 
   int origin[3];
-  int size = Ncomp*uniqueLocN[0] * uniqueLocN[1] * uniqueLocN[2];
-  float *todo;
-  todo = new float[size];
-  int ri[3], globalri[3];
-  nearestInt(myDomains[req.domain]->coordinates, ri, globalri);
+  setLocalOutputOffset(origin, plan->locimin, plan->ri, plan->remains);
+  if (plan->decimation[0] == 1 && plan->decimation[1] == 1 && plan->decimation[2] == 1){
+    prepareFloatField(block, plan->uniqueLocN, origin, req);
+  }
+  else{
+    float *fine = new float[Ncomp*plan->uniqueLocN[0] * plan->uniqueLocN[1] * plan->uniqueLocN[2]];
+    prepareFloatField(fine, plan->uniqueLocN, origin, req);
+    decimateFieldValues(block, fine, plan, Ncomp);
+    delete[] fine;
+  }
+  return Ncomp*plan->sampleLocN[0] * plan->sampleLocN[1] * plan->sampleLocN[2];
+}
+
+void OUTPUT_MANAGER::decimateFieldValues(float *block, float *fine, outputPlan *plan, int Ncomp){
+  int *N = plan->uniqueLocN, *Ns = plan->sampleLocN;
+  if (!plan->average){
+    int off[3];
+    for (int c = 0; c < 3; c++)
+      off[c] = plan->sampleFirst[c] * plan->decimation[c] - plan->fineFirst[c];
+    for (int k = 0; k < Ns[2]; k++){
+      int kk = off[2] + k*plan->decimation[2];
+      for (int j = 0; j < Ns[1]; j++){
+        int jj = off[1] + j*plan->decimation[1];
+        for (int i = 0; i < Ns[0]; i++){
+          int ii = off[0] + i*plan->decimation[0];
+          for (int c = 0; c < Ncomp; c++)
+            block[c + Ncomp*(i + Ns[0] * (j + Ns[1] * k))] = fine[c + Ncomp*(ii + N[0] * (jj + N[1] * kk))];
+        }
+      }
+    }
+    return;
+  }
+  int dims[3] = { N[0], N[1], N[2] };
+  std::vector<double> values(fine, fine + Ncomp*N[0] * N[1] * N[2]);
+  for (int axis = 0; axis < 3; axis++){
+    if (plan->decimation[axis] > 1)
+      averageAlongAxis(values, dims, axis, plan, Ncomp);
+  }
+  for (size_t n = 0; n < values.size(); n++)
+    block[n] = (float)values[n];
+}
 
-  setLocalOutputOffset(origin, locimin, ri, remains);
-  prepareFloatField(todo, uniqueLocN, origin, req);
-  MPI_File_write(thefile, todo, size, MPI_FLOAT, &status);
-  delete[]todo;
+int OUTPUT_MANAGER::findBlockOwner(std::vector<int> &qStart, std::vector<int> &qEnd, int point){
+  for (size_t q = 0; q < qStart.size(); q++){
+    if (qStart[q] <= point && point < qEnd[q])
+      return q;
+  }
+  return -1;
+}
+
+//blocks are aligned to the domain, not to the tasks: the partial sums of a block which starts
+//on a lower task along this axis are sent to that task (the block owner)
+void OUTPUT_MANAGER::averageAlongAxis(std::vector<double> &values, int dims[3], int axis, outputPlan *plan, int Ncomp){
+  int s = plan->decimation[axis];
+  int first = plan->fineFirst[axis];
+  int kLo = first / s, kHi = (first + dims[axis] - 1) / s;
+  int nb = kHi - kLo + 1;
+  int lead = (first % s) ? 1 : 0;
+
+  int stride[3] = { Ncomp, Ncomp*dims[0], Ncomp*dims[0] * dims[1] };
+  int newDims[3] = { dims[0], dims[1], dims[2] };
+  newDims[axis] = nb;
+  int newStride[3] = { Ncomp, Ncomp*newDims[0], Ncomp*newDims[0] * newDims[1] };
+  int other1 = (axis + 1) % 3, other2 = (axis + 2) % 3;
+  int planeSize = Ncomp*dims[other1] * dims[other2];
+
+  std::vector<double> sums(Ncomp*newDims[0] * newDims[1] * newDims[2], 0.0);
+  for (int m = 0; m < dims[axis]; m++){
+    int slot = (first + m) / s - kLo;
+    for (int b = 0; b < dims[other2]; b++)
+      for (int a = 0; a < dims[other1]; a++)
+        for (int c = 0; c < Ncomp; c++)
+          sums[c + slot*newStride[axis] + a*newStride[other1] + b*newStride[other2]] +=
+          values[c + m*stride[axis] + a*stride[other1] + b*stride[other2]];
+  }
+
+  //ranges of the writing tasks along this axis, as offsets from imin (empty for the others)
+  int nproc = mygrid->rnproc[axis], me = mygrid->rmyid[axis];
+  std::vector<int> &qStart = plan->lineStart[axis], &qEnd = plan->lineEnd[axis];
+  int total = 0;
+  for (int q = 0; q < nproc; q++)
+    total = (qEnd[q] > total) ? qEnd[q] : total;
+  int coords[3] = { mygrid->rmyid[0], mygrid->rmyid[1], mygrid->rmyid[2] };
+  std::vector<MPI_Request> requests;
+  std::vector<double> sendPlane, recvPlanes;
+  std::vector<int> recvSlots, recvFrom;
+  for (int q = me + 1; q < nproc; q++){
+    if (qStart[q] < qEnd[q] && (qStart[q] % s) && findBlockOwner(qStart, qEnd, (qStart[q] / s)*s) == me){
+      recvSlots.push_back(qStart[q] / s - kLo);
+      recvFrom.push_back(q);
+    }
+  }
+  recvPlanes.resize(recvSlots.size()*planeSize);
+  requests.resize(recvSlots.size() + 1, MPI_REQUEST_NULL);
+  for (size_t r = 0; r < recvSlots.size(); r++){
+    int rank;
+    coords[axis] = recvFrom[r];
+    MPI_Cart_rank(mygrid->cart_comm, coords, &rank);
+    MPI_Irecv(&recvPlanes[r*planeSize], planeSize, MPI_DOUBLE, rank, 40 + axis, mygrid->cart_comm, &requests[r]);
+  }
+  int owner = findBlockOwner(qStart, qEnd, kLo*s);
+  if (lead && owner >= 0){
+    sendPlane.resize(planeSize);
+    for (int b = 0, n = 0; b < dims[other2]; b++)
+      for (int a = 0; a < dims[other1]; a++)
+        for (int c = 0; c < Ncomp; c++)
+          sendPlane[n++] = sums[c + a*newStride[other1] + b*newStride[other2]];
+    int rank;
+    coords[axis] = owner;
+    MPI_Cart_rank(mygrid->cart_comm, coords, &rank);
+    MPI_Isend(&sendPlane[0], planeSize, MPI_DOUBLE, rank, 40 + axis, mygrid->cart_comm, &requests[recvSlots.size()]);
+  }
+  MPI_Waitall(requests.size(), &requests[0], MPI_STATUSES_IGNORE);
+  for (size_t r = 0; r < recvSlots.size(); r++){
+    for (int b = 0, n = 0; b < dims[other2]; b++)
+      for (int a = 0; a < dims[other1]; a++)
+        for (int c = 0; c < Ncomp; c++)
+          sums[c + recvSlots[r] * newStride[axis] + a*newStride[other1] + b*newStride[other2]] += recvPlanes[r*planeSize + n++];
+  }
+
+  //the owned blocks are normalised and the partial leading block dropped
+  dims[axis] = nb - lead;
+  int outStride[3] = { Ncomp, Ncomp*dims[0], Ncomp*dims[0] * dims[1] };
+  values.assign(Ncomp*dims[0] * dims[1] * dims[2], 0.0);
+  for (int m = 0; m < dims[axis]; m++){
+    int k = kLo + lead + m;
+    int blockEnd = (k*s + s < total) ? (k*s + s) : total;
+    double weight = 1.0 / (blockEnd - k*s);
+    for (int b = 0; b < dims[other2]; b++)
+      for (int a = 0; a < dims[other1]; a++)
+        for (int c = 0; c < Ncomp; c++)
+          values[c + m*outStride[axis] + a*outStride[other1] + b*outStride[other2]] =
+          weight*sums[c + (m + lead)*newStride[axis] + a*newStride[other1] + b*newStride[other2]];
+  }
 }
 
 void OUTPUT_MANAGER::writeGridFieldSubDomain(std::string fileName, request req){
+#if defined(USE_HDF5)
+  if (hdf5Output){
+    writeGridFieldHDF5(fileName, req);
+    return;
+  }
+#endif
   int Ncomp = 3;
   if ((req.type == OUT_E_FIELD) || (req.type == OUT_B_FIELD))
     Ncomp = 3;
-  else if (req.type == OUT_SPEC_DENSITY)
+  else if (req.type == OUT_SPEC_DENSITY || req.type == OUT_FIELD_ACCUMULATOR)
     Ncomp = 1;
   else if (req.type == OUT_CURRENT)
     Ncomp = 3;
 
-  int *totUniquePoints;
-  int isInMyHyperplane = false, shouldIWrite = false;
-  int uniqueN[3], uniqueLocN[3], slice_rNproc[3];
-  int remains[3];
-  int imin[3], imax[3], locimin[3], locimax[3];
-
-  setAndCheckRemains(remains, myDomains[req.domain]->remainingCoord);
-  findGlobalIntegerBoundaries(myDomains[req.domain]->rmin, myDomains[req.domain]->rmax, imin, imax);
-  findLocalIntegerBoundaries(myDomains[req.domain]->rmin, myDomains[req.domain]->rmax, locimin, locimax);
-  findNumberOfProcsWithinSubdomain(slice_rNproc, imin, imax, remains);
-
-  findGlobalSubdomainUniquePointsNumber(uniqueN, imin, imax, remains);
-  findLocalSubdomainUniquePointsNumber(uniqueLocN, locimin, locimax, remains);
-
-  isInMyHyperplane = isThePointInMyDomain(myDomains[req.domain]->coordinates);
-
-  MPI_Comm sliceCommunicator;
-  int mySliceID, sliceNProc;
-  MPI_Cart_sub(mygrid->cart_comm, remains, &sliceCommunicator);
-  MPI_Comm_rank(sliceCommunicator, &mySliceID);
-  MPI_Comm_size(sliceCommunicator, &sliceNProc);
-  MPI_Allreduce(MPI_IN_PLACE, &isInMyHyperplane, 1, MPI_INT, MPI_LOR, sliceCommunicator);
-
-  if (isInMyHyperplane)
-    shouldIWrite = amIInTheSubDomain(req);
+  if (myDomains[req.domain]->compression != COMPRESSION_NONE){
+    writeCompressedGridFieldSubDomain(fileName, req);
+    return;
+  }
 
-  MPI_Comm outputCommunicator;
-  MPI_Comm_split(mygrid->cart_comm, shouldIWrite, 0, &outputCommunicator);
-  int myOutputID, outputNProc;
-  MPI_Comm_rank(outputCommunicator, &myOutputID);
-  MPI_Comm_size(outputCommunicator, &outputNProc);
+  outputPlan *plan = getOutputPlan(req.domain, PLAN_GRID);
 
-  totUniquePoints = new int[outputNProc];
-  totUniquePoints[myOutputID] = uniqueLocN[0] * uniqueLocN[1] * uniqueLocN[2];
-  MPI_Allgather(MPI_IN_PLACE, 1, MPI_INT, totUniquePoints, 1, MPI_INT, outputCommunicator);
-
-  MPI_Offset disp = 0;
   const int smallHeaderSize = (3+3) * sizeof(int);
-  const int bigHeaderSize = (1+3+3+1)*sizeof(int) + (uniqueN[0] + uniqueN[1] + uniqueN[2])*sizeof(float);
+  const int bigHeaderSize = (1+3+3+1)*sizeof(int) + (plan->sampleN[0] + plan->sampleN[1] + plan->sampleN[2])*sizeof(float);
+  MPI_Offset disp = 0;
+  if (plan->myOutputID != 0)
+    disp = bigHeaderSize + (MPI_Offset)plan->myOutputID*smallHeaderSize + plan->pointsBefore*sizeof(float)*Ncomp;
+
+  if (plan->shouldIWrite){
+    //each task packs its headers and values in one block, written with a single collective call
+    int blockSize = (smallHeaderSize / sizeof(int)) + Ncomp*plan->sampleLocN[0] * plan->sampleLocN[1] * plan->sampleLocN[2];
+    if (plan->myOutputID == 0)
+      blockSize += bigHeaderSize / sizeof(float);
+    float *block = new float[blockSize];
+    int pos = 0;
+    if (plan->myOutputID == 0)
+      pos += packBigHeader(block, plan, Ncomp);
+    int *box = (int*)(block + pos);
+    pos += packSmallHeader(block + pos, plan);
+    pos += packCPUFieldValues(block + pos, plan, req);
+
+    writeOutputBlocks(fileName, plan, disp, block, pos, MPI_FLOAT, box);
+    delete[] block;
+  }
+}
 
-  MPI_File thefile;
-  char* nomefile = new char[fileName.length() + 1];
-  strcpy(nomefile, fileName.c_str());
 
-  if (shouldIWrite){
-    MPI_File_open(outputCommunicator, nomefile, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &thefile);
+//.zbin layout: the .bin big header, then int codec, chunkSize[3], nChunks and double tolerance,
+//then nChunks chunkIndexEntry (global sample offset and size of the box, position and length of
+//its payload) and the payloads. Each task cuts its own block in chunks, so that any sub-box can
+//be read by decompressing only the chunks it overlaps.
+void OUTPUT_MANAGER::writeCompressedGridFieldSubDomain(std::string fileName, request req){
+  int Ncomp = 3;
+  if ((req.type == OUT_E_FIELD) || (req.type == OUT_B_FIELD))
+    Ncomp = 3;
+  else if (req.type == OUT_SPEC_DENSITY || req.type == OUT_FIELD_ACCUMULATOR)
+    Ncomp = 1;
+  else if (req.type == OUT_CURRENT)
+    Ncomp = 3;
 
-    if (myOutputID == 0){
-      MPI_File_set_view(thefile, 0, MPI_FLOAT, MPI_FLOAT, (char *) "native", MPI_INFO_NULL);
-      writeBigHeader(thefile, uniqueN, imin, slice_rNproc, Ncomp);
-    }
-    else{
-      findDispForSetView(&disp, myOutputID, totUniquePoints, bigHeaderSize, smallHeaderSize, Ncomp);
-      MPI_File_set_view(thefile, disp, MPI_FLOAT, MPI_FLOAT, (char *) "native", MPI_INFO_NULL);
+  outDomain *domain = myDomains[req.domain];
+  outputPlan *plan = getOutputPlan(req.domain, PLAN_GRID);
+  if (!plan->shouldIWrite)
+    return;
+
+  int *N = plan->sampleLocN;
+  std::vector<float> values(Ncomp*N[0] * N[1] * N[2] + 1);
+  packCPUFieldValues(&values[0], plan, req);
+
+  int nc[3];
+  for (int c = 0; c < 3; c++)
+    nc[c] = (N[c] + domain->chunkSize[c] - 1) / domain->chunkSize[c];
+  int nChunks = nc[0] * nc[1] * nc[2];
+  std::vector< std::vector<char> > payloads(nChunks);
+  std::vector<chunkIndexEntry> index(nChunks);
+
+#pragma omp parallel for schedule(dynamic)
+  for (int q = 0; q < nChunks; q++){
+    int cq[3] = { q % nc[0], (q / nc[0]) % nc[1], q / (nc[0] * nc[1]) };
+    int first[3], n[3];
+    for (int c = 0; c < 3; c++){
+      first[c] = cq[c] * domain->chunkSize[c];
+      n[c] = (first[c] + domain->chunkSize[c] < N[c]) ? domain->chunkSize[c] : (N[c] - first[c]);
+      index[q].offset[c] = (plan->remains[c] ? plan->sampleFirst[c] : 0) + first[c];
+      index[q].n[c] = n[c];
     }
+    std::vector<float> chunk(Ncomp*n[0] * n[1] * n[2]);
+    for (int k = 0; k < n[2]; k++)
+      for (int j = 0; j < n[1]; j++)
+        for (int i = 0; i < n[0]; i++)
+          for (int c = 0; c < Ncomp; c++)
+            chunk[c + Ncomp*(i + n[0] * (j + n[1] * k))] =
+            values[c + Ncomp*((first[0] + i) + N[0] * ((first[1] + j) + N[1] * (first[2] + k)))];
+    compressFieldChunk(payloads[q], &chunk[0], n, Ncomp, domain->compression, domain->compressionTolerance);
+    index[q].bytes = payloads[q].size();
+  }
 
-    writeSmallHeader(thefile, uniqueLocN, imin, remains);
-    writeCPUFieldValues(thefile, uniqueLocN, locimin, remains, req);
+  MPI_Offset myBytes = 0, bytesBefore = 0;
+  for (int q = 0; q < nChunks; q++)
+    myBytes += index[q].bytes;
+  MPI_Exscan(&myBytes, &bytesBefore, 1, MPI_OFFSET, MPI_SUM, plan->outputCommunicator);
+  if (plan->myOutputID == 0)
+    bytesBefore = 0;
+  int totChunks;
+  MPI_Allreduce(&nChunks, &totChunks, 1, MPI_INT, MPI_SUM, plan->outputCommunicator);
+
+  const int bigHeaderSize = (1 + 3 + 3 + 1)*sizeof(int) + (plan->sampleN[0] + plan->sampleN[1] + plan->sampleN[2])*sizeof(float);
+  const int chunkHeaderSize = 5 * sizeof(int) + sizeof(double);
+  MPI_Offset dataStart = bigHeaderSize + chunkHeaderSize + (MPI_Offset)totChunks*sizeof(chunkIndexEntry);
+  MPI_Offset pos = dataStart + bytesBefore;
+  for (int q = 0; q < nChunks; q++){
+    index[q].fileOffset = pos;
+    pos += index[q].bytes;
+  }
 
-    MPI_File_close(&thefile);
+  //the index is gathered on the first task, which writes it together with the header
+  int outputNProc;
+  MPI_Comm_size(plan->outputCommunicator, &outputNProc);
+  std::vector<int> indexBytes(outputNProc), indexDispl(outputNProc, 0);
+  int myIndexBytes = nChunks*sizeof(chunkIndexEntry);
+  MPI_Gather(&myIndexBytes, 1, MPI_INT, &indexBytes[0], 1, MPI_INT, 0, plan->outputCommunicator);
+  for (int rank = 1; rank < outputNProc; rank++)
+    indexDispl[rank] = indexDispl[rank - 1] + indexBytes[rank - 1];
+
+  int blockSize = (int)myBytes;
+  if (plan->myOutputID == 0)
+    blockSize += (int)dataStart;
+  char *block = new char[blockSize + 1];
+  char *data = block;
+  if (plan->myOutputID == 0){
+    packBigHeader((float*)block, plan, Ncomp);
+    int itodo[5] = { domain->compression, domain->chunkSize[0], domain->chunkSize[1], domain->chunkSize[2], totChunks };
+    memcpy(block + bigHeaderSize, itodo, sizeof(itodo));
+    memcpy(block + bigHeaderSize + sizeof(itodo), &domain->compressionTolerance, sizeof(double));
+    data = block + dataStart;
   }
-  MPI_Comm_free(&sliceCommunicator);
-  MPI_Comm_free(&outputCommunicator);
-  delete[] nomefile;
-  delete[] totUniquePoints;
+  char *indexBlock = (plan->myOutputID == 0) ? (block + bigHeaderSize + chunkHeaderSize) : NULL;
+  MPI_Gatherv(nChunks ? &index[0] : NULL, myIndexBytes, MPI_BYTE, indexBlock,
+    &indexBytes[0], &indexDispl[0], MPI_BYTE, 0, plan->outputCommunicator);
+  for (int q = 0; q < nChunks; q++){
+    memcpy(data, &payloads[q][0], index[q].bytes);
+    data += index[q].bytes;
+  }
+
+  int box[6];
+  packSmallHeader((float*)box, plan);
+  writeOutputBlocks(fileName, plan, (plan->myOutputID == 0) ? 0 : dataStart + bytesBefore, block, blockSize, MPI_BYTE, box);
+  delete[] block;
 }
 
+std::string OUTPUT_MANAGER::gridOutputExtension(int domain){
+  if (myDomains[domain]->compression != COMPRESSION_NONE)
+    return ".zbin";
+  return ".bin";
+}
 
 void OUTPUT_MANAGER::callEMFieldDomain(request req){
 
   if (req.type == OUT_E_FIELD){
-    std::string nameBin = composeOutputName(outputDir, "E_FIELD", myDomains[req.domain]->name, "", req.domain, req.dtime, ".bin");
+    std::string nameBin = composeOutputName(outputDir, "E_FIELD", myDomains[req.domain]->name, "", req.domain, req.dtime, gridOutputExtension(req.domain));
 //    if (!myDomains[req.domain]->subselection)
 //      writeEBFieldDomain(nameBin, req);
 //    else
       writeGridFieldSubDomain(nameBin, req);
   }
   else if (req.type == OUT_B_FIELD){
-    std::string nameBin = composeOutputName(outputDir, "B_FIELD", myDomains[req.domain]->name, "", req.domain, req.dtime, ".bin");
+    std::string nameBin = composeOutputName(outputDir, "B_FIELD", myDomains[req.domain]->name, "", req.domain, req.dtime, gridOutputExtension(req.domain));
 //    if (!myDomains[req.domain]->subselection)
 //      writeEBFieldDomain(nameBin, req);
 //    else
@@ -1617,6 +3185,18 @@ void OUTPUT_MANAGER::callEMFieldProbe(request req){
     if (mygrid->accesso.dimensions < 2 || (rr[1] >= mygrid->rminloc[1] && rr[1] < mygrid->rmaxloc[1])){
       if (mygrid->accesso.dimensions < 3 || (rr[2] >= mygrid->rminloc[2] && rr[2] < mygrid->rmaxloc[2])){
         interpolateEBFieldsToPosition(rr, EE, BB);
+        if (probeFlushSteps){
+          probeRecord record;
+          record.probe = req.domain;
+          record.itime = req.itime;
+          record.time = req.dtime;
+          for (int c = 0; c < 3; c++){
+            record.EB[c] = (float)EE[c];
+            record.EB[c + 3] = (float)BB[c];
+          }
+          probeBuffer.push_back(record);
+          return;
+        }
         std::ofstream of0;
         of0.open(myEMProbes[req.domain]->fileName.c_str(), std::ios::app);
         of0 << " " << std::setw(diagNarrowWidth) << req.itime << " " << std::setw(diagWidth) << req.dtime;
@@ -1635,6 +3215,58 @@ void OUTPUT_MANAGER::callEMFieldProbe(request req){
 
 
 
+//header: int endian, int number of probes, then their coordinates (3 doubles each);
+//then one probeRecord (int probe, int itime, double time, 6 floats E, B) per sample
+void OUTPUT_MANAGER::openProbeFile(std::string fileName){
+  probeFile.open(fileName.c_str(), std::ofstream::binary | std::ofstream::trunc);
+  int itodo[2] = { is_big_endian(), (int)myEMProbes.size() };
+  probeFile.write((char*)itodo, sizeof(itodo));
+  for (std::vector<emProbe*>::iterator it = myEMProbes.begin(); it != myEMProbes.end(); it++)
+    probeFile.write((char*)(*it)->coordinates, 3 * sizeof(double));
+}
+
+static bool probeRecordComp(const probeRecord &first, const probeRecord &second){
+  if (first.itime != second.itime)
+    return (first.itime < second.itime);
+  return (first.probe < second.probe);
+}
+
+//collective when the samples are gathered in a single file
+void OUTPUT_MANAGER::flushProbeBuffer(){
+  if (!probeFlushSteps)
+    return;
+  probeBufferedSteps = 0;
+  if (!probeGather){
+    if (probeBuffer.empty())
+      return;
+    if (!probeFile.is_open()){
+      std::stringstream ss0;
+      ss0 << outputDir << "/EMProbes_" << mygrid->myid << ".bin";
+      openProbeFile(ss0.str());
+    }
+    probeFile.write((char*)&probeBuffer[0], probeBuffer.size()*sizeof(probeRecord));
+    probeFile.flush();
+    probeBuffer.clear();
+    return;
+  }
+
+  bool amIMaster = (mygrid->myid == mygrid->master_proc);
+  int myBytes = probeBuffer.size()*sizeof(probeRecord);
+  std::vector<int> counts(mygrid->nproc), displs(mygrid->nproc, 0);
+  MPI_Gather(&myBytes, 1, MPI_INT, &counts[0], 1, MPI_INT, mygrid->master_proc, MPI_COMM_WORLD);
+  for (int rank = 1; rank < mygrid->nproc; rank++)
+    displs[rank] = displs[rank - 1] + counts[rank - 1];
+  int total = amIMaster ? (displs[mygrid->nproc - 1] + counts[mygrid->nproc - 1]) / sizeof(probeRecord) : 0;
+  std::vector<probeRecord> all(total + 1);
+  MPI_Gatherv(probeBuffer.size() ? &probeBuffer[0] : NULL, myBytes, MPI_BYTE, &all[0], &counts[0], &displs[0], MPI_BYTE, mygrid->master_proc, MPI_COMM_WORLD);
+  probeBuffer.clear();
+  if (amIMaster && total){
+    std::sort(all.begin(), all.begin() + total, probeRecordComp);
+    probeFile.write((char*)&all[0], total*sizeof(probeRecord));
+    probeFile.flush();
+  }
+}
+
 void OUTPUT_MANAGER::writeSpecDensity(std::string fileName, request req){
   int Ncomp = 1;//myfield->getNcomp();
   int *totUniquePoints;
@@ -1696,7 +3328,6 @@ void OUTPUT_MANAGER::writeSpecDensity(std::string fileName, request req){
     + (uniqueN[0] + uniqueN[1] + uniqueN[2])*sizeof(float);
 
   MPI_File thefile;
-  MPI_Status status;
 
   char* nomefile = new char[fileName.size() + 1];
 
@@ -1704,7 +3335,7 @@ void OUTPUT_MANAGER::writeSpecDensity(std::string fileName, request req){
   sprintf(nomefile, "%s", fileName.c_str());
 
   if (shouldIWrite){
-    MPI_File_open(sliceCommunicator, nomefile, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &thefile);
+    MPI_File_open(sliceCommunicator, nomefile, MPI_MODE_CREATE | MPI_MODE_WRONLY, ioInfo, &thefile);
     int globalri[3];
     nearestInt(rr, ri, globalri);
     //+++++++++++ FILE HEADER  +++++++++++++++++++++
@@ -1719,7 +3350,7 @@ void OUTPUT_MANAGER::writeSpecDensity(std::string fileName, request req){
       itodo[5] = slice_rNproc[1];
       itodo[6] = slice_rNproc[2];
       itodo[7] = Ncomp;
-      MPI_File_write(thefile, itodo, 8, MPI_INT, &status);
+      outputWrite(thefile, itodo, 8, MPI_INT);
 
       float *fcir[3];
       for (int c = 0; c < 3; c++){
@@ -1730,9 +3361,9 @@ void OUTPUT_MANAGER::writeSpecDensity(std::string fileName, request req){
       }
       for (int c = 0; c < 3; c++){
         //if(remains[c])
-        MPI_File_write(thefile, fcir[c], uniqueN[c], MPI_FLOAT, &status);
+        outputWrite(thefile, fcir[c], uniqueN[c], MPI_FLOAT);
         //else
-        //  MPI_File_write(thefile, &fcir[c][globalri[c]], 1, MPI_FLOAT, &status);
+        //  outputWrite(thefile, &fcir[c][globalri[c]], 1, MPI_FLOAT);
       }
       for (int c = 0; c < 3; c++){
         delete[] fcir[c];
@@ -1766,7 +3397,7 @@ void OUTPUT_MANAGER::writeSpecDensity(std::string fileName, request req){
               itodo[c + 3] = 1;
             }
           }
-          MPI_File_write(thefile, itodo, 6, MPI_INT, &status);
+          outputWrite(thefile, itodo, 6, MPI_INT);
         }
     //+++++++++++ Start CPU Field Values  +++++++++++++++++++++
         {
@@ -1795,14 +3426,14 @@ void OUTPUT_MANAGER::writeSpecDensity(std::string fileName, request req){
               for (int i = 0; i < Nx; i++){
                 ii = i + origin[0];
                 for (int c = 0; c < Ncomp; c++)
-                  todo[c + i*Ncomp + j*Nx*Ncomp + k*Ny*Nx*Ncomp] = mycurrent->density(i, j, k);
+                  todo[c + i*Ncomp + j*Nx*Ncomp + k*Ny*Nx*Ncomp] = densityScratch.JJ(densityComp[req.target], i, j, k);
               }
             }
           }
-          MPI_File_write(thefile, todo, size, MPI_FLOAT, &status);
+          outputWrite(thefile, todo, size, MPI_FLOAT);
           delete[]todo;
         }
-    MPI_File_close(&thefile);
+    outputClose(&thefile);
     delete[] nomefile;
     delete[] totUniquePoints;
   }
@@ -1880,7 +3511,6 @@ void OUTPUT_MANAGER::writeSpecDensitySubDomain(std::string fileName, request req
     + (uniqueN[0] + uniqueN[1] + uniqueN[2])*sizeof(float);
 
   MPI_File thefile;
-  MPI_Status status;
 
   char* nomefile = new char[fileName.size() + 1];
 
@@ -1888,7 +3518,7 @@ void OUTPUT_MANAGER::writeSpecDensitySubDomain(std::string fileName, request req
   sprintf(nomefile, "%s", fileName.c_str());
 
   if (shouldIWrite){
-    MPI_File_open(outputCommunicator, nomefile, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &thefile);
+    MPI_File_open(outputCommunicator, nomefile, MPI_MODE_CREATE | MPI_MODE_WRONLY, ioInfo, &thefile);
     int globalri[3];
     nearestInt(rr, ri, globalri);
     //+++++++++++ FILE HEADER  +++++++++++++++++++++
@@ -1903,7 +3533,7 @@ void OUTPUT_MANAGER::writeSpecDensitySubDomain(std::string fileName, request req
       itodo[5] = slice_rNproc[1];
       itodo[6] = slice_rNproc[2];
       itodo[7] = Ncomp;
-      MPI_File_write(thefile, itodo, 8, MPI_INT, &status);
+      outputWrite(thefile, itodo, 8, MPI_INT);
 
       float *fcir[3];
       for (int c = 0; c < 3; c++){
@@ -1913,7 +3543,7 @@ void OUTPUT_MANAGER::writeSpecDensitySubDomain(std::string fileName, request req
         }
       }
       for (int c = 0; c < 3; c++){
-        MPI_File_write(thefile, fcir[c], uniqueN[c], MPI_FLOAT, &status);
+        outputWrite(thefile, fcir[c], uniqueN[c], MPI_FLOAT);
       }
       for (int c = 0; c < 3; c++){
         delete[] fcir[c];
@@ -1951,7 +3581,7 @@ void OUTPUT_MANAGER::writeSpecDensitySubDomain(std::string fileName, request req
               itodo[c + 3] = 1;
             }
           }
-          MPI_File_write(thefile, itodo, 6, MPI_INT, &status);
+          outputWrite(thefile, itodo, 6, MPI_INT);
         }
     //+++++++++++ Start CPU Field Values  +++++++++++++++++++++
             {
@@ -1981,14 +3611,14 @@ void OUTPUT_MANAGER::writeSpecDensitySubDomain(std::string fileName, request req
                   for (int i = 0; i < Nx; i++){
                     ii = i + origin[0];
                     for (int c = 0; c < Ncomp; c++)
-                      todo[c + i*Ncomp + j*Nx*Ncomp + k*Ny*Nx*Ncomp] = (float)mycurrent->density(ii, jj, kk);
+                      todo[c + i*Ncomp + j*Nx*Ncomp + k*Ny*Nx*Ncomp] = (float)densityScratch.JJ(densityComp[req.target], ii, jj, kk);
                   }
                 }
               }
-              MPI_File_write(thefile, todo, size, MPI_FLOAT, &status);
+              outputWrite(thefile, todo, size, MPI_FLOAT);
               delete[]todo;
             }
-    MPI_File_close(&thefile);
+    outputClose(&thefile);
     delete[] nomefile;
     delete[] totUniquePoints;
   }
@@ -1997,11 +3627,7 @@ void OUTPUT_MANAGER::writeSpecDensitySubDomain(std::string fileName, request req
 }
 
 void OUTPUT_MANAGER::callSpecDensity(request req){
-  mycurrent->eraseDensity();
-  myspecies[req.target]->density_deposition_standard(mycurrent);
-  mycurrent->pbc();
-
-  std::string nameBin = composeOutputName(outputDir, "DENS", myspecies[req.target]->name, myDomains[req.domain]->name, req.domain, req.dtime, ".bin");
+  std::string nameBin = composeOutputName(outputDir, "DENS", myspecies[req.target]->name, myDomains[req.domain]->name, req.domain, req.dtime, gridOutputExtension(req.domain));
 
 //  if (!myDomains[req.domain]->subselection){
 //    writeSpecDensity(nameBin, req);
@@ -2014,80 +3640,36 @@ void OUTPUT_MANAGER::callSpecDensity(request req){
 
 
 void OUTPUT_MANAGER::writeCurrent(std::string fileName, request req){
-  int Ncomp = 3;//myfield->getNcomp();
-  int *totUniquePoints;
-  int shouldIWrite = false;
-  int uniqueN[3], slice_rNproc[3];
-  double rr[3] = { myDomains[req.domain]->coordinates[0], myDomains[req.domain]->coordinates[1], myDomains[req.domain]->coordinates[2] };
-  int ri[3];
-  int remains[3] = { myDomains[req.domain]->remainingCoord[0], myDomains[req.domain]->remainingCoord[1], myDomains[req.domain]->remainingCoord[2] };
-
-  if (myDomains[req.domain]->overrideFlag){
-    rr[0] = 0.5*(mygrid->rmin[0] + mygrid->rmax[0]);
-    rr[1] = 0.5*(mygrid->rmin[1] + mygrid->rmax[1]);
-    rr[2] = 0.5*(mygrid->rmin[2] + mygrid->rmax[2]);
-    remains[0] = 1;
-    remains[1] = 1;
-    remains[2] = 1;
-  }
-
-
-  for (int c = 0; c < 3; c++){
-    if (remains[c]){
-      uniqueN[c] = mygrid->uniquePoints[c];
-      slice_rNproc[c] = mygrid->rnproc[c];
-    }
-    else{
-      uniqueN[c] = 1;
-      slice_rNproc[c] = 1;
-    }
-  }
-
-  shouldIWrite = isThePointInMyDomain(rr);
-
-  MPI_Comm sliceCommunicator;
-  int mySliceID, sliceNProc;
-
-  int dimension;
-  MPI_Cart_sub(mygrid->cart_comm, remains, &sliceCommunicator);
-  MPI_Comm_rank(sliceCommunicator, &mySliceID);
-  MPI_Comm_size(sliceCommunicator, &sliceNProc);
-  MPI_Cartdim_get(sliceCommunicator, &dimension);
-  MPI_Allreduce(MPI_IN_PLACE, &shouldIWrite, 1, MPI_INT, MPI_LOR, sliceCommunicator);
-
-  totUniquePoints = new int[sliceNProc];
-  for (int rank = 0; rank < sliceNProc; rank++){
-    int rid[3], idbookmark = 0;
-    MPI_Cart_coords(sliceCommunicator, rank, dimension, rid);
-    totUniquePoints[rank] = 1;
-    for (int c = 0; c < 3; c++){
-      if (remains[c]){
-        totUniquePoints[rank] *= mygrid->rproc_NuniquePointsloc[c][rid[idbookmark]];
-        idbookmark++;
-      }
-    }
+#if defined(USE_HDF5)
+  if (hdf5Output){
+    writeGridFieldHDF5(fileName, req);
+    return;
   }
+#endif
+  int Ncomp = 3;//myfield->getNcomp();
+  outputPlan *plan = getOutputPlan(req.domain, PLAN_SLICE);
+  int *uniqueN = plan->uniqueN, *slice_rNproc = plan->slice_rNproc, *remains = plan->remains;
+  int *ri = plan->ri, *globalri = plan->globalri;
+  int mySliceID = plan->myOutputID;
 
   MPI_Offset disp = 0;
   int small_header = 6 * sizeof(int);
   int big_header = (1 + 3 + 3 + 1)*sizeof(int)
     + (uniqueN[0] + uniqueN[1] + uniqueN[2])*sizeof(float);
 
-  MPI_File thefile;
-  MPI_Status status;
-
-  char* nomefile = new char[fileName.size() + 1];
-
-  nomefile[fileName.size()] = 0;
-  sprintf(nomefile, "%s", fileName.c_str());
+  if (plan->shouldIWrite){
+    disp = big_header + (MPI_Offset)mySliceID*small_header + plan->pointsBefore*sizeof(float)*Ncomp;
 
-  if (shouldIWrite){
-    MPI_File_open(sliceCommunicator, nomefile, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &thefile);
-    int globalri[3];
-    nearestInt(rr, ri, globalri);
+    //each task packs its headers and values in one block, written with a single collective call
+    int blockSize = 6 + Ncomp*plan->uniqueLocN[0] * plan->uniqueLocN[1] * plan->uniqueLocN[2];
+    if (mySliceID == 0){
+      blockSize += big_header / sizeof(float);
+      disp = 0;
+    }
+    float *block = new float[blockSize];
+    int pos = 0, box[6];
     //+++++++++++ FILE HEADER  +++++++++++++++++++++
     if (mySliceID == 0){
-      MPI_File_set_view(thefile, 0, MPI_FLOAT, MPI_FLOAT, (char *) "native", MPI_INFO_NULL);
       int itodo[8];
       itodo[0] = is_big_endian();
       itodo[1] = uniqueN[0];
@@ -2097,40 +3679,19 @@ void OUTPUT_MANAGER::writeCurrent(std::string fileName, request req){
       itodo[5] = slice_rNproc[1];
       itodo[6] = slice_rNproc[2];
       itodo[7] = Ncomp;
-      MPI_File_write(thefile, itodo, 8, MPI_INT, &status);
+      memcpy(block, itodo, 8 * sizeof(int));
+      pos += 8;
 
-      float *fcir[3];
-      for (int c = 0; c < 3; c++){
-        fcir[c] = new float[uniqueN[c]];
-        for (int m = 0; m < uniqueN[c]; m++){
-          fcir[c][m] = (float)mygrid->cir[c][m];
-        }
-      }
       for (int c = 0; c < 3; c++){
         if (remains[c])
-          MPI_File_write(thefile, fcir[c], uniqueN[c], MPI_FLOAT, &status);
+          for (int m = 0; m < uniqueN[c]; m++)
+            block[pos++] = (float)mygrid->cir[c][m];
         else
-          MPI_File_write(thefile, &fcir[c][globalri[c]], 1, MPI_FLOAT, &status);
-      }
-      for (int c = 0; c < 3; c++){
-        delete[] fcir[c];
+          block[pos++] = (float)mygrid->cir[c][globalri[c]];
       }
-
     }
     //*********** END HEADER *****************
 
-    disp = big_header;
-    for (int rank = 0; rank < mySliceID; rank++)
-      disp += small_header + totUniquePoints[rank] * sizeof(float)*Ncomp;
-    if (disp < 0){
-      std::cout << "a problem occurred when trying to mpi_file_set_view in writeEMFieldBinary" << std::endl;
-      std::cout << "myrank=" << mygrid->myid << " disp=" << disp << std::endl;
-      exit(33);
-    }
-    if (mySliceID != 0){
-      MPI_File_set_view(thefile, disp, MPI_FLOAT, MPI_FLOAT, (char *) "native", MPI_INFO_NULL);
-    }
-
     //+++++++++++ Start CPU HEADER  +++++++++++++++++++++
         {
           int itodo[6];
@@ -2144,11 +3705,13 @@ void OUTPUT_MANAGER::writeCurrent(std::string fileName, request req){
               itodo[c + 3] = 1;
             }
           }
-          MPI_File_write(thefile, itodo, 6, MPI_INT, &status);
+          memcpy(block + pos, itodo, 6 * sizeof(int));
+          memcpy(box, itodo, 6 * sizeof(int));
+          pos += 6;
         }
     //+++++++++++ Start CPU Field Values  +++++++++++++++++++++
         {
-          float *todo;
+          float *todo = block + pos;
           int NN[3], Nx, Ny, Nz, origin[3];
           for (int c = 0; c < 3; c++){
             if (remains[c]){
@@ -2164,7 +3727,6 @@ void OUTPUT_MANAGER::writeCurrent(std::string fileName, request req){
           Ny = NN[1];
           Nz = NN[2];
           int size = Ncomp*NN[0] * NN[1] * NN[2];
-          todo = new float[size];
           int ii, jj, kk;
           for (int k = 0; k < Nz; k++){
             kk = k + origin[2];
@@ -2177,14 +3739,11 @@ void OUTPUT_MANAGER::writeCurrent(std::string fileName, request req){
               }
             }
           }
-          MPI_File_write(thefile, todo, size, MPI_FLOAT, &status);
-          delete[]todo;
+          pos += size;
         }
-    MPI_File_close(&thefile);
-    delete[] nomefile;
-    delete[] totUniquePoints;
+    writeOutputBlocks(fileName, plan, disp, block, pos, MPI_FLOAT, box);
+    delete[] block;
   }
-  MPI_Comm_free(&sliceCommunicator);
 }
 
 void  OUTPUT_MANAGER::callCurrent(request req){
@@ -2227,18 +3786,18 @@ void OUTPUT_MANAGER::writeSpecPhaseSpace(std::string fileName, request req){
   sprintf(nomefile, "%s", fileName.c_str());
 
   MPI_File_open(MPI_COMM_WORLD, nomefile,
-    MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &thefile);
-
-  MPI_File_set_view(thefile, disp, MPI_FLOAT, MPI_FLOAT, (char *) "native", MPI_INFO_NULL);
+    MPI_MODE_CREATE | MPI_MODE_WRONLY, ioInfo, &thefile);
 
   float *buf;
-  MPI_Status status;
-  int dimensione, passaggi, resto;
+  int dimensione, passaggi, resto, maxPassaggi;
 
   dimensione = 100000;
   buf = new float[dimensione*outputNComp];
   passaggi = spec->Np / dimensione;
   resto = spec->Np % dimensione;
+  //the particles are written in collective rounds of (at most) dimensione particles per task
+  maxPassaggi = passaggi;
+  MPI_Allreduce(MPI_IN_PLACE, &maxPassaggi, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
   //printf("writePHACESPACE NCompFloat = %i     outputNComp = %i\n", NCompFloat, outputNComp);
 
   for (int i = 0; i < passaggi; i++){
@@ -2253,7 +3812,8 @@ void OUTPUT_MANAGER::writeSpecPhaseSpace(std::string fileName, request req){
         //*((double*)(&(buf[c + p*outputNComp]))) = spec->pettorale(p+ dimensione*i;
       }
     }
-    MPI_File_write(thefile, buf, dimensione*outputNComp, MPI_FLOAT, &status);
+    outputWriteAtAll(thefile, disp, buf, dimensione*outputNComp, MPI_FLOAT);
+    disp += (MPI_Offset)dimensione*outputNComp*sizeof(float);
   }
   for (int p = 0; p < resto; p++){
     int c;
@@ -2266,109 +3826,160 @@ void OUTPUT_MANAGER::writeSpecPhaseSpace(std::string fileName, request req){
       //*((double*)(&(buf[c + p*outputNComp]))) = spec->pettorale(p+ dimensione*i;
     }
   }
-  MPI_File_write(thefile, buf, resto*outputNComp, MPI_FLOAT, &status);
-  MPI_File_close(&thefile);
+  outputWriteAtAll(thefile, disp, buf, resto*outputNComp, MPI_FLOAT);
+  for (int i = passaggi; i < maxPassaggi; i++)
+    outputWriteAtAll(thefile, disp, buf, 0, MPI_FLOAT);
+  outputClose(&thefile);
   delete[]buf;
   delete[] NfloatLoc;
   delete[] nomefile;
 
 }
-int OUTPUT_MANAGER::findNumberOfParticlesInSubdomain(request req){
-  double rmin[3], rmax[3];
-  for (int c = 0; c < 3; c++){
-    rmin[c] = myDomains[req.domain]->rmin[c];
-    rmax[c] = myDomains[req.domain]->rmax[c];
-  }
-  int counter = 0;
-  double rr[3];
+static uint64_t splitmix64(uint64_t x){
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+//box, gamma, cone and marker filters and the subsampling are applied in a single pass
+int OUTPUT_MANAGER::selectParticlesInSubdomain(request req, std::vector<int> &selected){
+  outDomain *domain = myDomains[req.domain];
   SPECIE* spec = myspecies[req.target];
+  bool withMarker = spec->amIWithMarker();
+  if (domain->markerFlag && !withMarker){
+    printf("ERROR: marker range requested for species %s, which has no markers\n", spec->name.c_str());
+    exit(17);
+  }
+  double *rmin = domain->rmin, *rmax = domain->rmax;
+  uint64_t seedKey = splitmix64((uint64_t)domain->sampleSeed);
+  uint64_t stepKey = splitmix64(splitmix64(seedKey ^ (uint64_t)req.itime) ^ (uint64_t)mygrid->myid);
+  double rr[3], uu[3];
+  int passed = 0;
+  selected.clear();
   for (int p = 0; p < spec->Np; p++){
     rr[0] = spec->r0(p);
     rr[1] = spec->r1(p);
     rr[2] = spec->r2(p);
-
-    if (rmax[0] >= rr[0] && rmin[0] < rr[0]){
-      if (mygrid->accesso.dimensions < 2 || (rmax[1] >= rr[1] && rmin[1] < rr[1])){
-        if (mygrid->accesso.dimensions < 3 || (rmax[2] >= rr[2] && rmin[2] < rr[2])){
-          counter++;
-        }
-      }
+    if (!(rmax[0] >= rr[0] && rmin[0] < rr[0]))
+      continue;
+    if (!(mygrid->accesso.dimensions < 2 || (rmax[1] >= rr[1] && rmin[1] < rr[1])))
+      continue;
+    if (!(mygrid->accesso.dimensions < 3 || (rmax[2] >= rr[2] && rmin[2] < rr[2])))
+      continue;
+    uu[0] = spec->u0(p);
+    uu[1] = spec->u1(p);
+    uu[2] = spec->u2(p);
+    double u2 = uu[0] * uu[0] + uu[1] * uu[1] + uu[2] * uu[2];
+    double gamma = sqrt(1 + u2);
+    if (gamma < domain->gammaRange[0] || gamma >= domain->gammaRange[1])
+      continue;
+    if (domain->coneFlag){
+      double proj = uu[0] * domain->coneAxis[0] + uu[1] * domain->coneAxis[1] + uu[2] * domain->coneAxis[2];
+      if (u2 == 0 || proj < domain->coneCosAngle*sqrt(u2))
+        continue;
+    }
+    if (domain->markerFlag && (spec->marker(p) < domain->markerRange[0] || spec->marker(p) > domain->markerRange[1]))
+      continue;
+    if ((passed++) % domain->particleStride)
+      continue;
+    if (domain->sampleFraction < 1){
+      uint64_t key;
+      if (withMarker)
+        key = splitmix64(seedKey ^ (uint64_t)spec->marker(p));
+      else
+        key = splitmix64(stepKey ^ (uint64_t)p);
+      if ((key >> 11)*(1.0 / 9007199254740992.0) >= domain->sampleFraction)
+        continue;
     }
+    selected.push_back(p);
   }
-  return counter;
+  return selected.size();
+}
+
+int OUTPUT_MANAGER::packPhaseSpaceParticle(float *buf, SPECIE *spec, int p, int components, double weightScale){
+  int n = 0;
+  for (int c = 0; c < 6; c++){
+    if (components & (1 << c))
+      buf[n++] = (float)spec->ru(c, p);
+  }
+  if (components & PS_W)
+    buf[n++] = (float)(spec->w(p)*weightScale);
+  if (components & PS_MARKER){
+    memcpy(buf + n, &spec->marker(p), 2 * sizeof(float));
+    n += 2;
+  }
+  return n;
 }
 
 void OUTPUT_MANAGER::writeSpecPhaseSpaceSubDomain(std::string fileName, request req){
 
   SPECIE* spec = myspecies[req.target];
-  int shouldIWrite = false;
-  shouldIWrite = amIInTheSubDomain(req);
-
-  MPI_Comm outputCommunicator;
-  MPI_Comm_split(mygrid->cart_comm, shouldIWrite, 0, &outputCommunicator);
-  int myOutputID, outputNProc;
-  MPI_Comm_rank(outputCommunicator, &myOutputID);
-  MPI_Comm_size(outputCommunicator, &outputNProc);
-
-  int outputNPart = findNumberOfParticlesInSubdomain(req);
-  int* NfloatLoc = new int[outputNProc];
-  NfloatLoc[myOutputID] = outputNPart*spec->Ncomp;
-
-  MPI_Allgather(MPI_IN_PLACE, 1, MPI_INT, NfloatLoc, 1, MPI_INT, outputCommunicator);
+  outDomain *domain = myDomains[req.domain];
+  outputPlan *plan = getOutputPlan(req.domain, PLAN_PARTICLES);
+  if (!plan->shouldIWrite)
+    return;
 
-  MPI_Offset disp = 0;
-  for (int pp = 0; pp < myOutputID; pp++)
-    disp += (MPI_Offset)(NfloatLoc[pp] * sizeof(float));
-  MPI_File thefile;
-  MPI_Status status;
+  MPI_Comm outputCommunicator = plan->outputCommunicator;
+  int myOutputID = plan->myOutputID;
+
+  //the marker is written as two floats, as in the full domain output
+  int components = domain->phaseSpaceComponents;
+  if (!spec->amIWithMarker())
+    components &= ~PS_MARKER;
+  int outputNComp = (components & PS_MARKER) ? 2 : 0;
+  for (int c = 0; c < 7; c++){
+    if (components & (1 << c))
+      outputNComp++;
+  }
+  double weightScale = domain->particleStride / domain->sampleFraction;
+
+  std::vector<int> selected;
+  int outputNPart = selectParticlesInSubdomain(req, selected);
+  //the offset is the prefix sum of the particles of the lower ranks
+  MPI_Offset disp = 0, myBytes = (MPI_Offset)outputNPart*outputNComp*sizeof(float);
+  MPI_Exscan(&myBytes, &disp, 1, MPI_OFFSET, MPI_SUM, outputCommunicator);
+  if (myOutputID == 0)
+    disp = 0;
+
+  //the aggregators and the stream need the whole block of each task
+  if (subfileNumber || domain->streamFlag){
+    std::vector<float> all(outputNPart*outputNComp + 1);
+    int pos = 0;
+    for (int n = 0; n < outputNPart; n++)
+      pos += packPhaseSpaceParticle(&all[pos], spec, selected[n], components, weightScale);
+    writeOutputBlocks(fileName, plan, disp, &all[0], pos, MPI_FLOAT, NULL);
+    return;
+  }
 
   char *nomefile = new char[fileName.size() + 1];
   nomefile[fileName.size()] = 0;
   sprintf(nomefile, "%s", fileName.c_str());
 
-  if (shouldIWrite){
-    MPI_File_open(outputCommunicator, nomefile, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &thefile);
-    MPI_File_set_view(thefile, disp, MPI_FLOAT, MPI_FLOAT, (char *) "native", MPI_INFO_NULL);
-
-    float *buf;
-    int dimensione = 100000;
-    buf = new float[dimensione*spec->Ncomp];
+  MPI_File thefile;
+  MPI_File_open(outputCommunicator, nomefile, MPI_MODE_CREATE | MPI_MODE_WRONLY, ioInfo, &thefile);
 
-    double rr[3];
-    int counter = 0;
-    double rmin[3], rmax[3];
-    for (int c = 0; c < 3; c++){
-      rmin[c] = myDomains[req.domain]->rmin[c];
-      rmax[c] = myDomains[req.domain]->rmax[c];
-    }
-
-    for (int p = 0; p < spec->Np; p++){
-      rr[0] = spec->r0(p);
-      rr[1] = spec->r1(p);
-      rr[2] = spec->r2(p);
-      if (rmax[0] >= rr[0] && rmin[0] < rr[0]){
-        if (mygrid->accesso.dimensions < 2 || (rmax[1] >= rr[1] && rmin[1] < rr[1])){
-          if (mygrid->accesso.dimensions < 3 || (rmax[2] >= rr[2] && rmin[2] < rr[2])){
-            for (int c = 0; c < spec->Ncomp; c++){
-              buf[c + counter*spec->Ncomp] = (float)spec->ru(c, p);
-            }
-            counter++;
-          }
-        }
-      }
-      if (counter == dimensione){
-        MPI_File_write(thefile, buf, counter*spec->Ncomp, MPI_FLOAT, &status);
-        counter = 0;
-      }
-    }
-    if (counter > 0){
-      MPI_File_write(thefile, buf, counter*spec->Ncomp, MPI_FLOAT, &status);
-    }
-    MPI_File_close(&thefile);
-    delete[]buf;
+  float *buf;
+  int dimensione = 100000;
+  buf = new float[dimensione*outputNComp];
+  //the particles are written in collective rounds of (at most) dimensione particles per task
+  int passaggi = (outputNPart + dimensione - 1) / dimensione;
+  int maxPassaggi = passaggi;
+  MPI_Allreduce(MPI_IN_PLACE, &maxPassaggi, 1, MPI_INT, MPI_MAX, outputCommunicator);
+
+  for (int i = 0; i < maxPassaggi; i++){
+    int first = i*dimensione;
+    int count = (outputNPart - first < dimensione) ? (outputNPart - first) : dimensione;
+    if (count < 0)
+      count = 0;
+    int pos = 0;
+    for (int n = 0; n < count; n++)
+      pos += packPhaseSpaceParticle(buf + pos, spec, selected[first + n], components, weightScale);
+    outputWriteAtAll(thefile, disp, buf, pos, MPI_FLOAT);
+    disp += (MPI_Offset)pos*sizeof(float);
   }
-  MPI_Comm_free(&outputCommunicator);
-  delete[] NfloatLoc;
+  outputClose(&thefile);
+  delete[]buf;
   delete[] nomefile;
 }
 
@@ -2383,9 +3994,20 @@ void OUTPUT_MANAGER::callSpecPhaseSpace(request req){
     outputName = "PHASESPACE";
   }
 
+#if defined(USE_HDF5)
+  if (hdf5Output){
+    nameBin = composeOutputName(outputDir, outputName, name, myDomains[req.domain]->name, req.domain, req.dtime, ".bin");
+    writeSpecPhaseSpaceHDF5(nameBin, req);
+    return;
+  }
+#endif
   if (req.domain == 0){
     nameBin = composeOutputName(outputDir, outputName, name, req.dtime, ".bin");
-    writeSpecPhaseSpace(nameBin, req);
+    //the whole box is the subdomain 0, which has no filters: same file, through the aggregators
+    if (subfileNumber)
+      writeSpecPhaseSpaceSubDomain(nameBin, req);
+    else
+      writeSpecPhaseSpace(nameBin, req);
   }
   else{
     nameBin = composeOutputName(outputDir, outputName, name, myDomains[req.domain]->name, req.domain, req.dtime, ".bin");
@@ -2394,6 +4016,304 @@ void OUTPUT_MANAGER::callSpecPhaseSpace(request req){
 }
 
 
+//the first maxParticles particles which pass the filters of the domain (in task order) are tracked;
+//TRACK_<name>.bin starts with int endian, N, Ncomp, components and the N sorted markers (int64)
+void OUTPUT_MANAGER::selectTrackedParticles(request req){
+  SPECIE *spec = myspecies[req.target];
+  trackingOutput &track = myTrackings[req.target];
+  if (!spec->amIWithMarker()){
+    printf("ERROR: species %s needs markers (addMarker) to be tracked\n", spec->name.c_str());
+    exit(17);
+  }
+  std::vector<int> candidates;
+  int nLoc = selectParticlesInSubdomain(req, candidates);
+  int before = 0;
+  MPI_Exscan(&nLoc, &before, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+  if (mygrid->myid == 0)
+    before = 0;
+  int nMine = track.maxParticles - before;
+  nMine = (nMine < 0) ? 0 : ((nMine > nLoc) ? nLoc : nMine);
+  std::vector<long int> mine(nMine + 1);
+  for (int n = 0; n < nMine; n++)
+    mine[n] = spec->marker(candidates[n]);
+
+  std::vector<int> counts(mygrid->nproc), displs(mygrid->nproc, 0);
+  MPI_Allgather(&nMine, 1, MPI_INT, &counts[0], 1, MPI_INT, MPI_COMM_WORLD);
+  for (int rank = 1; rank < mygrid->nproc; rank++)
+    displs[rank] = displs[rank - 1] + counts[rank - 1];
+  int total = displs[mygrid->nproc - 1] + counts[mygrid->nproc - 1];
+  std::vector<long int> markers(total + 1);
+  MPI_Allgatherv(&mine[0], nMine, MPI_LONG, &markers[0], &counts[0], &displs[0], MPI_LONG, MPI_COMM_WORLD);
+  markers.resize(total);
+  spec->setTrackedParticles(markers);
+  track.selected = true;
+
+  track.fileName = outputDir + "/TRACK_" + spec->name + ".bin";
+  if (mygrid->myid == mygrid->master_proc){
+    int Ncomp = 0;
+    for (int c = 0; c < 7; c++){
+      if (track.components & (1 << c))
+        Ncomp++;
+    }
+    int itodo[4] = { is_big_endian(), total, Ncomp, track.components };
+    std::ofstream of1(track.fileName.c_str(), std::ofstream::binary | std::ofstream::trunc);
+    of1.write((char*)itodo, sizeof(itodo));
+    if (total)
+      of1.write((char*)&spec->trackedMarkers[0], total*sizeof(long int));
+    of1.close();
+  }
+}
+
+//one record per output: float time, then Ncomp floats for each marker of the header (NaN if lost)
+void OUTPUT_MANAGER::writeSpecTracking(request req){
+  SPECIE *spec = myspecies[req.target];
+  trackingOutput &track = myTrackings[req.target];
+  int Ncomp = 0;
+  for (int c = 0; c < 7; c++){
+    if (track.components & (1 << c))
+      Ncomp++;
+  }
+  int nLoc = spec->trackedIndex.size();
+  std::vector<int> slots(nLoc + 1);
+  std::vector<float> values(nLoc*Ncomp + 1);
+  for (int n = 0; n < nLoc; n++){
+    int p = spec->trackedIndex[n];
+    slots[n] = std::lower_bound(spec->trackedMarkers.begin(), spec->trackedMarkers.end(), spec->marker(p)) - spec->trackedMarkers.begin();
+    packPhaseSpaceParticle(&values[n*Ncomp], spec, p, track.components, 1.0);
+  }
+
+  bool amIMaster = (mygrid->myid == mygrid->master_proc);
+  std::vector<int> counts(mygrid->nproc), displs(mygrid->nproc, 0);
+  MPI_Gather(&nLoc, 1, MPI_INT, &counts[0], 1, MPI_INT, mygrid->master_proc, MPI_COMM_WORLD);
+  for (int rank = 1; rank < mygrid->nproc; rank++)
+    displs[rank] = displs[rank - 1] + counts[rank - 1];
+  int total = displs[mygrid->nproc - 1] + counts[mygrid->nproc - 1];
+  std::vector<int> allSlots(amIMaster ? total + 1 : 1);
+  MPI_Gatherv(&slots[0], nLoc, MPI_INT, &allSlots[0], &counts[0], &displs[0], MPI_INT, mygrid->master_proc, MPI_COMM_WORLD);
+  for (int rank = 0; rank < mygrid->nproc; rank++){
+    counts[rank] *= Ncomp;
+    displs[rank] *= Ncomp;
+  }
+  std::vector<float> allValues(amIMaster ? total*Ncomp + 1 : 1);
+  MPI_Gatherv(&values[0], nLoc*Ncomp, MPI_FLOAT, &allValues[0], &counts[0], &displs[0], MPI_FLOAT, mygrid->master_proc, MPI_COMM_WORLD);
+
+  if (amIMaster){
+    std::vector<float> record(1 + spec->trackedMarkers.size()*Ncomp, NAN);
+    record[0] = (float)req.dtime;
+    for (int n = 0; n < total; n++){
+      for (int c = 0; c < Ncomp; c++)
+        record[1 + allSlots[n] * Ncomp + c] = allValues[n*Ncomp + c];
+    }
+    std::ofstream of1(track.fileName.c_str(), std::ofstream::binary | std::ofstream::app);
+    of1.write((char*)&record[0], record.size()*sizeof(float));
+    of1.close();
+  }
+}
+
+void OUTPUT_MANAGER::callSpecTracking(request req){
+  if (!myTrackings[req.target].selected)
+    selectTrackedParticles(req);
+  writeSpecTracking(req);
+}
+
+static double histogramValue(SPECIE *spec, int p, histogramQuantity q){
+  double u2 = spec->u0(p)*spec->u0(p) + spec->u1(p)*spec->u1(p) + spec->u2(p)*spec->u2(p);
+  switch (q){
+  case HIST_X:
+    return spec->r0(p);
+  case HIST_Y:
+    return spec->r1(p);
+  case HIST_Z:
+    return spec->r2(p);
+  case HIST_PX:
+    return spec->u0(p);
+  case HIST_PY:
+    return spec->u1(p);
+  case HIST_PZ:
+    return spec->u2(p);
+  case HIST_GAMMA:
+    return sqrt(1.0 + u2);
+  case HIST_EKIN:
+    return sqrt(1.0 + u2) - 1.0;
+  case HIST_THETA:
+    return (u2 > 0) ? acos(spec->u0(p) / sqrt(u2)) : 0;
+  case HIST_PHI_XY:
+    return atan2(spec->u1(p), spec->u0(p));
+  case HIST_PHI_XZ:
+    return atan2(spec->u2(p), spec->u0(p));
+  default:
+    return 0;
+  }
+}
+
+//the particles which pass the filters of the domain are binned by each thread on its own copy,
+//the copies are summed and reduced on the master, which writes:
+//int endian, nAxes, weighted, then for each axis int quantity, nbins, double min, max, then the bins (double, first axis fastest)
+void OUTPUT_MANAGER::writeSpecHistogram(std::string fileName, request req){
+  outHistogram *hist = myHistograms[req.target];
+  outDomain *domain = myDomains[req.domain];
+  request specReq = req;
+  specReq.target = histogramSpecies[req.target];
+  SPECIE *spec = myspecies[specReq.target];
+
+  std::vector<int> selected;
+  int nSelected = selectParticlesInSubdomain(specReq, selected);
+  double weightScale = domain->particleStride / domain->sampleFraction;
+  long int nTot = 1;
+  for (int a = 0; a < hist->nAxes; a++)
+    nTot *= hist->nbins[a];
+  std::vector<double> bins(nTot, 0.0);
+
+#pragma omp parallel
+  {
+    std::vector<double> myBins(nTot, 0.0);
+#pragma omp for
+    for (int n = 0; n < nSelected; n++){
+      int p = selected[n];
+      long int index = 0, stride = 1;
+      for (int a = 0; a < hist->nAxes; a++){
+        double val = histogramValue(spec, p, hist->quantity[a]);
+        if (!(val >= hist->range[a][0] && val < hist->range[a][1])){
+          index = -1;
+          break;
+        }
+        int ibin = (int)((val - hist->range[a][0]) / (hist->range[a][1] - hist->range[a][0])*hist->nbins[a]);
+        if (ibin >= hist->nbins[a])
+          ibin = hist->nbins[a] - 1;
+        index += ibin*stride;
+        stride *= hist->nbins[a];
+      }
+      if (index >= 0)
+        myBins[index] += hist->weighted ? spec->w(p)*weightScale : 1.0;
+    }
+#pragma omp critical
+    {
+      for (long int i = 0; i < nTot; i++)
+        bins[i] += myBins[i];
+    }
+  }
+
+  if (mygrid->myid == mygrid->master_proc)
+    MPI_Reduce(MPI_IN_PLACE, &bins[0], nTot, MPI_DOUBLE, MPI_SUM, mygrid->master_proc, MPI_COMM_WORLD);
+  else
+    MPI_Reduce(&bins[0], NULL, nTot, MPI_DOUBLE, MPI_SUM, mygrid->master_proc, MPI_COMM_WORLD);
+
+#if defined(USE_HDF5)
+  if (hdf5Output){
+    writeSpecHistogramHDF5(fileName, req, bins);
+    return;
+  }
+#endif
+  if (mygrid->myid == mygrid->master_proc){
+    std::stringstream block;
+    int itodo[3] = { is_big_endian(), hist->nAxes, hist->weighted };
+    block.write((char*)itodo, sizeof(itodo));
+    for (int a = 0; a < hist->nAxes; a++){
+      int iaxis[2] = { hist->quantity[a], hist->nbins[a] };
+      block.write((char*)iaxis, sizeof(iaxis));
+      block.write((char*)hist->range[a], 2 * sizeof(double));
+    }
+    block.write((char*)&bins[0], nTot*sizeof(double));
+    std::string data = block.str();
+    if (domain->streamFlag)
+      streamBlock(fileName, 0, 1, NULL, 0, (void*)data.c_str(), data.size());
+    if (!domain->streamFlag || domain->streamFiles){
+      std::ofstream of1(fileName.c_str(), std::ofstream::binary | std::ofstream::trunc);
+      of1.write(data.c_str(), data.size());
+      of1.close();
+    }
+  }
+}
+
+void OUTPUT_MANAGER::callSpecHistogram(request req){
+  std::string specName = myspecies[histogramSpecies[req.target]]->name;
+  std::string nameBin = composeOutputName(outputDir, "HISTOGRAM", specName, myHistograms[req.target]->name, req.domain, req.dtime, ".bin");
+  writeSpecHistogram(nameBin, req);
+}
+
+//when the window has moved since the last sample, the sums are moved with the grid:
+//the cells entering from the right are taken from the right neighbour (zero on the last task)
+void OUTPUT_MANAGER::shiftAccumulator(accumulatorOutput &accum){
+  int shift = (int)floor((mygrid->rmin[0] - accum.gridXmin) / mygrid->dr[0] + 0.5);
+  accum.gridXmin = mygrid->rmin[0];
+  if (shift <= 0)
+    return;
+  int *Nloc = mygrid->Nloc;
+  if (shift >= Nloc[0]){
+    printf("ERROR: the window moved by more than a local domain between two samples of accumulator %s\n", accum.acc->name.c_str());
+    exit(17);
+  }
+  int Nyz = Nloc[1] * Nloc[2];
+  std::vector<double> sendBuf(shift*Nyz), recvBuf(shift*Nyz);
+  for (int l = 0; l < Nyz; l++){
+    for (int i = 0; i < shift; i++)
+      sendBuf[i + shift*l] = accum.values[(i + 1) + Nloc[0] * l];
+  }
+  int ileft, iright;
+  MPI_Cart_shift(mygrid->cart_comm, 0, 1, &ileft, &iright);
+  MPI_Sendrecv(&sendBuf[0], shift*Nyz, MPI_DOUBLE, ileft, 14,
+    &recvBuf[0], shift*Nyz, MPI_DOUBLE, iright, 14, mygrid->cart_comm, MPI_STATUS_IGNORE);
+  if (mygrid->rmyid[0] == (mygrid->rnproc[0] - 1))
+    std::fill(recvBuf.begin(), recvBuf.end(), 0.0);
+  for (int l = 0; l < Nyz; l++){
+    double *line = &accum.values[Nloc[0] * l];
+    memmove(line, line + shift, (Nloc[0] - shift)*sizeof(double));
+    for (int i = 0; i < shift; i++)
+      line[Nloc[0] - shift + i] = recvBuf[i + shift*l];
+  }
+}
+
+void OUTPUT_MANAGER::accumulateFieldValues(accumulatorOutput &accum){
+  int *Nloc = mygrid->Nloc;
+  long int Ntot = ((long int)Nloc[0])*Nloc[1] * Nloc[2];
+  if (accum.values.empty()){
+    accum.values.assign(Ntot, 0.0);
+    accum.gridXmin = mygrid->rmin[0];
+  }
+  else
+    shiftAccumulator(accum);
+  accumulatorQuantity quantity = accum.acc->quantity;
+  int comp = (accum.spec >= 0) ? densityComp[accum.spec] : 0;
+#pragma omp parallel for
+  for (long int n = 0; n < Ntot; n++){
+    int i = n % Nloc[0], j = (n / Nloc[0]) % Nloc[1], k = n / (Nloc[0] * Nloc[1]);
+    double val = 0;
+    switch (quantity){
+    case ACC_E2:
+      for (int c = 0; c < 3; c++)
+        val += myfield->VEB(c, i, j, k)*myfield->VEB(c, i, j, k);
+      break;
+    case ACC_B2:
+      for (int c = 3; c < 6; c++)
+        val += myfield->VEB(c, i, j, k)*myfield->VEB(c, i, j, k);
+      break;
+    case ACC_JE:
+      for (int c = 0; c < 3; c++)
+        val += mycurrent->JJ(c, i, j, k)*myfield->VEB(c, i, j, k);
+      break;
+    case ACC_SPEC_DENSITY:
+      val = densityScratch.JJ(comp, i, j, k);
+      break;
+    }
+    accum.values[n] += val;
+  }
+  accum.samples++;
+}
+
+void OUTPUT_MANAGER::callFieldAccumulator(request req){
+  accumulatorOutput &accum = myAccumulators[req.target];
+  accumulateFieldValues(accum);
+  if (req.itime + accum.everySteps <= accum.windowEnd && !req.last)
+    return;
+
+  std::string nameBin = composeOutputName(outputDir, "ACCUMULATOR", accum.acc->name, myDomains[req.domain]->name, req.domain, req.dtime, gridOutputExtension(req.domain));
+  writeGridFieldSubDomain(nameBin, req);
+  std::fill(accum.values.begin(), accum.values.end(), 0.0);
+  accum.samples = 0;
+  while (accum.windowEnd < req.itime + accum.everySteps)
+    accum.windowEnd += accum.windowSteps;
+}
+
 void OUTPUT_MANAGER::callDiag(request req){
   std::vector<SPECIE*>::const_iterator spec_iterator;
   double * ekinSpecies;
@@ -2405,6 +4325,18 @@ void OUTPUT_MANAGER::callDiag(request req){
 
   double EE[3], BE[3];
 
+  // fields and all the species share a single packed reduction
+  packedReduction diagReduction;
+  myfield->addEnergyAndExtremesTo(diagReduction);
+  for (spec_iterator = myspecies.begin(); spec_iterator != myspecies.end(); spec_iterator++){
+    (*spec_iterator)->addKineticEnergyWExtremsTo(diagReduction);
+  }
+  diagReduction.allreduce(MPI_COMM_WORLD);
+  myfield->getEnergyAndExtremesFrom(diagReduction);
+  for (spec_iterator = myspecies.begin(); spec_iterator != myspecies.end(); spec_iterator++){
+    (*spec_iterator)->getKineticEnergyWExtremsFrom(diagReduction);
+  }
+
   myfield->computeEnergyAndExtremes();
   double etotFields = myfield->total_energy[6];
 
@@ -2480,10 +4412,13 @@ bool OUTPUT_MANAGER::isThePointInMyDomain(double rr[3]){
   return false;
 }
 bool OUTPUT_MANAGER::amIInTheSubDomain(request req){
+  return amIInTheSubDomain(req.domain);
+}
+bool OUTPUT_MANAGER::amIInTheSubDomain(int domain){
   double rmin[3], rmax[3];
   for (int c = 0; c < 3; c++){
-    rmin[c] = myDomains[req.domain]->rmin[c];
-    rmax[c] = myDomains[req.domain]->rmax[c];
+    rmin[c] = myDomains[domain]->rmin[c];
+    rmax[c] = myDomains[domain]->rmax[c];
   }
   if (rmax[0] >= mygrid->rminloc[0] && rmin[0] < mygrid->rmaxloc[0]){
     if (mygrid->accesso.dimensions < 2 || (rmax[1] >= mygrid->rminloc[1] && rmin[1] < mygrid->rmaxloc[1])){
@@ -2633,17 +4568,9 @@ void OUTPUT_MANAGER::autoVisualDiag(){
   MPI_Comm_rank(MPI_COMM_WORLD, &myid);
   if (myid == 0){
     std::cout << "*******OUTPUT MANAGER DEBUG***********" << std::endl;
-    std::map< int, std::vector<request> >::iterator itMap;
-    for (std::vector<int>::iterator itD = timeList.begin(); itD != timeList.end(); itD++) {
-      std::map< int, std::vector<request> >::iterator itMapD;
-      itMapD = allOutputs.find(*itD);
-      if (itMapD != allOutputs.end()){
-        std::cout << *itD << " ";
-        for (std::vector<request>::iterator itR = itMapD->second.begin(); itR != itMapD->second.end(); itR++)
-          std::cout << "(" << itR->type << "," << itR->target << ")";
-        std::cout << std::endl;
-      }
-
+    for (std::vector<scheduledOutput>::iterator it = outputSchedule.begin(); it != outputSchedule.end(); it++) {
+      std::cout << "(" << it->type << "," << it->target << "," << it->domain << ") ";
+      std::cout << it->startTime << " : " << it->frequency << " : " << it->endTime << std::endl;
     }
     std::cout << "**************************************" << std::endl;
   }
@@ -36,6 +36,10 @@ along with piccante.  If not, see <http://www.gnu.org/licenses/>.
 #include <vector>
 #include <list>
 #include <map>
+#include <queue>
+#include <deque>
+#include <functional>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -58,6 +62,9 @@ along with piccante.  If not, see <http://www.gnu.org/licenses/>.
 
 #define SPEC_DIAG_COMP 14
 #define FIELD_DIAG_COMP 14
+#define STREAM_FRAME_MAGIC 0x50494353
+//an HDF5 grid chunk aligned to the task boxes is used if it is at least 1/HDF5_MIN_CHUNK_FRACTION of the largest box
+#define HDF5_MIN_CHUNK_FRACTION 8
 
 enum diagType{
   OUT_E_FIELD,
@@ -66,7 +73,10 @@ enum diagType{
   OUT_DIAG,
   OUT_CURRENT,
   OUT_EB_PROBE,
-  OUT_SPEC_DENSITY
+  OUT_SPEC_DENSITY,
+  OUT_SPEC_TRACK,
+  OUT_SPEC_HISTOGRAM,
+  OUT_FIELD_ACCUMULATOR
 };
 
 enum whichFieldOut{
@@ -75,6 +85,54 @@ enum whichFieldOut{
   WHICH_E_AND_B
 };
 
+enum outputCompression{
+  COMPRESSION_NONE,
+  COMPRESSION_LOSSLESS,
+  COMPRESSION_QUANTIZED
+};
+
+enum phaseSpaceComponent{
+  PS_X = 1 << 0,
+  PS_Y = 1 << 1,
+  PS_Z = 1 << 2,
+  PS_PX = 1 << 3,
+  PS_PY = 1 << 4,
+  PS_PZ = 1 << 5,
+  PS_W = 1 << 6,
+  PS_MARKER = 1 << 7,
+  PS_ALL = (1 << 8) - 1
+};
+
+//particle quantities which can be binned by an outHistogram; HIST_EKIN is gamma-1 (as in the spectrum),
+//HIST_THETA the angle between p and the x axis, HIST_PHI_XY (HIST_PHI_XZ) the angle of p in the x-y (x-z) plane
+enum histogramQuantity{
+  HIST_X,
+  HIST_Y,
+  HIST_Z,
+  HIST_PX,
+  HIST_PY,
+  HIST_PZ,
+  HIST_GAMMA,
+  HIST_EKIN,
+  HIST_THETA,
+  HIST_PHI_XY,
+  HIST_PHI_XZ
+};
+
+//quantities summed by an outAccumulator at the grid points: |E|^2, |B|^2, J.E and the density of a species
+enum accumulatorQuantity{
+  ACC_E2,
+  ACC_B2,
+  ACC_JE,
+  ACC_SPEC_DENSITY
+};
+
+enum planType{
+  PLAN_GRID,
+  PLAN_SLICE,
+  PLAN_PARTICLES
+};
+
 
 struct request{
   double dtime;
@@ -82,6 +140,129 @@ struct request{
   diagType type;
   int target;
   int domain;
+  bool last;
+};
+
+//a periodic output, expanded one request at a time: it fires at dtime, then dtime += frequency while dtime <= endTime
+struct scheduledOutput{
+  diagType type;
+  int target;
+  int domain;
+  double startTime, frequency, endTime;
+  double dtime;
+};
+
+struct stagedWrite{
+  MPI_Request request;
+  void *buffer;
+  long int bytes;
+};
+
+//communicator and layout of the output files of a domain
+struct outputPlan{
+  double gridXmin;
+  int remains[3];
+  int imin[3], locimin[3];
+  int uniqueN[3], uniqueLocN[3], slice_rNproc[3];
+  int fineFirst[3], decimation[3], sampleN[3], sampleLocN[3], sampleFirst[3];
+  bool average;
+  std::vector<int> lineStart[3], lineEnd[3];
+  int ri[3], globalri[3];
+  int shouldIWrite, myOutputID;
+  MPI_Offset pointsBefore;
+  MPI_Comm outputCommunicator;
+  MPI_Comm aggregationCommunicator;
+  int subfileID;
+  int domain;
+};
+
+//one entry per writing task in the .idx file of a subfiled output: the block that the task would
+//write at fileOffset of the single file is at subfileOffset of subfile <name>.<subfile>
+struct subfileIndexEntry{
+  int task;
+  int subfile;
+  int box[6];
+  int64_t fileOffset;
+  int64_t subfileOffset;
+  int64_t bytes;
+};
+
+//header of a streamed frame, followed by nameLength chars (file name without the directory)
+//and bytes of payload: the block that the task writes (or would write) at fileOffset of the file
+struct streamFrameHeader{
+  int magic;
+  int task, tasks;
+  int nameLength;
+  int box[6];
+  int64_t fileOffset;
+  int64_t bytes;
+};
+
+//frames with the same key (output without time, task) replace each other in the queue
+struct streamFrame{
+  std::string key;
+  std::vector<char> data;
+};
+
+//one entry per chunk in the index of a compressed (.zbin) grid output
+struct chunkIndexEntry{
+  int offset[3];
+  int n[3];
+  int64_t fileOffset;
+  int64_t bytes;
+};
+
+//particles selected once, with the filters of the domain, and followed at every output
+struct trackingOutput{
+  int domain;
+  int maxParticles;
+  bool selected;
+  int components;
+  std::string fileName;
+};
+
+struct outHistogram{
+  int nAxes;
+  histogramQuantity quantity[3];
+  int nbins[3];
+  double range[3][2];
+  bool weighted;
+  std::string name;
+  outHistogram();
+  void addAxis(histogramQuantity q, int n, double min, double max);
+  void setWeighted(bool flag);
+  void setName(std::string iname);
+};
+
+struct outAccumulator{
+  accumulatorQuantity quantity;
+  std::string species;
+  bool average;
+  std::string name;
+  outAccumulator();
+  void setQuantity(accumulatorQuantity q);
+  void setSpeciesDensity(std::string specName);
+  void setAverage(bool flag);
+  void setName(std::string iname);
+};
+
+//running sum of an accumulator on the local grid points (itimes of the end of the window and of the last sample)
+struct accumulatorOutput{
+  outAccumulator *acc;
+  int spec;
+  int everySteps, windowSteps;
+  int windowEnd;
+  int samples;
+  double gridXmin;
+  std::vector<double> values;
+};
+
+//binary probe sample, as written by the buffered probe output
+struct probeRecord{
+  int probe;
+  int itime;
+  double time;
+  float EB[6];
 };
 
 struct emProbe{
@@ -100,6 +281,21 @@ struct outDomain{
   double rmin[3], rmax[3];
   bool overrideFlag;
   bool followMovingWindowFlag;
+  int decimation[3];
+  bool decimationAverage;
+  outputCompression compression;
+  double compressionTolerance;
+  int chunkSize[3];
+  double gammaRange[2];
+  bool coneFlag;
+  double coneAxis[3], coneCosAngle;
+  bool markerFlag;
+  long int markerRange[2];
+  int particleStride;
+  double sampleFraction;
+  int sampleSeed;
+  int phaseSpaceComponents;
+  bool streamFlag, streamFiles;
   std::string name;
   outDomain();
   bool compareDomains(outDomain* rhs);
@@ -110,11 +306,25 @@ struct outDomain{
   void setYRange(double min, double max);
   void setZRange(double min, double max);
   void followMovingWindow();
+  void setStride(int sx, int sy, int sz);
+  void setBlockAverage(int fx, int fy, int fz);
+  void setCompression(outputCompression type, double tolerance);
+  void setChunkSize(int cx, int cy, int cz);
+  void setGammaRange(double min, double max);
+  void setMomentumCone(double ux, double uy, double uz, double halfAngle);
+  void setMarkerRange(long int min, long int max);
+  void setParticleStride(int stride);
+  void setRandomSubsampling(double fraction, int seed);
+  void setPhaseSpaceComponents(int components);
+  void setStreaming(bool withFiles);
 };
 
 bool requestCompTime(const request &first, const request &second);
 bool requestCompUnique(const request &first, const request &second);
 
+void compressFieldChunk(std::vector<char> &out, float *values, int n[3], int Ncomp, outputCompression codec, double tolerance);
+bool decompressFieldChunk(float *values, int n[3], int Ncomp, const char *in, int64_t bytes, double tolerance);
+
 class OUTPUT_MANAGER
 {
 
@@ -123,7 +333,14 @@ public:
   ~OUTPUT_MANAGER();
 
   void initialize(std::string _outputDir);
+  void initialize(std::string _outputDir, MPI_Info hints);
+  void setIOHint(std::string key, std::string value);
   void close();
+  void setAsyncOutput(long int bufferBytes);
+  void setProbeBuffer(int steps, bool gatherToOneFile);
+  void setSubfiling(int nSubfiles);
+  void setStreaming(std::string socketPath, long int queueBytes);
+  void setHDF5Output(int deflateLevel);
 
   void addEBFieldFrom(double startTime, double frequency);
   void addEBFieldAt(double atTime);
@@ -177,6 +394,16 @@ public:
   void addSpeciesPhaseSpaceAt(std::string name, double atTime);
   void addSpeciesPhaseSpaceFromTo(std::string name, double startTime, double frequency, double endTime);
 
+  void addSpeciesTrackingFrom(outDomain* domain_in, std::string name, int maxParticles, double startTime, double frequency);
+  void addSpeciesTrackingFromTo(outDomain* domain_in, std::string name, int maxParticles, double startTime, double frequency, double endTime);
+
+  void addSpeciesHistogramFrom(outDomain* domain_in, outHistogram* hist, std::string name, double startTime, double frequency);
+  void addSpeciesHistogramAt(outDomain* domain_in, outHistogram* hist, std::string name, double atTime);
+  void addSpeciesHistogramFromTo(outDomain* domain_in, outHistogram* hist, std::string name, double startTime, double frequency, double endTime);
+
+  void addFieldAccumulatorFrom(outDomain* domain_in, outAccumulator* acc, double startTime, int everySteps, double window);
+  void addFieldAccumulatorFromTo(outDomain* domain_in, outAccumulator* acc, double startTime, int everySteps, double window, double endTime);
+
   void addDiagFrom(double startTime, double frequency);
   void addDiagAt(double atTime);
   void addDiagFromTo(double startTime, double frequency, double endTime);
@@ -206,12 +433,22 @@ private:
   bool isThereDiag;
   bool isThereEMProbe;
 
+  // probe samples are kept in probeBuffer and written in binary every probeFlushSteps probe outputs
+  // (0: one text line per sample), in a file per task or gathered in a single file by the master
+  int probeFlushSteps, probeBufferedSteps;
+  bool probeGather;
+  std::vector<probeRecord> probeBuffer;
+  std::ofstream probeFile;
+  void openProbeFile(std::string fileName);
+  void flushProbeBuffer();
+
   bool checkGrid();
   bool checkEMField();
   bool checkCurrent();
   bool checkSpecies();
   bool isThePointInMyDomain(double rr[3]);
   bool amIInTheSubDomain(request req);
+  bool amIInTheSubDomain(int domain);
   void nearestInt(double rr[3], int *ri, int *globalri);
   void setAndCheckRemains(int *remains, bool remainingCoord[]);
   void findLocalIntegerBoundaries(double rmin[3], double rmax[3], int *imin, int *imax);
@@ -226,9 +463,73 @@ private:
   std::string extremaFieldFileName;
   std::vector<std::string> extremaSpecFileNames;
 
-  std::list<request> requestList;
-  std::vector<int> timeList;
-  std::map< int, std::vector<request> > allOutputs;
+  // MPI-IO hints (e.g. ROMIO cb_nodes, striping_factor) passed to every MPI_File_open
+  MPI_Info ioInfo;
+
+  // asynchronous output: at most asyncBudget bytes staged, files closed at the next output step or in close()
+  bool asyncOutput;
+  long int asyncBudget, stagedBytes;
+  std::list<stagedWrite> stagedWrites;
+  std::vector<MPI_File> pendingFiles;
+  stagedWrite* stageOutputBuffer(void *buf, int count, MPI_Datatype datatype);
+  void outputWrite(MPI_File thefile, void *buf, int count, MPI_Datatype datatype);
+  void outputWriteAtAll(MPI_File thefile, MPI_Offset disp, void *buf, int count, MPI_Datatype datatype);
+  void outputClose(MPI_File *thefile);
+
+  // subfiling: the tasks of an output send their blocks to subfileNumber aggregators (0: single shared file)
+  int subfileNumber;
+  void prepareAggregation(outputPlan *plan);
+  void writeOutputBlocks(std::string fileName, outputPlan *plan, MPI_Offset disp, void *buf, int count, MPI_Datatype datatype, int *box);
+  void completeOldestWrite();
+  void completePendingOutput();
+
+  // streaming: the blocks of the streamed domains are queued (at most streamBudget bytes) and sent
+  // without blocking to a consumer listening on the unix socket streamPath
+  std::string streamPath;
+  long int streamBudget, streamQueuedBytes;
+  long int streamDropped, streamCoalesced;
+  int streamSocket;
+  size_t streamSent;
+  std::deque<streamFrame> streamQueue;
+  void streamBlock(std::string fileName, int task, int tasks, int *box, MPI_Offset disp, void *buf, long int bytes);
+  void pumpStream();
+  void closeStream();
+  void finishStream();
+
+  // HDF5 output: the domain outputs of a step are written in one file, a group per output
+  bool hdf5Output;
+  int hdf5Deflate;
+#if defined(USE_HDF5)
+  hid_t hdf5File;
+  void openHDF5File(request req);
+  void closeHDF5File();
+  hid_t createHDF5Group(std::string fileName, request req);
+  hid_t createHDF5Dataset(hid_t group, const char *name, hid_t type, int rank, hsize_t *dims, hsize_t *chunk);
+  void writeHDF5Dataset(hid_t dataset, hid_t type, int rank, hsize_t *offset, hsize_t *count, const void *buf);
+  void writeHDF5Attribute(hid_t object, const char *name, hid_t type, int n, const void *values);
+  void writeGridFieldHDF5(std::string fileName, request req);
+  void writeSpecPhaseSpaceHDF5(std::string fileName, request req);
+  void writeSpecHistogramHDF5(std::string fileName, request req, std::vector<double> &bins);
+#endif
+
+  // densities are deposited on densityScratch, one component per species (densityComp, -1 if never requested)
+  CURRENT densityScratch;
+  std::vector<int> densityComp;
+  void allocateDensityScratch();
+
+  // plans are built once per (domain, planType) and rebuilt only when the window has moved
+  std::map<std::pair<int, int>, outputPlan> outputPlans;
+  void prepareOutputPlans();
+  outputPlan* getOutputPlan(int domain, planType type);
+  void buildGridOutputPlan(outputPlan *plan, int domain);
+  void buildSliceOutputPlan(outputPlan *plan, int domain);
+  void buildParticleOutputPlan(outputPlan *plan, int domain);
+  void depositSpecDensities(std::vector<request> &diagList);
+
+  // outputs fire lazily: nextOutputs holds (step, index in outputSchedule) of the next request of each series
+  std::vector<scheduledOutput> outputSchedule;
+  std::priority_queue<std::pair<int, int>, std::vector<std::pair<int, int> >, std::greater<std::pair<int, int> > > nextOutputs;
+  bool pushScheduledOutput(int id);
 
   static const int diagWideWidth = 16;
   static const int diagNarrowWidth = 6;
@@ -241,11 +542,14 @@ private:
   void addSpeciesDensity(outDomain* domain_in, std::string name, double startTime, double frequency, double endTime);
   void addCurrent(outDomain* domain_in, double startTime, double frequency, double endTime);
   void addSpeciesPhaseSpace(outDomain* domain_in, std::string name, double startTime, double frequency, double endTime);
+  void addSpeciesTracking(outDomain* domain_in, std::string name, int maxParticles, double startTime, double frequency, double endTime);
+  void addSpeciesHistogram(outDomain* domain_in, outHistogram* hist, std::string name, double startTime, double frequency, double endTime);
+  void addFieldAccumulator(outDomain* domain_in, outAccumulator* acc, double startTime, int everySteps, double window, double endTime);
   void addDiag(double startTime, double frequency, double endTime);
 
-  void addRequestToList(std::list<request>& timeList, diagType type, int target, int domain, double startTime, double frequency, double endTime);
+  void addRequestToList(std::vector<scheduledOutput>& schedule, diagType type, int target, int domain, double startTime, double frequency, double endTime);
 
-  void prepareOutputMap();
+  void prepareOutputSchedule();
 
   void createDiagFile();
   void createExtremaFiles();
@@ -257,12 +561,13 @@ private:
   std::string composeOutputName(std::string dir, std::string out, std::string opt1, std::string opt2, int domain, double time, std::string ext);
   void writeEMFieldBinary(std::string fileName, request req);
   void writeNewEMFieldBinary(std::string fileName, request req, int comp);
-  void writeEMFieldBinaryHDF5(std::string fileName, request req);
 
   void callEMFieldProbe(request req);
   void interpolateEBFieldsToPosition(double pos[3], double E[3], double B[3]);
 
   void writeGridFieldSubDomain(std::string fileName, request req);
+  void writeCompressedGridFieldSubDomain(std::string fileName, request req);
+  std::string gridOutputExtension(int domain);
   void callEMFieldDomain(request req);
 
   void writeSpecDensity(std::string fileName, request req);
@@ -276,6 +581,24 @@ private:
   void writeSpecPhaseSpaceSubDomain(std::string fileName, request req);
   void callSpecPhaseSpace(request req);
 
+  // one tracked set per species, selected at the first output of the series
+  std::map<int, trackingOutput> myTrackings;
+  void selectTrackedParticles(request req);
+  void writeSpecTracking(request req);
+  void callSpecTracking(request req);
+
+  // the target of an OUT_SPEC_HISTOGRAM request is the index in myHistograms, each one bins a species
+  std::vector<outHistogram*> myHistograms;
+  std::vector<int> histogramSpecies;
+  void writeSpecHistogram(std::string fileName, request req);
+  void callSpecHistogram(request req);
+
+  // the target of an OUT_FIELD_ACCUMULATOR request is the index in myAccumulators
+  std::vector<accumulatorOutput> myAccumulators;
+  void shiftAccumulator(accumulatorOutput &accum);
+  void accumulateFieldValues(accumulatorOutput &accum);
+  void callFieldAccumulator(request req);
+
 
   void callDiag(request req);
 
@@ -283,15 +606,17 @@ private:
   int findRightNeightbourPoint(double val, double* coords, int numcoords);
 
   void prepareIntegerBigHeader(int *itodo, int uniqueN[3], int slice_rNproc[3], int Ncomp);
-  void prepareFloatCoordinatesHeader(float *fcir[3], int uniqueN[3], int imin[3]);
-  void writeBigHeader(MPI_File thefile, int uniqueN[3], int imin[3], int slice_rNproc[3], int Ncomp);
-  void prepareIntegerSmallHeader(int *itodo, int uniqueLocN[3], int imin[3], int remains[3]);
-  void writeSmallHeader(MPI_File thefile, int uniqueLocN[3], int imin[3], int remains[3]);
+  void prepareFloatCoordinatesHeader(float *fcir[3], int uniqueN[3], int imin[3], int decimation[3], bool average);
+  int packBigHeader(float *block, outputPlan *plan, int Ncomp);
+  int packSmallHeader(float *block, outputPlan *plan);
   void prepareFloatField(float *todo, int uniqueLocN[3], int origin[3], request req);
-  void findDispForSetView(MPI_Offset *disp, int myOutputID, int *totUniquePoints, int big_header, int small_header, int Ncomp);
   void setLocalOutputOffset(int *origin, int locimin[3], int ri[3], int remains[3]);
-  void writeCPUFieldValues(MPI_File thefile, int uniqueLocN[3], int locimin[3], int remains[3], request req);
-  int findNumberOfParticlesInSubdomain(request req);
+  int packCPUFieldValues(float *block, outputPlan *plan, request req);
+  void decimateFieldValues(float *block, float *fine, outputPlan *plan, int Ncomp);
+  void averageAlongAxis(std::vector<double> &values, int dims[3], int axis, outputPlan *plan, int Ncomp);
+  int findBlockOwner(std::vector<int> &qStart, std::vector<int> &qEnd, int point);
+  int selectParticlesInSubdomain(request req, std::vector<int> &selected);
+  int packPhaseSpaceParticle(float *buf, SPECIE *spec, int p, int components, double weightScale);
   int findNcompForThisGridOutput(request req);
   void writeEBFieldDomain(std::string fileName, request req);
 
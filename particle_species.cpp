@@ -28,6 +28,7 @@ SPECIE::SPECIE()
   isTestSpecies = false;
   spectrum.values = NULL;
   energyExtremesFlag = false;
+  reductionOffset[0] = -1;
   lastParticle = 0;
   flagWithMarker = false;
 }
@@ -40,6 +41,7 @@ SPECIE::SPECIE(GRID *grid)
   isTestSpecies = false;
   spectrum.values = NULL;
   energyExtremesFlag = false;
+  reductionOffset[0] = -1;
   lastParticle = 0;
   flagWithMarker = false;
 }
@@ -48,11 +50,11 @@ void SPECIE::allocate_species()
   if (mygrid->with_particles == NO)
     return;
 #ifdef _ACC_SINGLE_POINTER
-  val = (double*)malloc((Np*Ncomp)*sizeof(double));
+  val = (double*)bigArrays::allocate((Np*Ncomp)*sizeof(double), MEM_PARTICLES, Np);
 #else
   val = (double**)malloc(Ncomp*sizeof(double*));
   for (int c = 0; c < Ncomp; c++){
-    val[c] = (double*)malloc(Np*sizeof(double));
+    val[c] = (double*)bigArrays::allocate(Np*sizeof(double), MEM_PARTICLES, Np);
   }
 #endif
   valSize = Np;
@@ -61,10 +63,10 @@ void SPECIE::allocate_species()
 }
 SPECIE::~SPECIE(){
 #ifdef _ACC_SINGLE_POINTER
-  free(val);
+  bigArrays::release(val);
 #else
   for (int c = 0; c < Ncomp; c++){
-    free(val[c]);
+    bigArrays::release(val[c]);
   }
   free(val);
 #endif
@@ -80,10 +82,10 @@ void SPECIE::erase()
     exit(11);
   }
 #ifdef _ACC_SINGLE_POINTER
-  memset((void*)val, 0, (Np*Ncomp)*sizeof(double));
+  bigArrays::parallelZero((void*)val, (Np*Ncomp)*sizeof(double), Np);
 #else
   for (int c = 0; c < Ncomp; c++){
-    memset((void*)val[c], 0, Np*sizeof(double));
+    bigArrays::parallelZero((void*)val[c], Np*sizeof(double), Np);
   }
 #endif
 }
@@ -100,20 +102,20 @@ void SPECIE::reallocate_species()
   if (Np > valSize){
     valSize = Np + allocsize;
 #ifdef _ACC_SINGLE_POINTER
-    val = (double *)realloc((void*)val, valSize*Ncomp*sizeof(double));
+    val = (double *)bigArrays::reallocate((void*)val, valSize*Ncomp*sizeof(double), MEM_PARTICLES, valSize);
 #else
     for (int c = 0; c < Ncomp; c++){
-      val[c] = (double *)realloc((void*)val[c], valSize*sizeof(double));
+      val[c] = (double *)bigArrays::reallocate((void*)val[c], valSize*sizeof(double), MEM_PARTICLES, valSize);
     }
 #endif
   }
   else if (Np < (valSize - allocsize)){
     valSize = Np + allocsize;
 #ifdef _ACC_SINGLE_POINTER
-    val = (double *)realloc((void*)val, valSize*Ncomp*sizeof(double));
+    val = (double *)bigArrays::reallocate((void*)val, valSize*Ncomp*sizeof(double), MEM_PARTICLES, valSize);
 #else
     for (int c = 0; c < Ncomp; c++){
-      val[c] = (double *)realloc((void*)val[c], valSize*sizeof(double));
+      val[c] = (double *)bigArrays::reallocate((void*)val[c], valSize*sizeof(double), MEM_PARTICLES, valSize);
     }
 #endif
   }
@@ -176,6 +178,31 @@ bool SPECIE::amIWithMarker(){
   return flagWithMarker;
 }
 
+void SPECIE::setTrackedParticles(std::vector<long int> &markers){
+  if (!flagWithMarker){
+    printf("ERROR: species %s needs markers (addMarker) to track particles\n", name.c_str());
+    exit(17);
+  }
+  trackedMarkers = markers;
+  std::sort(trackedMarkers.begin(), trackedMarkers.end());
+  findTrackedParticles();
+}
+
+//full search, only needed when the tracked set changes
+void SPECIE::findTrackedParticles(){
+  trackedIndex.clear();
+  if (trackedMarkers.empty())
+    return;
+  for (int p = 0; p < Np; p++){
+    if (isTracked(marker(p)))
+      trackedIndex.push_back(p);
+  }
+}
+
+bool SPECIE::isTracked(long int id){
+  return std::binary_search(trackedMarkers.begin(), trackedMarkers.end(), id);
+}
+
 void SPECIE::computeParticleMassChargeCoupling(){
   if (type == ELECTRON){
     coupling = -1.;
@@ -768,7 +795,10 @@ void SPECIE::move_window()
   if (!mygrid->shouldIMove)
     return;
 
-  SPECIE::position_parallel_pbc();
+  //the window moves only along x: the particles left behind by the local domains
+  //are passed to the left neighbours by a single x exchange; unless x is periodic,
+  //those leaving the left edge of the window are dropped instead of being wrapped
+  exchangeParticlesAlong(0, mygrid->getXBoundaryConditions() != _PBC);
 
   double plasmarmin[3], plasmarmax[3];
   setLocalPlasmaMinimaAndMaxima(plasmarmin, plasmarmax);
@@ -796,6 +826,18 @@ void SPECIE::move_window()
   }
 
 }
+//tiles holding at least one particle
+void SPECIE::markActiveTiles(std::vector<int> &activity){
+  for (int p = 0; p < Np; p++){
+    double rr;
+    if (mygrid->isStretched())
+      rr = mygrid->dri[0] * (mygrid->unStretchGrid(r0(p), 0) - mygrid->csiminloc[0]);
+    else
+      rr = mygrid->dri[0] * (r0(p) - mygrid->rminloc[0]);
+    activity[mygrid->getActiveTileOf((int)floor(rr))] = 1;
+  }
+}
+
 //void SPECIE::output_bin(ofstream &ff)
 //{
 //	if (mygrid->with_particles == NO)
@@ -1012,94 +1054,118 @@ void SPECIE::position_parallel_pbc()
   if (mygrid->with_particles == NO)
     return;
 
+  for (int direction = 0; direction < accesso.dimensions; direction++)
+    exchangeParticlesAlong(direction);
+}
+
+//moves to the neighbours (or wraps, for the boundary processors) the particles outside the local domain along "direction"
+//with dropAtLeftEdge the particles leaving the global left edge are discarded instead of being wrapped
+//the particles which are kept are compacted in place, the send buffers grow geometrically
+void SPECIE::exchangeParticlesAlong(int direction, bool dropAtLeftEdge)
+{
   int p, c;
   int nlost, nnew, nold;
   int ninright, ninleft, nright, nleft;
-  ninright = ninleft = nright = nleft = 0;
-  double *sendr_buffer = NULL, *sendl_buffer = NULL, *recv_buffer = NULL;
+  int sizeRight, sizeLeft;
+  static double *sendr_buffer = NULL, *sendl_buffer = NULL, *recv_buffer = NULL;
+  static int allocatedRight = 0, allocatedLeft = 0, allocatedRecv = 0;
   MPI_Status status;
   int iright, ileft;
-  /*
-      si potrebbe cambiare in questo senso:
-      se una particella è persa, la scambio con l'ultima particella attiva e diminiusco di uno il numero di particelle attive
-      se anche questa è da buttare via, proseguon nella ricerca di partcielle buone con la penultima attiva fino a quando non trovo una buana
-      da sostiuire a quella in esame
-      così dicendo riduco Np_loc che è anche l'estremo del ciclo for
-
-      */
-
 
-  for (int direction = 0; direction < accesso.dimensions; direction++)
+  nlost = 0;
+  ninright = ninleft = nright = nleft = 0;
+  sizeRight = sizeLeft = 0;
+  size_t nextTracked = 0, nTracked = 0;
+  for (p = 0; p < Np; p++)
   {
-    nlost = 0;
-    ninright = ninleft = nright = nleft = 0;
-    for (p = 0; p < Np; p++)
+    bool tracked = (nextTracked < trackedIndex.size() && trackedIndex[nextTracked] == p);
+    if (tracked)
+      nextTracked++;
+    if (ru(direction, p) > mygrid->rmaxloc[direction])
     {
-      if (ru(direction, p) > mygrid->rmaxloc[direction])
-      {
-        nlost++;
-        nright++;
-        if (mygrid->rmyid[direction] == mygrid->rnproc[direction] - 1)
-          ru(direction, p) -= (mygrid->rmax[direction] - mygrid->rmin[direction]);
-        sendr_buffer = (double*)realloc(sendr_buffer, nright*Ncomp*sizeof(double));
-        for (c = 0; c < Ncomp; c++)
-          sendr_buffer[c + Ncomp*(nright - 1)] = ru(c, p);
-
+      nlost++;
+      nright++;
+      if (mygrid->rmyid[direction] == mygrid->rnproc[direction] - 1)
+        ru(direction, p) -= (mygrid->rmax[direction] - mygrid->rmin[direction]);
+      sizeRight = nright*Ncomp;
+      if (sizeRight > allocatedRight){
+        allocatedRight = MAX(2 * allocatedRight, allocsize*Ncomp);
+        sendr_buffer = (double*)realloc(sendr_buffer, allocatedRight*sizeof(double));
       }
-      else if (ru(direction, p) < mygrid->rminloc[direction])
-      {
-        nlost++;
-        nleft++;
-        if (mygrid->rmyid[direction] == 0)
-          ru(direction, p) += (mygrid->rmax[direction] - mygrid->rmin[direction]);
-        sendl_buffer = (double*)realloc(sendl_buffer, nleft*Ncomp*sizeof(double));
-        for (c = 0; c < Ncomp; c++)
-          sendl_buffer[c + Ncomp*(nleft - 1)] = ru(c, p);
+      for (c = 0; c < Ncomp; c++)
+        sendr_buffer[c + Ncomp*(nright - 1)] = ru(c, p);
+
+    }
+    else if (ru(direction, p) < mygrid->rminloc[direction])
+    {
+      nlost++;
+      if (dropAtLeftEdge && mygrid->rmyid[direction] == 0)
+        continue;
+      nleft++;
+      if (mygrid->rmyid[direction] == 0)
+        ru(direction, p) += (mygrid->rmax[direction] - mygrid->rmin[direction]);
+      sizeLeft = nleft*Ncomp;
+      if (sizeLeft > allocatedLeft){
+        allocatedLeft = MAX(2 * allocatedLeft, allocsize*Ncomp);
+        sendl_buffer = (double*)realloc(sendl_buffer, allocatedLeft*sizeof(double));
       }
-      else
-      {
+      for (c = 0; c < Ncomp; c++)
+        sendl_buffer[c + Ncomp*(nleft - 1)] = ru(c, p);
+    }
+    else
+    {
+      if (tracked)
+        trackedIndex[nTracked++] = p - nlost;
+      if (nlost > 0){
         for (c = 0; c < Ncomp; c++)
           ru(c, p - nlost) = ru(c, p);
       }
     }
-    MPI_Cart_shift(mygrid->cart_comm, direction, 1, &ileft, &iright);
-    // ====== send right receive from left						
-    ninleft = 0;
-    MPI_Sendrecv(&nright, 1, MPI_INT, iright, 13,
-      &ninleft, 1, MPI_INT, ileft, 13,
-      MPI_COMM_WORLD, &status);
-    nnew = ninleft;
-
-    // ====== send left receive from right
-    ninright = 0;
-    MPI_Sendrecv(&nleft, 1, MPI_INT, ileft, 13,
-      &ninright, 1, MPI_INT, iright, 13,
-      MPI_COMM_WORLD, &status);
-    nnew += ninright;
-    recv_buffer = (double*)realloc(recv_buffer, nnew*Ncomp*sizeof(double));
-    // ====== send right receive from left				
-    MPI_Sendrecv(sendr_buffer, nright*Ncomp, MPI_DOUBLE, iright, 13,
-      recv_buffer, ninleft*Ncomp, MPI_DOUBLE, ileft, 13,
-      MPI_COMM_WORLD, &status);
-    MPI_Sendrecv(sendl_buffer, nleft*Ncomp, MPI_DOUBLE, ileft, 13,
-      (recv_buffer + ninleft*Ncomp), ninright*Ncomp, MPI_DOUBLE, iright, 13,
-      MPI_COMM_WORLD, &status);
-    nold = Np;
-    Np = Np - nlost + nnew;
-
-
-    reallocate_species();
+  }
+  trackedIndex.resize(nTracked);
+  MPI_Cart_shift(mygrid->cart_comm, direction, 1, &ileft, &iright);
+  // ====== send right receive from left
+  ninleft = 0;
+  MPI_Sendrecv(&nright, 1, MPI_INT, iright, 13,
+    &ninleft, 1, MPI_INT, ileft, 13,
+    MPI_COMM_WORLD, &status);
+  nnew = ninleft;
+
+  // ====== send left receive from right
+  ninright = 0;
+  MPI_Sendrecv(&nleft, 1, MPI_INT, ileft, 13,
+    &ninright, 1, MPI_INT, iright, 13,
+    MPI_COMM_WORLD, &status);
+  nnew += ninright;
+  if (nnew*Ncomp > allocatedRecv){
+    allocatedRecv = MAX(nnew*Ncomp, allocsize*Ncomp);
+    recv_buffer = (double*)realloc(recv_buffer, allocatedRecv*sizeof(double));
+  }
+  // ====== send right receive from left
+  MPI_Sendrecv(sendr_buffer, nright*Ncomp, MPI_DOUBLE, iright, 13,
+    recv_buffer, ninleft*Ncomp, MPI_DOUBLE, ileft, 13,
+    MPI_COMM_WORLD, &status);
+  MPI_Sendrecv(sendl_buffer, nleft*Ncomp, MPI_DOUBLE, ileft, 13,
+    (recv_buffer + ninleft*Ncomp), ninright*Ncomp, MPI_DOUBLE, iright, 13,
+    MPI_COMM_WORLD, &status);
+  nold = Np;
+  Np = Np - nlost + nnew;
+
+
+  reallocate_species();
 
+  for (int pp = 0; pp < nnew; pp++){
+    for (c = 0; c < Ncomp; c++){
+      ru(c, pp + nold - nlost) = recv_buffer[pp*Ncomp + c];
+    }
+  }
+  //the tracked particles coming from the neighbours are recognised by their marker
+  if (trackedMarkers.size()){
     for (int pp = 0; pp < nnew; pp++){
-      for (c = 0; c < Ncomp; c++){
-        ru(c, pp + nold - nlost) = recv_buffer[pp*Ncomp + c];
-      }
+      if (isTracked(marker(pp + nold - nlost)))
+        trackedIndex.push_back(pp + nold - nlost);
     }
   }
-
-  free(sendl_buffer);
-  free(sendr_buffer);
-  free(recv_buffer);
 }
 void SPECIE::position_obc()
 {
@@ -1117,8 +1183,12 @@ void SPECIE::position_obc()
       così dicendo riduco Np_loc che è anche l'estremo del ciclo for
 
       */
+  size_t nextTracked = 0, nTracked = 0;
   for (p = 0; p < Np; p++)
   {
+    bool tracked = (nextTracked < trackedIndex.size() && trackedIndex[nextTracked] == p);
+    if (tracked)
+      nextTracked++;
     for (c = 0; c < Ncomp; c++)
       ru(c, p - nlost) = ru(c, p);
 
@@ -1127,6 +1197,8 @@ void SPECIE::position_obc()
       nlost++;
       continue;
     }
+    if (tracked)
+      trackedIndex[nTracked++] = p - nlost;
 
     if (ru(1, p) > mygrid->rmaxloc[1])
       ru(1, p) -= (mygrid->rmaxloc[1] - mygrid->rminloc[1]);
@@ -1141,6 +1213,7 @@ void SPECIE::position_obc()
 
 
   }
+  trackedIndex.resize(nTracked);
   Np -= nlost;
   reallocate_species();
 }
@@ -2924,6 +2997,12 @@ void SPECIE::currentStretchedDepositionStandard(CURRENT *current)
 
 }
 void SPECIE::density_deposition_standard(CURRENT *current)
+{
+  density_deposition_standard(current, 3);
+}
+
+//deposits on the component comp of current (3 is the density of a standard CURRENT)
+void SPECIE::density_deposition_standard(CURRENT *current, int comp)
 {
   if (mygrid->with_particles == NO){
     return;
@@ -2931,7 +3010,7 @@ void SPECIE::density_deposition_standard(CURRENT *current)
 
 
   if (mygrid->isStretched()){
-    SPECIE::densityStretchedDepositionStandard(current);
+    SPECIE::densityStretchedDepositionStandard(current, comp);
     return;
   }
 
@@ -2976,7 +3055,7 @@ void SPECIE::density_deposition_standard(CURRENT *current)
             i1 = i + wii[0] - 1;
 
             dvol = wiw[0][i] * wiw[1][j] * wiw[2][k],
-              current->density(i1, j1, k1) += w(p)*dvol;
+              current->JJ(comp, i1, j1, k1) += w(p)*dvol;
           }
         }
       }
@@ -2991,7 +3070,7 @@ void SPECIE::density_deposition_standard(CURRENT *current)
         {
           i1 = i + wii[0] - 1;
           dvol = wiw[0][i] * wiw[1][j],
-            current->density(i1, j1, k1) += w(p)*dvol;
+            current->JJ(comp, i1, j1, k1) += w(p)*dvol;
         }
       }
       break;
@@ -3002,14 +3081,14 @@ void SPECIE::density_deposition_standard(CURRENT *current)
       {
         i1 = i + wii[0] - 1;
         dvol = wiw[0][i],
-          current->density(i1, j1, k1) += w(p)*dvol;
+          current->JJ(comp, i1, j1, k1) += w(p)*dvol;
       }
       break;
     }
 
   }
 }
-void SPECIE::densityStretchedDepositionStandard(CURRENT *current)
+void SPECIE::densityStretchedDepositionStandard(CURRENT *current, int comp)
 {
   if (mygrid->with_particles == NO)
     return;
@@ -3058,7 +3137,7 @@ void SPECIE::densityStretchedDepositionStandard(CURRENT *current)
             i1 = i + wii[0] - 1;
 
             dvol = wiw[0][i] * wiw[1][j] * wiw[2][k],
-              current->density(i1, j1, k1) += myweight*dvol;
+              current->JJ(comp, i1, j1, k1) += myweight*dvol;
           }
         }
       }
@@ -3074,7 +3153,7 @@ void SPECIE::densityStretchedDepositionStandard(CURRENT *current)
         {
           i1 = i + wii[0] - 1;
           dvol = wiw[0][i] * wiw[1][j],
-            current->density(i1, j1, k1) += myweight*dvol;
+            current->JJ(comp, i1, j1, k1) += myweight*dvol;
         }
       }
       break;
@@ -3086,7 +3165,7 @@ void SPECIE::densityStretchedDepositionStandard(CURRENT *current)
       {
         i1 = i + wii[0] - 1;
         dvol = wiw[0][i],
-          current->density(i1, j1, k1) += myweight*dvol;
+          current->JJ(comp, i1, j1, k1) += myweight*dvol;
       }
       break;
     }
@@ -3137,6 +3216,19 @@ void SPECIE::computeKineticEnergyWExtrems(){
     return;
   }
 
+  packedReduction red;
+  addKineticEnergyWExtremsTo(red);
+  red.allreduce(MPI_COMM_WORLD);
+  getKineticEnergyWExtremsFrom(red);
+}
+
+// local energy, momentum and extrema, reduced by the caller together with other objects
+void SPECIE::addKineticEnergyWExtremsTo(packedReduction &red){
+  reductionOffset[0] = -1;
+  if (mygrid->with_particles == NO || !allocated || energyExtremesFlag){
+    return;
+  }
+
   const double VERY_BIG_NUM_POS = 1.0e30;
   const double VERY_BIG_NUM_NEG = -1.0e30;
 
@@ -3184,11 +3276,28 @@ void SPECIE::computeKineticEnergyWExtrems(){
   totalMomentum[1] *= mass*mygrid->dr[0] * mygrid->dr[1] * mygrid->dr[2] * mygrid->ref_den*M_PI / coupling*chargeSign;
   totalMomentum[2] *= mass*mygrid->dr[0] * mygrid->dr[1] * mygrid->dr[2] * mygrid->ref_den*M_PI / coupling*chargeSign;
 
+  double sums[4] = { energy, totalMomentum[0], totalMomentum[1], totalMomentum[2] };
+  reductionOffset[0] = red.addSums(sums, 4);
+  reductionOffset[1] = red.addMinima(minima, 7);
+  reductionOffset[2] = red.addMaxima(maxima, 7);
+}
+
+// reads back the reduced values and builds the spectrum, which needs the global Kmax
+void SPECIE::getKineticEnergyWExtremsFrom(packedReduction &red){
+  if (reductionOffset[0] < 0){
+    return;
+  }
+  double sums[4];
+  red.getSums(reductionOffset[0], sums, 4);
+  red.getMinima(reductionOffset[1], minima, 7);
+  red.getMaxima(reductionOffset[2], maxima, 7);
+  totalEnergy = sums[0];
+  totalMomentum[0] = sums[1];
+  totalMomentum[1] = sums[2];
+  totalMomentum[2] = sums[3];
+  reductionOffset[0] = -1;
 
-  MPI_Allreduce(&energy, &totalEnergy, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-  MPI_Allreduce(MPI_IN_PLACE, totalMomentum, 3, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-  MPI_Allreduce(MPI_IN_PLACE, minima, 7, MPI_DOUBLE, MPI_MIN, MPI_COMM_WORLD);
-  MPI_Allreduce(MPI_IN_PLACE, maxima, 7, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+  double gamma_minus_1;
 
   spectrum.Kmax = maxima[6];
   spectrum.Nbin = NBIN_SPECTRUM;
@@ -3243,7 +3352,7 @@ void SPECIE::reloadDump(std::ifstream &ff){
 void SPECIE::reloadBigBufferDump(std::ifstream &ff){
   ff.read((char*)&Np, sizeof(Np));
   SPECIE::reallocate_species();
-  ff.read((char*)&val, sizeof(double)*Np*Ncomp);
+  ff.read((char*)val, sizeof(double)*Np*Ncomp);
 }
 
 bool SPECIE::areEnergyExtremesAvailable(){
@@ -23,6 +23,8 @@ along with piccante.  If not, see <http://www.gnu.org/licenses/>.
 #define _USE_MATH_DEFINES
 
 #include <mpi.h>
+#include <vector>
+#include <algorithm>
 #include "commons.h"
 #include "structures.h"
 #include "grid.h"
@@ -64,6 +66,7 @@ public:
   void creation();
   void creationFromFile1D(std::string name);
   void move_window();
+  void markActiveTiles(std::vector<int> &activity);
   void addMarker();
   bool amIWithMarker();
   void output(std::ofstream &ff);
@@ -91,11 +94,14 @@ public:
   void current_deposition_standard(CURRENT *current);
   void currentStretchedDepositionStandard(CURRENT *current);
   void density_deposition_standard(CURRENT *current);
-  void densityStretchedDepositionStandard(CURRENT *current);
+  void density_deposition_standard(CURRENT *current, int comp);
+  void densityStretchedDepositionStandard(CURRENT *current, int comp);
   void setParticlesPerCellXYZ(int numX, int numY, int numZ);
   void setName(std::string iname);
   double getKineticEnergy();
   void computeKineticEnergyWExtrems();
+  void addKineticEnergyWExtremsTo(packedReduction &red);
+  void getKineticEnergyWExtremsFrom(packedReduction &red);
   void outputSpectrum(std::ofstream &fspectrum);
 
   void dump(std::ofstream &f);
@@ -108,6 +114,14 @@ public:
 
   void printParticleNumber();
 
+  //tracked particles: sorted markers (the same on every task) and sorted local indices,
+  //which follow the particles through the exchanges
+  std::vector<long int> trackedMarkers;
+  std::vector<int> trackedIndex;
+  void setTrackedParticles(std::vector<long int> &markers);
+  void findTrackedParticles();
+  bool isTracked(long int id);
+
 
   //PUBLIC INLINE FUNCTIONS
 #ifdef _ACC_SINGLE_POINTER
@@ -150,6 +164,7 @@ private:
   double savedExtrema[14];
   double savedEnergy;
   bool energyExtremesFlag;
+  int reductionOffset[3];
   bool flagWithMarker;
   void callWaterbag(gsl_rng* ext_rng, double p0_x, double p0_y, double p0_z, double uxin, double uyin, double uzin);
   void callUnifSphere(gsl_rng* ext_rng, double p0, double uxin, double uyin, double uzin);
@@ -172,6 +187,7 @@ private:
   void computeLorentzMatrix(double ux, double uy, double uz, double matr[16]);
 
   void debug_warning_particle_outside_boundaries(double x, double y, double z, int nump);
+  void exchangeParticlesAlong(int direction, bool dropAtLeftEdge = false);
 };
 
 
@@ -19,6 +19,12 @@ along with piccante.  If not, see <http://www.gnu.org/licenses/>.
 
 
 #include "structures.h"
+#if !defined(_MSC_VER)
+#include <sys/mman.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 
 /***************************************************************
@@ -704,3 +710,509 @@ void tempDistrib::setSpecial(double _a){
 
 //************** END DISTRIBUTION_FUNCTION ******
 
+
+//************** FILTER STACK ******
+filterStack::filterStack(){
+  clear();
+}
+
+void filterStack::clear(){
+  Npasses = 0;
+  Nbinomial = 0;
+}
+
+void filterStack::addPass(double _alpha){
+  if (Npasses >= MAX_FILTER_PASSES){
+    printf("ERROR: too many filter passes (max %i)\n", MAX_FILTER_PASSES);
+    exit(17);
+  }
+  alpha[Npasses++] = _alpha;
+}
+
+void filterStack::addBinomial(int times){
+  for (int n = 0; n < times; n++)
+    addPass(0.5);
+  Nbinomial += times;
+}
+
+void filterStack::addCompensator(){
+  addPass(1.0 + 0.5*Nbinomial);
+  Nbinomial = 0;
+}
+
+// line[] holds Npasses halo points on each side; on exit the inner Nline-2*Npasses points are filtered
+void filterStack::filterLine(double *line, double *work, int Nline){
+  double *in = line, *out = work;
+  for (int p = 0; p < Npasses; p++){
+    double a = alpha[p];
+    double b = 0.5*(1.0 - a);
+    for (int i = p + 1; i < Nline - p - 1; i++)
+      out[i] = a*in[i] + b*(in[i - 1] + in[i + 1]);
+    double *temp = in;
+    in = out;
+    out = temp;
+  }
+  if (in != line){
+    for (int i = Npasses; i < Nline - Npasses; i++)
+      line[i] = in[i];
+  }
+}
+
+// filters the components comps[] of a grid array (element (c,i,j,k) at origin[c + i*stride[0] + j*stride[1] + k*stride[2]])
+// along "direction", all the passes at once: a single halo of Npasses points is exchanged with the neighbours,
+// the ghost cells are NOT refreshed here
+template <class T> void filterStack::applyAlong(GRID *grid, int direction, T *origin, int stride[3], int ncomp, int *comps){
+  if (Npasses == 0)
+    return;
+  int d1 = (direction + 1) % 3, d2 = (direction + 2) % 3;
+  int N = grid->Nloc[direction];
+  int N1 = grid->Nloc[d1], N2 = grid->Nloc[d2];
+  int P = Npasses;
+  if (N < (P + 2)){
+    printf("ERROR: %i filter passes need at least %i local points along direction %i\n", P, P + 2, direction);
+    exit(17);
+  }
+  int Npencils = N1*N2;
+  int haloSize = ncomp*Npencils*P;
+
+  static T *sendl = NULL, *sendr = NULL, *recvl = NULL, *recvr = NULL;
+  static int allocatedHalo = 0;
+  if (haloSize > allocatedHalo){
+    allocatedHalo = haloSize;
+    sendl = (T*)realloc(sendl, haloSize*sizeof(T));
+    sendr = (T*)realloc(sendr, haloSize*sizeof(T));
+    recvl = (T*)realloc(recvl, haloSize*sizeof(T));
+    recvr = (T*)realloc(recvr, haloSize*sizeof(T));
+  }
+
+  // local point N-1 is the neighbour's 0: send [N-1-P, N-2] to the right and [1, P] to the left
+#pragma omp parallel for
+  for (int pen = 0; pen < Npencils; pen++){
+    T *base = origin + (pen % N1)*stride[d1] + (pen / N1)*stride[d2];
+    for (int n = 0; n < ncomp; n++){
+      T *line = base + comps[n];
+      int bb = (n*Npencils + pen)*P;
+      for (int h = 0; h < P; h++){
+        sendr[bb + h] = line[(N - 1 - P + h)*stride[direction]];
+        sendl[bb + h] = line[(1 + h)*stride[direction]];
+      }
+    }
+  }
+  memset((void*)recvl, 0, haloSize*sizeof(T));
+  memset((void*)recvr, 0, haloSize*sizeof(T));
+
+  MPI_Datatype mpiType = (sizeof(T) == sizeof(float)) ? MPI_FLOAT : MPI_DOUBLE;
+  int ileft, iright;
+  MPI_Status status;
+  MPI_Cart_shift(grid->cart_comm, direction, 1, &ileft, &iright);
+  MPI_Sendrecv(sendr, haloSize, mpiType, iright, 13,
+    recvl, haloSize, mpiType, ileft, 13,
+    MPI_COMM_WORLD, &status);
+  MPI_Sendrecv(sendl, haloSize, mpiType, ileft, 13,
+    recvr, haloSize, mpiType, iright, 13,
+    MPI_COMM_WORLD, &status);
+
+  int Nline = N + 2 * P;
+#pragma omp parallel
+  {
+    double *line = new double[Nline];
+    double *work = new double[Nline];
+#pragma omp for
+    for (int pen = 0; pen < Npencils; pen++){
+      T *base = origin + (pen % N1)*stride[d1] + (pen / N1)*stride[d2];
+      for (int n = 0; n < ncomp; n++){
+        T *field = base + comps[n];
+        int bb = (n*Npencils + pen)*P;
+        for (int h = 0; h < P; h++){
+          line[h] = recvl[bb + h];
+          line[N + P + h] = recvr[bb + h];
+        }
+        for (int i = 0; i < N; i++)
+          line[P + i] = field[i*stride[direction]];
+        filterLine(line, work, Nline);
+        for (int i = 0; i < N; i++)
+          field[i*stride[direction]] = line[P + i];
+      }
+    }
+    delete[] line;
+    delete[] work;
+  }
+}
+// E and B are stored as fieldType, J and the densities as double
+template void filterStack::applyAlong<float>(GRID *grid, int direction, float *origin, int stride[3], int ncomp, int *comps);
+template void filterStack::applyAlong<double>(GRID *grid, int direction, double *origin, int stride[3], int ncomp, int *comps);
+
+//************** END FILTER STACK ******
+
+//************** PACKED REDUCTION ******
+MPI_Op packedReduction::packedOp;
+bool packedReduction::packedOpCreated = false;
+
+packedReduction::packedReduction(){
+  clear();
+}
+
+void packedReduction::clear(){
+  sums.clear();
+  mins.clear();
+  maxs.clear();
+}
+
+int packedReduction::addSums(double *values, int n){
+  int offset = sums.size();
+  sums.insert(sums.end(), values, values + n);
+  return offset;
+}
+
+int packedReduction::addMinima(double *values, int n){
+  int offset = mins.size();
+  mins.insert(mins.end(), values, values + n);
+  return offset;
+}
+
+int packedReduction::addMaxima(double *values, int n){
+  int offset = maxs.size();
+  maxs.insert(maxs.end(), values, values + n);
+  return offset;
+}
+
+// buffer: [Nsum, Nmin, sums..., mins..., maxs...], the same layout on every task
+// the whole buffer is a single record of a contiguous datatype, so MPI cannot split it:
+// the record length comes from the datatype and *len records are reduced
+void packedReduction::packedOpFunction(void *invec, void *inoutvec, int *len, MPI_Datatype *datatype){
+  int recordBytes;
+  MPI_Type_size(*datatype, &recordBytes);
+  int Ntot = recordBytes / sizeof(double);
+  for (int r = 0; r < *len; r++){
+    double *in = (double*)invec + r*Ntot;
+    double *inout = (double*)inoutvec + r*Ntot;
+    int Nsum = (int)inout[0];
+    int Nmin = (int)inout[1];
+    int n = 2;
+    for (int i = 0; i < Nsum; i++, n++)
+      inout[n] += in[n];
+    for (int i = 0; i < Nmin; i++, n++)
+      inout[n] = MIN(inout[n], in[n]);
+    for (; n < Ntot; n++)
+      inout[n] = MAX(inout[n], in[n]);
+  }
+}
+
+void packedReduction::allreduce(MPI_Comm comm){
+  if (!packedOpCreated){
+    MPI_Op_create(packedOpFunction, 1, &packedOp);
+    packedOpCreated = true;
+  }
+  int Nsum = sums.size(), Nmin = mins.size(), Nmax = maxs.size();
+  int Ntot = 2 + Nsum + Nmin + Nmax;
+  double *buffer = new double[Ntot];
+  buffer[0] = Nsum;
+  buffer[1] = Nmin;
+  for (int i = 0; i < Nsum; i++)
+    buffer[2 + i] = sums[i];
+  for (int i = 0; i < Nmin; i++)
+    buffer[2 + Nsum + i] = mins[i];
+  for (int i = 0; i < Nmax; i++)
+    buffer[2 + Nsum + Nmin + i] = maxs[i];
+
+  MPI_Datatype recordType;
+  MPI_Type_contiguous(Ntot, MPI_DOUBLE, &recordType);
+  MPI_Type_commit(&recordType);
+  MPI_Allreduce(MPI_IN_PLACE, buffer, 1, recordType, packedOp, comm);
+  MPI_Type_free(&recordType);
+
+  for (int i = 0; i < Nsum; i++)
+    sums[i] = buffer[2 + i];
+  for (int i = 0; i < Nmin; i++)
+    mins[i] = buffer[2 + Nsum + i];
+  for (int i = 0; i < Nmax; i++)
+    maxs[i] = buffer[2 + Nsum + Nmin + i];
+  delete[] buffer;
+}
+
+void packedReduction::getSums(int offset, double *values, int n){
+  for (int i = 0; i < n; i++)
+    values[i] = sums[offset + i];
+}
+
+void packedReduction::getMinima(int offset, double *values, int n){
+  for (int i = 0; i < n; i++)
+    values[i] = mins[offset + i];
+}
+
+void packedReduction::getMaxima(int offset, double *values, int n){
+  for (int i = 0; i < n; i++)
+    values[i] = maxs[offset + i];
+}
+//************** END PACKED REDUCTION ******
+
+//************** FFT ******
+fftPlan::fftPlan(){
+  N = 0;
+}
+
+void fftPlan::init(int n){
+  N = n;
+  radix.clear();
+  twiddle.clear();
+  int rest = n;
+  for (int p = 2; p*p <= rest; p++){
+    while (rest%p == 0){
+      radix.push_back(p);
+      rest /= p;
+    }
+  }
+  if (rest > 1)
+    radix.push_back(rest);
+  // twiddles of each pass: tw[k*R+r] = exp(-2 pi i r k/(Ns R)), k<Ns
+  int Ns = 1;
+  for (size_t p = 0; p < radix.size(); p++){
+    int R = radix[p];
+    for (int k = 0; k < Ns; k++)
+      for (int r = 0; r < R; r++)
+        twiddle.push_back(std::polar(1.0, -2 * M_PI*r*k / (Ns*R)));
+    Ns *= R;
+  }
+}
+
+int fftPlan::size(){
+  return N;
+}
+
+int fftPlan::goodSize(int n){
+  for (int m = MAX(n, 1);; m++){
+    int rest = m;
+    while (rest % 2 == 0) rest /= 2;
+    while (rest % 3 == 0) rest /= 3;
+    while (rest % 5 == 0) rest /= 5;
+    if (rest == 1)
+      return m;
+  }
+}
+
+void fftPlan::pass(int R, int Ns, const std::complex<double> *tw, const std::complex<double> *x, std::complex<double> *y, bool inverse){
+  int stride = N / R;
+  if (R == 2){
+    for (int j = 0; j < stride; j++){
+      int k = j%Ns;
+      std::complex<double> w = inverse ? std::conj(tw[k * 2 + 1]) : tw[k * 2 + 1];
+      std::complex<double> a = x[j], b = x[j + stride] * w;
+      int out = (j / Ns)*Ns * 2 + k;
+      y[out] = a + b;
+      y[out + Ns] = a - b;
+    }
+    return;
+  }
+  std::vector<std::complex<double> > roots(R), v(R);
+  for (int r = 0; r < R; r++)
+    roots[r] = std::polar(1.0, (inverse ? 2 : -2) * M_PI*r / R);
+  for (int j = 0; j < stride; j++){
+    int k = j%Ns;
+    for (int r = 0; r < R; r++)
+      v[r] = x[j + r*stride] * (inverse ? std::conj(tw[k*R + r]) : tw[k*R + r]);
+    int out = (j / Ns)*Ns*R + k;
+    for (int s = 0; s < R; s++){
+      std::complex<double> sum = 0;
+      for (int r = 0; r < R; r++)
+        sum += v[r] * roots[(r*s) % R];
+      y[out + s*Ns] = sum;
+    }
+  }
+}
+
+void fftPlan::transform(std::complex<double> *data, int stride, bool inverse, std::complex<double> *scratch){
+  std::complex<double> *x = scratch, *y = scratch + N;
+  for (int i = 0; i < N; i++)
+    x[i] = data[i*stride];
+  int Ns = 1;
+  const std::complex<double> *tw = twiddle.empty() ? NULL : &twiddle[0];
+  for (size_t p = 0; p < radix.size(); p++){
+    int R = radix[p];
+    pass(R, Ns, tw, x, y, inverse);
+    tw += Ns*R;
+    Ns *= R;
+    std::swap(x, y);
+  }
+  for (int i = 0; i < N; i++)
+    data[i*stride] = x[i];
+}
+//************** END FFT ******
+
+//*************************BIG ARRAYS******************************
+std::map<void*, bigArrays::arrayRecord> bigArrays::records;
+size_t bigArrays::taggedBytes[MEM_NTAGS] = { 0 };
+size_t bigArrays::peakBytes[MEM_NTAGS] = { 0 };
+hugePagesMode bigArrays::hugePages = HUGE_PAGES_OFF;
+bool bigArrays::hugePagesWarningDone = false;
+
+void bigArrays::setHugePages(hugePagesMode mode){
+  hugePages = mode;
+}
+
+// the byte range of the calling thread: the units are split like a schedule(static) loop
+void bigArrays::threadRange(size_t bytes, long int touchUnits, size_t &begin, size_t &end){
+  int nthreads = 1, ithread = 0;
+#ifdef _OPENMP
+  nthreads = omp_get_num_threads();
+  ithread = omp_get_thread_num();
+#endif
+  if (touchUnits < 1)
+    touchUnits = 1;
+  long int q = touchUnits / nthreads, r = touchUnits % nthreads;
+  long int u0 = ithread*q + MIN((long int)ithread, r);
+  long int u1 = u0 + q + ((ithread < r) ? 1 : 0);
+  double unitBytes = (double)bytes / touchUnits;
+  begin = (size_t)(u0*unitBytes);
+  end = (u1 == touchUnits) ? bytes : (size_t)(u1*unitBytes);
+}
+
+void bigArrays::parallelZero(void *ptr, size_t bytes, long int touchUnits){
+#pragma omp parallel
+  {
+    size_t begin, end;
+    threadRange(bytes, touchUnits, begin, end);
+    if (end > begin)
+      memset((char*)ptr + begin, 0, end - begin);
+  }
+}
+
+long int bigArrays::gridTouchUnits(int *N_grid){
+  if (N_grid[2] > 1)
+    return N_grid[2];
+  if (N_grid[1] > 1)
+    return N_grid[1];
+  return N_grid[0];
+}
+
+void *bigArrays::rawAllocate(size_t bytes, bool &mapped){
+  void *ptr = NULL;
+  mapped = false;
+  bool huge = (hugePages != HUGE_PAGES_OFF && bytes >= HUGE_PAGE_SIZE);
+#if defined(_MSC_VER)
+  ptr = _aligned_malloc(bytes, BIG_ARRAYS_ALIGNMENT);
+#else
+#ifdef MAP_HUGETLB
+  if (huge && hugePages == HUGE_PAGES_EXPLICIT){
+    size_t mappedBytes = ((bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE)*HUGE_PAGE_SIZE;
+    ptr = mmap(NULL, mappedBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr == MAP_FAILED){
+      ptr = NULL;
+      if (!hugePagesWarningDone){
+        printf("WARNING: no explicit huge pages available, using transparent huge pages\n");
+        hugePagesWarningDone = true;
+      }
+    }
+    else
+      mapped = true;
+  }
+#endif
+  if (ptr == NULL){
+    if (posix_memalign(&ptr, huge ? HUGE_PAGE_SIZE : BIG_ARRAYS_ALIGNMENT, bytes))
+      ptr = NULL;
+#ifdef MADV_HUGEPAGE
+    if (ptr != NULL && huge)
+      madvise(ptr, (bytes / HUGE_PAGE_SIZE)*HUGE_PAGE_SIZE, MADV_HUGEPAGE);
+#endif
+  }
+#endif
+  if (ptr == NULL){
+    printf("ERROR: cannot allocate %.1f MB\n", bytes / (1024.0*1024.0));
+    exit(17);
+  }
+  return ptr;
+}
+
+void *bigArrays::allocate(size_t bytes, memoryTag tag, long int touchUnits){
+  bytes = MAX(bytes, (size_t)BIG_ARRAYS_ALIGNMENT);
+  arrayRecord rec;
+  void *ptr = rawAllocate(bytes, rec.mapped);
+  parallelZero(ptr, bytes, touchUnits);
+  rec.bytes = rec.used = bytes;
+  rec.tag = tag;
+  records[ptr] = rec;
+  taggedBytes[tag] += bytes;
+  peakBytes[tag] = MAX(peakBytes[tag], taggedBytes[tag]);
+  return ptr;
+}
+
+// the old content is copied by the same threads that first touch the new pages,
+// the bytes beyond the old content are zero as with allocate
+void *bigArrays::reallocate(void *ptr, size_t bytes, memoryTag tag, long int touchUnits){
+  std::map<void*, arrayRecord>::iterator old = records.find(ptr);
+  if (old == records.end())
+    return allocate(bytes, tag, touchUnits);
+  bytes = MAX(bytes, (size_t)BIG_ARRAYS_ALIGNMENT);
+  size_t capacity = old->second.bytes, used = old->second.used;
+  if (bytes <= capacity && bytes >= capacity / BIG_ARRAYS_SHRINK_FACTOR){
+    if (bytes > used)
+      parallelZero((char*)ptr + used, bytes - used, touchUnits);
+    old->second.used = bytes;
+    return ptr;
+  }
+  size_t kept = MIN(bytes, used);
+  if (bytes > capacity)
+    capacity = MAX(bytes, (size_t)(BIG_ARRAYS_GROWTH_FACTOR*capacity));
+  else
+    capacity = bytes;
+  arrayRecord rec;
+  void *newPtr = rawAllocate(capacity, rec.mapped);
+#pragma omp parallel
+  {
+    size_t begin, end;
+    threadRange(capacity, touchUnits, begin, end);
+    if (begin < kept)
+      memcpy((char*)newPtr + begin, (char*)ptr + begin, MIN(end, kept) - begin);
+    begin = MAX(begin, kept);
+    if (end > begin)
+      memset((char*)newPtr + begin, 0, end - begin);
+  }
+  release(ptr);
+  rec.bytes = capacity;
+  rec.used = bytes;
+  rec.tag = tag;
+  records[newPtr] = rec;
+  taggedBytes[tag] += capacity;
+  peakBytes[tag] = MAX(peakBytes[tag], taggedBytes[tag]);
+  return newPtr;
+}
+
+void bigArrays::release(void *ptr){
+  if (ptr == NULL)
+    return;
+  std::map<void*, arrayRecord>::iterator it = records.find(ptr);
+  if (it == records.end()){
+    free(ptr);
+    return;
+  }
+  taggedBytes[it->second.tag] -= it->second.bytes;
+#if defined(_MSC_VER)
+  _aligned_free(ptr);
+#else
+  if (it->second.mapped)
+    munmap(ptr, ((it->second.bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE)*HUGE_PAGE_SIZE);
+  else
+    free(ptr);
+#endif
+  records.erase(it);
+}
+
+void bigArrays::printMemoryReport(MPI_Comm comm, int master){
+  const char *names[MEM_NTAGS] = { "fields", "currents", "particles", "spectral" };
+  const char *modes[3] = { "off", "transparent", "explicit" };
+  double local[2 * MEM_NTAGS], maxima[2 * MEM_NTAGS], sums[2 * MEM_NTAGS];
+  for (int t = 0; t < MEM_NTAGS; t++){
+    local[t] = taggedBytes[t] / (1024.0*1024.0);
+    local[t + MEM_NTAGS] = peakBytes[t] / (1024.0*1024.0);
+  }
+  MPI_Reduce(local, maxima, 2 * MEM_NTAGS, MPI_DOUBLE, MPI_MAX, master, comm);
+  MPI_Reduce(local, sums, 2 * MEM_NTAGS, MPI_DOUBLE, MPI_SUM, master, comm);
+  int myid;
+  MPI_Comm_rank(comm, &myid);
+  if (myid != master)
+    return;
+  printf("memory report (MB), huge pages %s\n", modes[hugePages]);
+  printf("  %-10s %14s %14s %14s %14s\n", "", "now max rank", "peak max rank", "now all ranks", "peak all ranks");
+  for (int t = 0; t < MEM_NTAGS; t++)
+    printf("  %-10s %14.1f %14.1f %14.1f %14.1f\n", names[t], maxima[t], maxima[t + MEM_NTAGS], sums[t], sums[t + MEM_NTAGS]);
+  fflush(stdout);
+}
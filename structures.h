@@ -22,8 +22,14 @@ along with piccante.  If not, see <http://www.gnu.org/licenses/>.
 
 #define _USE_MATH_DEFINES
 
+#include <mpi.h>
 #include <cmath>
+#include <cstring>
+#include <vector>
+#include <complex>
+#include <map>
 #include "commons.h"
+#include "grid.h"
 #if defined(_MSC_VER)
 #include "gsl/gsl_rng.h" // gnu scientific linux per generatore di numeri casuali
 #include "gsl/gsl_randist.h"
@@ -202,5 +208,115 @@ private:
 
 };
 
+//************** DIGITAL FILTERS *******
+enum filterDir{
+  dir_x = 1 << 0,
+  dir_y = 1 << 1,
+  dir_z = 1 << 2
+};
+
+#define MAX_FILTER_PASSES 16
+
+// a stack of 3-point passes y_i = alpha*x_i + 0.5*(1-alpha)*(x_{i-1}+x_{i+1})
+// alpha=0.5 is the binomial pass, the compensator cancels the k^2 term of the binomials before it
+class filterStack{
+public:
+  int Npasses;
+  double alpha[MAX_FILTER_PASSES];
+
+  filterStack();
+  void clear();
+  void addPass(double _alpha);
+  void addBinomial(int times);
+  void addCompensator();
+
+  template <class T> void applyAlong(GRID *grid, int direction, T *origin, int stride[3], int ncomp, int *comps);
+
+private:
+  int Nbinomial;
+  void filterLine(double *line, double *work, int Nline);
+};
+
+//************** PACKED REDUCTION *******
+// sums, minima and maxima from several objects reduced with a single MPI_Allreduce:
+// each object adds its local values and reads the global ones back from the returned offset
+class packedReduction{
+public:
+  packedReduction();
+  void clear();
+  int addSums(double *values, int n);
+  int addMinima(double *values, int n);
+  int addMaxima(double *values, int n);
+  void allreduce(MPI_Comm comm);
+  void getSums(int offset, double *values, int n);
+  void getMinima(int offset, double *values, int n);
+  void getMaxima(int offset, double *values, int n);
+
+private:
+  std::vector<double> sums, mins, maxs;
+  static MPI_Op packedOp;
+  static bool packedOpCreated;
+  static void packedOpFunction(void *invec, void *inoutvec, int *len, MPI_Datatype *datatype);
+};
+
+//************** FFT *******
+// unnormalized complex FFT of any length: Stockham passes for every prime factor
+// (radix 2 unrolled, plain DFT for the others, so a prime factor p costs O(N*p): see goodSize).
+// The plan is read-only once built, so several threads can share it as long as each one
+// passes its own scratch (2*N values)
+class fftPlan{
+public:
+  fftPlan();
+  void init(int n);
+  int size();
+  void transform(std::complex<double> *data, int stride, bool inverse, std::complex<double> *scratch);
+  static int goodSize(int n);
+
+private:
+  int N;
+  std::vector<int> radix;
+  std::vector<std::complex<double> > twiddle;
+  void pass(int R, int Ns, const std::complex<double> *tw, const std::complex<double> *x, std::complex<double> *y, bool inverse);
+};
+
+//************** BIG ARRAYS *******
+// fields, currents and particles are allocated aligned (on the huge page size when huge pages are on)
+// and first touched by the OpenMP threads with the static schedule of the loops that sweep them, so
+// on a multi-socket node every page lands next to the thread that works on it.
+// touchUnits is the trip count of that loop (the outermost grid axis, the number of particles)
+// reallocate works in place while the new size fits the block and is at least 1/BIG_ARRAYS_SHRINK_FACTOR
+// of it, a new block grows by BIG_ARRAYS_GROWTH_FACTOR at least
+enum memoryTag{ MEM_FIELDS, MEM_CURRENT, MEM_PARTICLES, MEM_SPECTRAL, MEM_NTAGS };
+enum hugePagesMode{ HUGE_PAGES_OFF, HUGE_PAGES_TRANSPARENT, HUGE_PAGES_EXPLICIT };
+
+#define BIG_ARRAYS_ALIGNMENT 64
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define BIG_ARRAYS_SHRINK_FACTOR 4
+#define BIG_ARRAYS_GROWTH_FACTOR 1.5
+
+class bigArrays{
+public:
+  static void setHugePages(hugePagesMode mode);
+  static void *allocate(size_t bytes, memoryTag tag, long int touchUnits);
+  static void *reallocate(void *ptr, size_t bytes, memoryTag tag, long int touchUnits);
+  static void release(void *ptr);
+  static void parallelZero(void *ptr, size_t bytes, long int touchUnits);
+  static long int gridTouchUnits(int *N_grid);
+  static void printMemoryReport(MPI_Comm comm, int master);
+
+private:
+  struct arrayRecord{
+    size_t bytes, used;
+    memoryTag tag;
+    bool mapped;
+  };
+  static std::map<void*, arrayRecord> records;
+  static size_t taggedBytes[MEM_NTAGS], peakBytes[MEM_NTAGS];
+  static hugePagesMode hugePages;
+  static bool hugePagesWarningDone;
+  static void *rawAllocate(size_t bytes, bool &mapped);
+  static void threadRange(size_t bytes, long int touchUnits, size_t &begin, size_t &end);
+};
+
 #endif
 
@@ -0,0 +1,173 @@
+/* Copyright 2014 - Andrea Sgattoni, Luca Fedeli, Stefano Sinigardi */
+
+/*******************************************************************************
+This file is part of piccante.
+
+piccante is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+piccante is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with piccante.  If not, see <http://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+//minimal consumer of the streamed outputs (OUTPUT_MANAGER::setStreaming): it listens on a unix
+//socket, prints one line per frame and, with -o dir, writes each block at its offset of dir/<name>
+//usage: stream_consumer socketPath [-o dir] [-x]   (-x: exit when no processor is connected any more)
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define STREAM_FRAME_MAGIC 0x50494353
+
+//same layout as in output_manager.h
+struct streamFrameHeader{
+  int magic;
+  int task, tasks;
+  int nameLength;
+  int box[6];
+  int64_t fileOffset;
+  int64_t bytes;
+};
+
+struct client{
+  int fd;
+  std::vector<char> data;
+};
+
+std::string outputDir;
+
+//returns the number of bytes used, 0 if the frame is not complete yet, -1 if the stream is corrupted
+long int processFrame(const char *data, size_t size){
+  streamFrameHeader header;
+  if (size < sizeof(header))
+    return 0;
+  memcpy(&header, data, sizeof(header));
+  if (header.magic != STREAM_FRAME_MAGIC || header.nameLength < 0 || header.bytes < 0)
+    return -1;
+  size_t frameBytes = sizeof(header) + header.nameLength + header.bytes;
+  if (size < frameBytes)
+    return 0;
+  std::string name(data + sizeof(header), header.nameLength);
+  printf("%s task %d/%d offset %lld bytes %lld box %d %d %d %d %d %d\n", name.c_str(), header.task, header.tasks,
+    (long long)header.fileOffset, (long long)header.bytes,
+    header.box[0], header.box[1], header.box[2], header.box[3], header.box[4], header.box[5]);
+  fflush(stdout);
+  if (outputDir.size()){
+    std::string fileName = outputDir + "/" + name;
+    int fd = open(fileName.c_str(), O_WRONLY | O_CREAT, 0644);
+    if (fd < 0){
+      printf("ERROR: cannot open %s\n", fileName.c_str());
+      exit(17);
+    }
+    const char *payload = data + sizeof(header) + header.nameLength;
+    int64_t written = 0;
+    while (written < header.bytes){
+      ssize_t n = pwrite(fd, payload + written, header.bytes - written, header.fileOffset + written);
+      if (n < 0){
+        printf("ERROR: cannot write %s\n", fileName.c_str());
+        exit(17);
+      }
+      written += n;
+    }
+    close(fd);
+  }
+  return (long int)frameBytes;
+}
+
+int main(int narg, char **args){
+  if (narg < 2){
+    printf("usage: %s socketPath [-o dir] [-x]\n", args[0]);
+    return 1;
+  }
+  std::string socketPath = args[1];
+  bool exitWhenIdle = false;
+  for (int i = 2; i < narg; i++){
+    if (!strcmp(args[i], "-o") && i + 1 < narg)
+      outputDir = args[++i];
+    else if (!strcmp(args[i], "-x"))
+      exitWhenIdle = true;
+  }
+
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (socketPath.size() >= sizeof(address.sun_path)){
+    printf("ERROR: socket path too long\n");
+    return 17;
+  }
+  strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+  unlink(socketPath.c_str());
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 1024) != 0){
+    printf("ERROR: cannot listen on %s\n", socketPath.c_str());
+    return 17;
+  }
+
+  std::vector<client> clients;
+  bool anyConnection = false;
+  char buffer[1 << 16];
+  while (!(exitWhenIdle && anyConnection && clients.empty())){
+    std::vector<struct pollfd> pfd(clients.size() + 1);
+    pfd[0].fd = listener;
+    pfd[0].events = POLLIN;
+    for (size_t c = 0; c < clients.size(); c++){
+      pfd[c + 1].fd = clients[c].fd;
+      pfd[c + 1].events = POLLIN;
+    }
+    if (poll(&pfd[0], pfd.size(), -1) < 0){
+      if (errno == EINTR)
+        continue;
+      printf("ERROR: poll failed\n");
+      return 17;
+    }
+    if (pfd[0].revents & POLLIN){
+      client newClient;
+      newClient.fd = accept(listener, NULL, NULL);
+      if (newClient.fd >= 0){
+        clients.push_back(newClient);
+        anyConnection = true;
+      }
+    }
+    for (size_t c = pfd.size() - 1; c >= 1; c--){
+      if (!(pfd[c].revents & (POLLIN | POLLHUP | POLLERR)))
+        continue;
+      client &cl = clients[c - 1];
+      ssize_t n = read(cl.fd, buffer, sizeof(buffer));
+      if (n > 0){
+        cl.data.insert(cl.data.end(), buffer, buffer + n);
+        size_t used = 0;
+        long int frameBytes;
+        while ((frameBytes = processFrame(&cl.data[0] + used, cl.data.size() - used)) > 0)
+          used += frameBytes;
+        cl.data.erase(cl.data.begin(), cl.data.begin() + used);
+        if (frameBytes == 0)
+          continue;
+        printf("WARNING: corrupted stream, connection closed\n");
+      }
+      else if (n < 0 && errno == EINTR)
+        continue;
+      close(cl.fd);
+      clients.erase(clients.begin() + (c - 1));
+    }
+  }
+  close(listener);
+  unlink(socketPath.c_str());
+  return 0;
+}
@@ -28,6 +28,18 @@ void moveWindow(GRID* _mygrid, EM_FIELD* _myfield, std::vector<SPECIE*> _myspeci
   }
 }
 
+void updateActiveRegion(GRID* _mygrid, EM_FIELD* _myfield, std::vector<SPECIE*> _myspecies){
+  if (!_mygrid->shouldICheckActiveRegion())
+    return;
+  std::vector<int> activity(_mygrid->getNActiveTiles(), 0);
+  _myfield->markActiveTiles(activity);
+  for (std::vector<SPECIE*>::iterator spec_iterator = _myspecies.begin(); spec_iterator != _myspecies.end(); spec_iterator++){
+    (*spec_iterator)->markActiveTiles(activity);
+  }
+  MPI_Allreduce(MPI_IN_PLACE, &activity[0], (int)activity.size(), MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+  _mygrid->setActiveTiles(activity);
+}
+
 void restartFromDump(int *_dumpID, GRID* mygrid, EM_FIELD* myfield, std::vector<SPECIE*> species){
   int dumpID = _dumpID[0];
   std::ifstream dumpFile;
@@ -43,6 +43,7 @@ along with piccante.  If not, see <http://www.gnu.org/licenses/>.
 #include "particle_species.h"
 
 void moveWindow(GRID* _mygrid, EM_FIELD* _myfield, std::vector<SPECIE*> _myspecies);
+void updateActiveRegion(GRID* _mygrid, EM_FIELD* _myfield, std::vector<SPECIE*> _myspecies);
 
 void restartFromDump(int *dumpID, GRID* _mygrid, EM_FIELD* _myfield, std::vector<SPECIE*> _myspecies);
 void dumpFilesForRestart(int *dumpID, GRID* _mygrid, EM_FIELD* _myfield, std::vector<SPECIE*> _myspecies);